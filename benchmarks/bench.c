@@ -0,0 +1,293 @@
+// Benchmarks of the simulator itself, in simulated accesses per host second.
+//
+// Usage: bench [--runs <runs>] [<instructions_file>...]
+//
+// Microbenchmarks time the hot paths of a single simulation directly, and
+// every trace given on the command line is timed end to end through the
+// library interface. Results are printed as CSV, one line per benchmark, so
+// runs of different versions can be compared:
+//
+//   version,benchmark,accesses,runs,mean,stddev,min,max
+//
+// where `accesses` is the number of simulated accesses of a single run, and
+// the remaining columns are accesses per host second over `runs` timed runs.
+
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "constants.h"
+#include "log.h"
+#include "page_table.h"
+#include "simulator.h"
+#include "tlb.h"
+#include "tlbsim.h"
+#include "trace.h"
+
+#ifndef BENCH_VERSION
+#define BENCH_VERSION "unknown"
+#endif
+
+#define DEFAULT_RUNS 10
+#define MICRO_ACCESSES (1 << 20)
+
+// End to end runs replay short traces until they reach this many accesses,
+// so a run is long enough to be timed.
+#define MIN_E2E_ACCESSES (1 << 18)
+
+static inline va_t page_address(va_t virtual_page_number) {
+  return virtual_page_number << PAGE_SIZE_BITS;
+}
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// ========================================================================
+// Microbenchmarks.
+// ========================================================================
+
+typedef struct {
+  const char* name;
+  // Options of the simulation, as taken by tlbsim_create().
+  const char* options;
+  // Brings the fresh simulation to the state measured by `run`. Not timed.
+  void (*setup)();
+  // Returns the number of simulated accesses.
+  uint64_t (*run)();
+} micro_benchmark_t;
+
+static void touch_pages(uint64_t pages) {
+  for (uint64_t page = 0; page < pages; page++) {
+    tlb_translate(page_address(page), OP_READ);
+  }
+}
+
+static uint64_t translate_cycling(uint64_t pages) {
+  for (uint64_t i = 0; i < MICRO_ACCESSES; i++) {
+    tlb_translate(page_address(i % pages), OP_READ);
+  }
+  return MICRO_ACCESSES;
+}
+
+// Half of the L1 TLB: every translation hits in L1.
+static void setup_l1_hit() { touch_pages(TLB_L1_SIZE / 2); }
+static uint64_t run_l1_hit() { return translate_cycling(TLB_L1_SIZE / 2); }
+
+// Cycling over more pages than L1 holds, but fewer than L2 does: every
+// translation misses in L1 and hits in L2, so find_new_tlb_entry() has to
+// pick an L1 victim each time.
+static void setup_l2_hit() { touch_pages(TLB_L2_SIZE / 2); }
+static uint64_t run_l2_hit() { return translate_cycling(TLB_L2_SIZE / 2); }
+
+// Cycling over more pages than L2 holds, all resident in DRAM: every
+// translation walks the page table and refills both full TLB levels.
+#define MISS_PAGES (TLB_L2_SIZE * 8)
+static void setup_miss() { touch_pages(MISS_PAGES); }
+static uint64_t run_miss() { return translate_cycling(MISS_PAGES); }
+
+// Allocates every free DRAM frame.
+static void setup_allocate() {}
+static uint64_t run_allocate() {
+  uint64_t allocated = 0;
+  pa_dram_t dram_page_address;
+  while (allocate_dram_page(&dram_page_address)) {
+    allocated++;
+  }
+  return allocated;
+}
+
+// Fills DRAM, then evicts every resident page.
+static void setup_evict() {
+  touch_pages(config_dram_page_capacity(&sim->config));
+}
+static uint64_t run_evict() {
+  uint64_t pages = get_total_page_faults() - get_total_page_evictions();
+  for (uint64_t i = 0; i < pages; i++) {
+    evict_page_from_dram();
+  }
+  return pages;
+}
+
+static const micro_benchmark_t micro_benchmarks[] = {
+    {"tlb_translate_l1_hit", NULL, setup_l1_hit, run_l1_hit},
+    {"tlb_translate_l2_hit", NULL, setup_l2_hit, run_l2_hit},
+    {"tlb_translate_miss", NULL, setup_miss, run_miss},
+    {"allocate_dram_page", NULL, setup_allocate, run_allocate},
+    {"evict_page_from_dram", NULL, setup_evict, run_evict},
+};
+
+// ========================================================================
+// Reporting.
+// ========================================================================
+
+typedef struct {
+  uint64_t accesses;
+  int runs;
+  double* rates;
+} result_t;
+
+static void report(const char* name, const result_t* result) {
+  double sum = 0;
+  double min = INFINITY;
+  double max = 0;
+  for (int i = 0; i < result->runs; i++) {
+    sum += result->rates[i];
+    min = fmin(min, result->rates[i]);
+    max = fmax(max, result->rates[i]);
+  }
+  double mean = sum / result->runs;
+
+  double squares = 0;
+  for (int i = 0; i < result->runs; i++) {
+    squares += (result->rates[i] - mean) * (result->rates[i] - mean);
+  }
+  double stddev = result->runs > 1 ? sqrt(squares / (result->runs - 1)) : 0;
+
+  printf("%s,%s,%" PRIu64 ",%d,%.0f,%.0f,%.0f,%.0f\n", BENCH_VERSION, name,
+         result->accesses, result->runs, mean, stddev, min, max);
+  fflush(stdout);
+}
+
+// ========================================================================
+// Benchmarks.
+// ========================================================================
+
+static void run_micro_benchmark(const micro_benchmark_t* benchmark,
+                                result_t* result) {
+  // The first run only warms up the host caches and allocator.
+  for (int run = -1; run < result->runs; run++) {
+    tlbsim_ctx* ctx = tlbsim_create(benchmark->options);
+    sim = ctx;
+    benchmark->setup();
+
+    double start = now_seconds();
+    uint64_t accesses = benchmark->run();
+    double elapsed = now_seconds() - start;
+
+    sim = NULL;
+    tlbsim_destroy(ctx);
+
+    if (run >= 0) {
+      result->accesses = accesses;
+      result->rates[run] = accesses / elapsed;
+    }
+  }
+}
+
+static tlbsim_op_t* load_trace(const char* path, uint64_t* total) {
+  trace_t trace;
+  trace_open(&trace, path);
+
+  uint64_t capacity = 1024;
+  tlbsim_op_t* ops = malloc(capacity * sizeof(tlbsim_op_t));
+  *total = 0;
+
+  instruction_t instruction;
+  while (trace_next(&trace, &instruction)) {
+    if (*total == capacity) {
+      capacity *= 2;
+      ops = realloc(ops, capacity * sizeof(tlbsim_op_t));
+    }
+    if (!ops) {
+      panic("Failed to allocate the instructions of %s", path);
+    }
+    ops[*total].address = instruction.address;
+    ops[*total].core = instruction.core;
+    ops[*total].write = instruction.op == OP_WRITE;
+    ops[*total].asid = instruction.asid;
+    (*total)++;
+  }
+
+  trace_close(&trace);
+  return ops;
+}
+
+// Simulates the whole trace from a fresh state, as many times as needed to
+// reach MIN_E2E_ACCESSES accesses per run. Only the simulation is timed, not
+// the creation and resets of the context, so short traces compare with long
+// ones.
+static void run_trace_benchmark(const char* path, result_t* result) {
+  uint64_t total;
+  tlbsim_op_t* ops = load_trace(path, &total);
+  if (!total) {
+    panic("%s holds no instructions", path);
+  }
+  uint64_t repeat = (MIN_E2E_ACCESSES + total - 1) / total;
+
+  for (int run = -1; run < result->runs; run++) {
+    double elapsed = 0;
+    tlbsim_ctx* ctx = tlbsim_create(NULL);
+    for (uint64_t i = 0; i < repeat; i++) {
+      if (i) {
+        tlbsim_reset(ctx);
+      }
+      double start = now_seconds();
+      tlbsim_access(ctx, ops, total);
+      elapsed += now_seconds() - start;
+    }
+    tlbsim_destroy(ctx);
+
+    if (run >= 0) {
+      result->accesses = repeat * total;
+      result->rates[run] = result->accesses / elapsed;
+    }
+  }
+
+  free(ops);
+}
+
+int main(int argc, char* argv[]) {
+  int runs = DEFAULT_RUNS;
+
+  static const struct option long_options[] = {
+      {"runs", required_argument, NULL, 'r'},
+      {NULL, 0, NULL, 0},
+  };
+  int option;
+  while ((option = getopt_long(argc, argv, "r:", long_options, NULL)) != -1) {
+    switch (option) {
+      case 'r':
+        runs = atoi(optarg);
+        if (runs < 1) {
+          panic("Invalid number of runs: %s", optarg);
+        }
+        break;
+      default:
+        printf("Usage: %s [--runs <runs>] [<instructions_file>...]\n",
+               argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  result_t result = {0, runs, calloc(runs, sizeof(double))};
+  if (!result.rates) {
+    panic("Failed to allocate %d runs", runs);
+  }
+
+  printf("version,benchmark,accesses,runs,mean,stddev,min,max\n");
+
+  for (size_t i = 0; i < sizeof(micro_benchmarks) / sizeof(micro_benchmarks[0]);
+       i++) {
+    run_micro_benchmark(&micro_benchmarks[i], &result);
+    report(micro_benchmarks[i].name, &result);
+  }
+
+  for (int i = optind; i < argc; i++) {
+    const char* name = strrchr(argv[i], '/');
+    name = name ? name + 1 : argv[i];
+
+    char label[256];
+    snprintf(label, sizeof(label), "e2e/%s", name);
+    run_trace_benchmark(argv[i], &result);
+    report(label, &result);
+  }
+
+  free(result.rates);
+  return 0;
+}
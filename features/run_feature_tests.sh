@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Checks of the simulator features beyond the reference model, against
+# pinned outputs. Sourced by the run_tlbsim_*_tests.sh scripts, from the
+# repository root, after the build.
+
+FEATURE_INPUTS_DIR=features/inputs
+FEATURE_OUTPUTS_DIR=features/outputs
+
+# Compares reports/<name>.out with an expected output, like the reference
+# tests do.
+check_feature_output() {
+    local name=$1
+    local expected_output_file=$2
+    local report_file=reports/$name.diff
+
+    echo "#####################################################################" > $report_file
+    echo "# Feature: $name" >> $report_file
+    echo "# Left side: expected ($expected_output_file)" >> $report_file
+    echo "# Right side: actual (reports/$name.out)" >> $report_file
+    echo "#####################################################################" >> $report_file
+
+    if diff -y --expand-tabs $expected_output_file reports/$name.out >> $report_file; then
+        echo "# Test $name passed" >> $report_file
+    else
+        echo "# Test $name failed" >> $report_file
+    fi
+}
+
+# LRU hit ratios of a trace whose stack distances are, in order,
+# inf inf inf 3 3 3 inf 4 2 1.
+echo "Running feature test stack_distance -> reports/stack_distance.diff"
+./build/tlbsim -v summary --stack-distance 4 \
+    $FEATURE_INPUTS_DIR/stack_distance.txt > reports/stack_distance.out
+check_feature_output stack_distance $FEATURE_OUTPUTS_DIR/stack_distance.out
+
+# A run saved halfway and resumed prints the events of the uninterrupted run.
+echo "Running feature test checkpoint_round_trip -> reports/checkpoint_round_trip.diff"
+./build/tlbsim --checkpoint reports/checkpoint_round_trip.ckpt --checkpoint-at 60000 \
+    inputs/single_page_eviction.txt 2> /dev/null | grep '^\[' > reports/checkpoint_round_trip.out
+./build/tlbsim --restore reports/checkpoint_round_trip.ckpt \
+    inputs/single_page_eviction.txt 2> /dev/null >> reports/checkpoint_round_trip.out
+check_feature_output checkpoint_round_trip outputs/tlbsim-l2/single_page_eviction.out
+
+# Dirty pages evicted to swap clusters in FIFO order, then read back in order,
+# mostly from the pages read ahead.
+echo "Running feature test swap_readahead -> reports/swap_readahead.diff"
+./build/tlbsim --page-policy fifo --dram-bits 16 --swap-cluster 8 --swap-readahead 4 \
+    $FEATURE_INPUTS_DIR/swap_readahead.txt > reports/swap_readahead.out 2> /dev/null
+check_feature_output swap_readahead $FEATURE_OUTPUTS_DIR/swap_readahead.out
+
+# Digests of a run, and of the reference output it matches.
+echo "Running feature test digest -> reports/digest.diff"
+./build/tlbsim --digest 50000 inputs/single_page_eviction.txt > reports/digest.out 2> /dev/null
+check_feature_output digest $FEATURE_OUTPUTS_DIR/digest.out
+
+echo "Running feature test digest_of -> reports/digest_of.diff"
+./build/tlbsim --digest 50000 --digest-of outputs/tlbsim-l2/single_page_eviction.out \
+    > reports/digest_of.out
+check_feature_output digest_of $FEATURE_OUTPUTS_DIR/digest.out
@@ -11,6 +11,8 @@ mkdir -p reports
 
 make -j
 
+source features/run_feature_tests.sh
+
 for input in inputs/*; do
     input_file=$(basename "$input" .txt)
 
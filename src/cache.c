@@ -0,0 +1,282 @@
+#include "cache.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "checkpoint.h"
+#include "log.h"
+#include "simulator.h"
+
+typedef struct {
+  // Line address, that is the physical address without its offset in the
+  // line.
+  pa_dram_t line;
+  // Access count of the cache at the last access to the line, for LRU.
+  uint64_t last_use;
+  bool valid;
+  bool dirty;
+  // Whether the line was filled by an access of the MMU.
+  bool mmu;
+} cache_line_t;
+
+typedef struct {
+  cache_line_t* lines;
+  uint32_t sets;
+  uint32_t ways;
+  uint64_t accesses;
+  cache_stats_t stats;
+  // Taken when more than one core is simulated, as cores may run on
+  // different host threads. Only the LLC is shared by the accesses of the
+  // cores; the private levels are only shared with the invalidations of
+  // evicted pages, so cores rarely wait for each other above the LLC.
+  pthread_mutex_t lock;
+} cache_t;
+
+struct cache_state {
+  // Private levels of every core, then the shared LLC.
+  cache_t l1d[MAX_CORES];
+  cache_t l2[MAX_CORES];
+  cache_t llc;
+};
+
+static const char* cache_level_names[] = {
+    [CACHE_L1D] = "l1d",
+    [CACHE_L2] = "l2",
+    [CACHE_LLC] = "llc",
+};
+
+const char* cache_level_name(cache_level_t level) {
+  return cache_level_names[level];
+}
+
+static cache_t* cache_of(unsigned core, cache_level_t level) {
+  switch (level) {
+    case CACHE_L1D:
+      return &sim->caches->l1d[core];
+    case CACHE_L2:
+      return &sim->caches->l2[core];
+    default:
+      return &sim->caches->llc;
+  }
+}
+
+static void cache_level_init(cache_t* cache,
+                             const cache_level_config_t* config) {
+  uint32_t lines = config->size / sim->config.cache_line_bytes;
+  cache->ways = config->ways;
+  cache->sets = lines / config->ways;
+  cache->lines = calloc(lines, sizeof(cache_line_t));
+  if (!cache->lines) {
+    panic("Failed to allocate a cache of %u lines", lines);
+  }
+  pthread_mutex_init(&cache->lock, NULL);
+}
+
+static void cache_level_free(cache_t* cache) {
+  if (!cache->lines) {
+    return;
+  }
+  free(cache->lines);
+  pthread_mutex_destroy(&cache->lock);
+}
+
+void cache_init() {
+  cache_free();
+  if (!sim->config.cache_levels) {
+    return;
+  }
+
+  sim->caches = calloc(1, sizeof(struct cache_state));
+  if (!sim->caches) {
+    panic("Failed to allocate the caches");
+  }
+  for (cache_level_t level = 0; level < sim->config.cache_levels; level++) {
+    unsigned cores = level == CACHE_LLC ? 1 : sim->config.cores;
+    for (unsigned core = 0; core < cores; core++) {
+      cache_level_init(cache_of(core, level), &sim->config.caches[level]);
+    }
+  }
+}
+
+void cache_free() {
+  if (!sim->caches) {
+    return;
+  }
+  for (unsigned core = 0; core < MAX_CORES; core++) {
+    cache_level_free(&sim->caches->l1d[core]);
+    cache_level_free(&sim->caches->l2[core]);
+  }
+  cache_level_free(&sim->caches->llc);
+  free(sim->caches);
+  sim->caches = NULL;
+}
+
+void cache_checkpoint(checkpoint_t* checkpoint) {
+  if (!sim->caches) {
+    return;
+  }
+  for (cache_level_t level = 0; level < sim->config.cache_levels; level++) {
+    unsigned cores = level == CACHE_LLC ? 1 : sim->config.cores;
+    for (unsigned core = 0; core < cores; core++) {
+      cache_t* cache = cache_of(core, level);
+      checkpoint_array(checkpoint, cache->lines,
+                       (size_t)cache->sets * cache->ways,
+                       sizeof(cache_line_t));
+      checkpoint_value(checkpoint, cache->accesses);
+      checkpoint_value(checkpoint, cache->stats);
+    }
+  }
+}
+
+// Accesses lock the levels from the L1D down and hold them until they are
+// done, while invalidations hold a single level at a time, so the order
+// never inverts.
+static inline void lock_cache(cache_t* cache) {
+  if (sim->config.cores > 1) {
+    pthread_mutex_lock(&cache->lock);
+  }
+}
+
+static inline void unlock_cache(cache_t* cache) {
+  if (sim->config.cores > 1) {
+    pthread_mutex_unlock(&cache->lock);
+  }
+}
+
+static inline cache_line_t* cache_set(const cache_t* cache, pa_dram_t line) {
+  return &cache->lines[(line & (cache->sets - 1)) * cache->ways];
+}
+
+static void access_level(cache_level_t level, pa_dram_t line, op_t op,
+                         bool mmu, bool detailed);
+
+// Passes an access on to the level below `level`, or to DRAM below the last
+// one.
+static void access_below(cache_level_t level, pa_dram_t line, op_t op,
+                         bool mmu, bool detailed) {
+  if (level + 1 < sim->config.cache_levels) {
+    access_level(level + 1, line, op, mmu, detailed);
+  } else if (detailed) {
+    dram_access_uncached(line * sim->config.cache_line_bytes, op);
+  }
+}
+
+// Accesses that are not `detailed`, made while sampling warms up, only keep
+// the content of the caches current: they are neither counted nor timed, and
+// do not reach DRAM.
+static void access_cache(cache_t* cache, cache_level_t level, pa_dram_t line,
+                         op_t op, bool mmu, bool detailed) {
+  cache_stats_t ignored;
+  cache_stats_t* stats = detailed ? &cache->stats : &ignored;
+  if (detailed) {
+    increment_time(sim->config.caches[level].latency_ns);
+  }
+  uint64_t now = ++cache->accesses;
+  if (mmu) {
+    stats->mmu_accesses++;
+  }
+
+  cache_line_t* set = cache_set(cache, line);
+  cache_line_t* victim = &set[0];
+  for (uint32_t way = 0; way < cache->ways; way++) {
+    cache_line_t* entry = &set[way];
+    if (entry->valid && entry->line == line) {
+      stats->hits++;
+      if (mmu) {
+        stats->mmu_hits++;
+      }
+      entry->last_use = now;
+      if (op == OP_WRITE) {
+        if (sim->config.cache_write_through) {
+          access_below(level, line, OP_WRITE, mmu, detailed);
+        } else {
+          entry->dirty = true;
+        }
+      }
+      return;
+    }
+    if (victim->valid &&
+        (!entry->valid || entry->last_use < victim->last_use)) {
+      victim = entry;
+    }
+  }
+
+  stats->misses++;
+  if (op == OP_WRITE && !sim->config.cache_write_allocate) {
+    access_below(level, line, OP_WRITE, mmu, detailed);
+    return;
+  }
+
+  access_below(level, line, OP_READ, mmu, detailed);
+  if (victim->valid) {
+    if (victim->dirty) {
+      stats->writebacks++;
+      access_below(level, victim->line, OP_WRITE, victim->mmu, detailed);
+    }
+    if (mmu && !victim->mmu) {
+      stats->mmu_evictions++;
+    }
+  }
+
+  *victim = (cache_line_t){
+      .line = line, .last_use = now, .valid = true, .mmu = mmu};
+  if (op == OP_WRITE) {
+    if (sim->config.cache_write_through) {
+      access_below(level, line, OP_WRITE, mmu, detailed);
+    } else {
+      victim->dirty = true;
+    }
+  }
+}
+
+static void access_level(cache_level_t level, pa_dram_t line, op_t op,
+                         bool mmu, bool detailed) {
+  cache_t* cache = cache_of(get_core(), level);
+  lock_cache(cache);
+  access_cache(cache, level, line, op, mmu, detailed);
+  unlock_cache(cache);
+}
+
+void cache_access(pa_dram_t address, op_t op, bool mmu) {
+  access_level(CACHE_L1D, address / sim->config.cache_line_bytes, op, mmu,
+               !sim->warming);
+}
+
+void cache_invalidate_page(pa_dram_t dram_page_address) {
+  pa_dram_t first = dram_page_address / sim->config.cache_line_bytes;
+  pa_dram_t end = first + PAGE_SIZE_BYTES / sim->config.cache_line_bytes;
+
+  for (cache_level_t level = 0; level < sim->config.cache_levels; level++) {
+    unsigned cores = level == CACHE_LLC ? 1 : sim->config.cores;
+    for (unsigned core = 0; core < cores; core++) {
+      cache_t* cache = cache_of(core, level);
+      lock_cache(cache);
+      for (pa_dram_t line = first; line < end; line++) {
+        cache_line_t* set = cache_set(cache, line);
+        for (uint32_t way = 0; way < cache->ways; way++) {
+          if (set[way].valid && set[way].line == line) {
+            set[way].valid = false;
+          }
+        }
+      }
+      unlock_cache(cache);
+    }
+  }
+}
+
+void cache_get_stats(cache_level_t level, cache_stats_t* stats) {
+  *stats = (cache_stats_t){0};
+  if (!sim->caches || level >= sim->config.cache_levels) {
+    return;
+  }
+  unsigned cores = level == CACHE_LLC ? 1 : sim->config.cores;
+  for (unsigned core = 0; core < cores; core++) {
+    const cache_stats_t* core_stats = &cache_of(core, level)->stats;
+    stats->hits += core_stats->hits;
+    stats->misses += core_stats->misses;
+    stats->writebacks += core_stats->writebacks;
+    stats->mmu_accesses += core_stats->mmu_accesses;
+    stats->mmu_hits += core_stats->mmu_hits;
+    stats->mmu_evictions += core_stats->mmu_evictions;
+  }
+}
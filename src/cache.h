@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "memory.h"
+
+// Physically indexed data caches between the cores and DRAM, off by default.
+// Every core has a private L1D and L2, and the cores share the LLC; the first
+// `cache_levels` of them are simulated. Both the data accesses, once
+// translated, and the accesses of the MMU (page table walks and updates, and
+// write-backs of dirty TLB entries) go through them, so page walks compete
+// with the data for the lines.
+//
+// Lines are replaced in LRU order. Writes either mark the line dirty, to be
+// written to the next level once evicted, or are written through to it, and
+// write misses either fill the line or go straight to the next level. The
+// levels are neither inclusive nor coherent with each other.
+typedef enum {
+  CACHE_L1D,
+  CACHE_L2,
+  CACHE_LLC,
+  CACHE_LEVELS,
+} cache_level_t;
+
+typedef struct {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t writebacks;
+  // Accesses of the MMU, and hits among them.
+  uint64_t mmu_accesses;
+  uint64_t mmu_hits;
+  // Data lines evicted to make room for lines of the MMU.
+  uint64_t mmu_evictions;
+} cache_stats_t;
+
+// Sets up the caches of the current simulation, or resets them.
+void cache_init();
+void cache_free();
+
+struct checkpoint;
+// Saves or restores the caches of the current simulation.
+void cache_checkpoint(struct checkpoint* checkpoint);
+
+// Accesses a physical address from the current core, going down the levels
+// until one holds its line. `mmu` tells the accesses of the MMU apart from
+// data accesses. While sampling warms up, only the content of the caches is
+// updated.
+void cache_access(pa_dram_t address, op_t op, bool mmu);
+
+// Drops the lines of a DRAM frame from every cache, once the page it held is
+// evicted.
+void cache_invalidate_page(pa_dram_t dram_page_address);
+
+// Sums the statistics of a level over the cores.
+void cache_get_stats(cache_level_t level, cache_stats_t* stats);
+
+const char* cache_level_name(cache_level_t level);
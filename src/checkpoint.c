@@ -0,0 +1,166 @@
+#include "checkpoint.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "simulator.h"
+
+// Checkpoint layout:
+//
+//   magic            4 bytes  "TLBC"
+//   version          4 bytes  CHECKPOINT_VERSION
+//   config size      4 bytes  sizeof(config_t), to catch other builds
+//   config           the config_t of the simulation
+//   position         the checkpoint_position_t of the run
+//   state            every module, in the order simulator_checkpoint()
+//                    walks them
+//   end magic        4 bytes  "TLBE", to catch truncated checkpoints
+#define CHECKPOINT_MAGIC "TLBC"
+#define CHECKPOINT_END_MAGIC "TLBE"
+#define CHECKPOINT_VERSION 2
+
+void checkpoint_bytes(checkpoint_t* checkpoint, void* data, size_t size) {
+  if (checkpoint->restoring) {
+    if (fread(data, 1, size, checkpoint->file) != size) {
+      panic("Truncated checkpoint %s", checkpoint->path);
+    }
+  } else if (fwrite(data, 1, size, checkpoint->file) != size) {
+    panic("Failed to write checkpoint %s", checkpoint->path);
+  }
+}
+
+void checkpoint_vector(checkpoint_t* checkpoint, void** data, uint64_t count,
+                       size_t size) {
+  if (checkpoint->restoring) {
+    free(*data);
+    *data = NULL;
+    if (count) {
+      *data = malloc(count * size);
+      if (!*data) {
+        panic("Failed to allocate %" PRIu64 " elements of checkpoint %s",
+              count, checkpoint->path);
+      }
+    }
+  }
+  checkpoint_array(checkpoint, *data, count, size);
+}
+
+// Opens a checkpoint and goes through its header and configuration.
+static void checkpoint_open(checkpoint_t* checkpoint, const char* path,
+                            bool restoring, config_t* config) {
+  checkpoint->path = path;
+  checkpoint->restoring = restoring;
+  checkpoint->file = fopen(path, restoring ? "rb" : "wb");
+  if (!checkpoint->file) {
+    panic("Failed to open checkpoint %s", path);
+  }
+
+  char magic[4];
+  uint32_t version = CHECKPOINT_VERSION;
+  uint32_t config_size = sizeof(config_t);
+  memcpy(magic, CHECKPOINT_MAGIC, sizeof(magic));
+  checkpoint_value(checkpoint, magic);
+  checkpoint_value(checkpoint, version);
+  checkpoint_value(checkpoint, config_size);
+  if (memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0) {
+    panic("%s is not a checkpoint", path);
+  }
+  if (version != CHECKPOINT_VERSION || config_size != sizeof(config_t)) {
+    panic("Checkpoint %s was saved by another version of the simulator",
+          path);
+  }
+
+  checkpoint_bytes(checkpoint, config, sizeof(config_t));
+}
+
+static void checkpoint_close(checkpoint_t* checkpoint) {
+  char magic[4];
+  memcpy(magic, CHECKPOINT_END_MAGIC, sizeof(magic));
+  checkpoint_value(checkpoint, magic);
+  if (memcmp(magic, CHECKPOINT_END_MAGIC, sizeof(magic)) != 0) {
+    panic("Corrupted checkpoint %s", checkpoint->path);
+  }
+
+  if (fclose(checkpoint->file) != 0) {
+    panic("Failed to write checkpoint %s", checkpoint->path);
+  }
+}
+
+void checkpoint_save(const char* path, const checkpoint_position_t* position) {
+  checkpoint_t checkpoint;
+  checkpoint_open(&checkpoint, path, false, &sim->config);
+
+  checkpoint_position_t saved_position = {0};
+  if (position) {
+    saved_position = *position;
+  }
+  checkpoint_value(&checkpoint, saved_position);
+
+  simulator_checkpoint(&checkpoint);
+  checkpoint_close(&checkpoint);
+}
+
+void checkpoint_read_config(const char* path, config_t* config) {
+  checkpoint_t checkpoint;
+  checkpoint_open(&checkpoint, path, true, config);
+  fclose(checkpoint.file);
+}
+
+// Whether a simulation created with `config` has the layout of one created
+// with `saved`: only the latencies may differ.
+static bool same_layout(const config_t* saved, const config_t* config) {
+  config_t relaxed;
+  memcpy(&relaxed, config, sizeof(relaxed));
+  relaxed.tlb_l1_latency_ns = saved->tlb_l1_latency_ns;
+  relaxed.tlb_l2_latency_ns = saved->tlb_l2_latency_ns;
+  relaxed.dram_latency_ns = saved->dram_latency_ns;
+  relaxed.disk_latency_ns = saved->disk_latency_ns;
+  relaxed.shootdown_latency_ns = saved->shootdown_latency_ns;
+  return memcmp(saved, &relaxed, sizeof(relaxed)) == 0;
+}
+
+void checkpoint_restore(const char* path, checkpoint_position_t* position) {
+  checkpoint_t checkpoint;
+  config_t saved;
+  checkpoint_open(&checkpoint, path, true, &saved);
+  if (!same_layout(&saved, &sim->config)) {
+    panic("Checkpoint %s was saved with another configuration; only "
+          "latencies can be changed",
+          path);
+  }
+
+  checkpoint_position_t saved_position;
+  checkpoint_value(&checkpoint, saved_position);
+  if (saved_position.traces > MAX_CORES ||
+      (saved_position.traces &&
+       saved_position.next_trace >= saved_position.traces)) {
+    panic("Corrupted checkpoint %s", path);
+  }
+  if (position) {
+    *position = saved_position;
+  }
+
+  simulator_checkpoint(&checkpoint);
+  checkpoint_close(&checkpoint);
+}
+
+void checkpoint_run_open(checkpoint_run_t* run, unsigned index,
+                         trace_t* trace, const char* path) {
+  trace_open(trace, path);
+
+  uint64_t offset = run->position.offsets[index];
+  if (trace_skip(trace, offset) != offset) {
+    panic("%s is shorter than the %" PRIu64
+          " instructions of the checkpoint",
+          path, offset);
+  }
+  run->total_instructions += offset;
+}
+
+void checkpoint_run_finish(checkpoint_run_t* run) {
+  if (run->save_path && !run->saved) {
+    checkpoint_save(run->save_path, &run->position);
+    run->saved = true;
+  }
+}
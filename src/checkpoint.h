@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "constants.h"
+#include "trace.h"
+
+// Checkpoints hold the whole state of a simulation, and how far into its
+// traces the run got, so later runs can resume from there instead of
+// replaying the instructions that led to it.
+//
+// Every module walks its state in one function that both saves and restores
+// it, through checkpoint_bytes() and friends, so the two directions cannot
+// drift apart. Restoring happens over a simulation freshly created with the
+// same configuration, so every array whose size follows from the
+// configuration is already allocated. Checkpoints are raw images of that
+// state, so they can only be restored by the same build on the same kind of
+// host.
+typedef struct checkpoint {
+  FILE* file;
+  const char* path;
+  bool restoring;
+} checkpoint_t;
+
+// Writes `size` bytes at `data`, or reads them back into it.
+void checkpoint_bytes(checkpoint_t* checkpoint, void* data, size_t size);
+
+#define checkpoint_value(checkpoint, value) \
+  checkpoint_bytes((checkpoint), &(value), sizeof(value))
+
+// An array whose length follows from the configuration. NULL arrays, like
+// the state of the policies that are not in use, are skipped.
+static inline void checkpoint_array(checkpoint_t* checkpoint, void* data,
+                                    size_t count, size_t size) {
+  if (data) {
+    checkpoint_bytes(checkpoint, data, count * size);
+  }
+}
+
+// A growable array holding `count` elements. When restoring, `*data` is
+// replaced with an allocation of exactly `count` elements, or NULL.
+void checkpoint_vector(checkpoint_t* checkpoint, void** data, uint64_t count,
+                       size_t size);
+
+// Where a run is in its traces: the instructions taken from each of them,
+// and the trace whose turn is next when cores take turns.
+typedef struct {
+  uint32_t traces;
+  uint32_t next_trace;
+  uint64_t offsets[MAX_CORES];
+} checkpoint_position_t;
+
+// Saves the current simulation, and its position in the traces when given.
+void checkpoint_save(const char* path, const checkpoint_position_t* position);
+
+// Reads the configuration a checkpoint was taken with.
+void checkpoint_read_config(const char* path, config_t* config);
+
+// Restores the current simulation, which must have been created with the
+// configuration of the checkpoint. Only latencies may differ, so one warmed
+// up state can be reused by timing variants. Sets `position`, when given, to
+// where the checkpointed run was.
+void checkpoint_restore(const char* path, checkpoint_position_t* position);
+
+// A run over traces that starts at `position`, and saves a checkpoint to
+// `save_path`, when set, once `save_at` instructions have been taken from
+// them in total.
+typedef struct {
+  checkpoint_position_t position;
+  const char* save_path;
+  uint64_t save_at;
+  uint64_t total_instructions;
+  bool saved;
+} checkpoint_run_t;
+
+// Opens trace `index` of the run, skipping the instructions already taken
+// from it.
+void checkpoint_run_open(checkpoint_run_t* run, unsigned index,
+                         trace_t* trace, const char* path);
+
+// Counts an instruction taken from trace `index`. Returns true when the run
+// has to stop, once its checkpoint has been saved.
+static inline bool checkpoint_run_step(checkpoint_run_t* run, unsigned index,
+                                       unsigned next_trace) {
+  run->position.offsets[index]++;
+  run->position.next_trace = next_trace;
+  if (!run->save_path || ++run->total_instructions < run->save_at) {
+    return false;
+  }
+  checkpoint_save(run->save_path, &run->position);
+  run->saved = true;
+  return true;
+}
+
+// Saves the checkpoint of a run that ran out of instructions before
+// `save_at`, if it has one.
+void checkpoint_run_finish(checkpoint_run_t* run);
@@ -1,7 +1,23 @@
 #include "clock.h"
 
-time_ns_t current_time = 0;
+#include "simulator.h"
 
-void reset_time() { current_time = 0; }
-time_ns_t get_time() { return current_time; }
-void increment_time(time_ns_t dt) { current_time += dt; }
\ No newline at end of file
+// Core simulated by the calling host thread.
+__thread unsigned current_core = 0;
+
+void reset_time() {
+  for (unsigned core = 0; core < MAX_CORES; core++) {
+    sim->cores[core].time = 0;
+  }
+}
+time_ns_t get_time() { return sim->cores[current_core].time; }
+void increment_time(time_ns_t dt) {
+  if (!sim->warming) {
+    sim->cores[current_core].time += dt;
+  }
+}
+
+void set_core(unsigned core) { current_core = core; }
+unsigned get_core() { return current_core; }
+time_ns_t get_core_time(unsigned core) { return sim->cores[core].time; }
+bool is_warming() { return sim && sim->warming; }
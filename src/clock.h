@@ -1,9 +1,22 @@
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 typedef uint64_t time_ns_t;
 
+// Every simulated core has its own clock. The time functions act on the clock
+// of the core selected by the calling host thread (core 0 by default), in the
+// current simulation.
 void reset_time();
 time_ns_t get_time();
-void increment_time(time_ns_t dt);
\ No newline at end of file
+void increment_time(time_ns_t dt);
+
+void set_core(unsigned core);
+unsigned get_core();
+time_ns_t get_core_time(unsigned core);
+
+// Whether the current simulation is warming up between the detailed windows
+// of sampling: nothing is timed nor logged, and the clocks only advance by the
+// time per instruction of the last measured window.
+bool is_warming();
@@ -0,0 +1,530 @@
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "log.h"
+
+void config_init(config_t* config) {
+  config->tlb_l1.size = TLB_L1_SIZE;
+  config->tlb_l1.ways = 0;
+  config->tlb_l2.size = TLB_L2_SIZE;
+  config->tlb_l2.ways = 0;
+  config->tlb_l1.policy = TLB_POLICY_LRU;
+  config->tlb_l2.policy = TLB_POLICY_LRU;
+  config->tlb_l1_huge.size = TLB_L1_HUGE_SIZE;
+  config->tlb_l1_huge.ways = 0;
+  config->tlb_l2_huge.size = TLB_L2_HUGE_SIZE;
+  config->tlb_l2_huge.ways = 0;
+  config->tlb_prefetcher = TLB_PREFETCH_NONE;
+  config->tlb_prefetch_degree = TLB_PREFETCH_DEGREE;
+  config->tlb_prefetch_buffer.size = TLB_PREFETCH_BUFFER_SIZE;
+  config->tlb_prefetch_buffer.ways = 0;
+  config->tlb_prefetch_buffer.policy = TLB_POLICY_FIFO;
+  config->tlb_l1_latency_ns = TLB_L1_LATENCY_NS;
+  config->tlb_l2_latency_ns = TLB_L2_LATENCY_NS;
+  config->dram_latency_ns = DRAM_LATENCY_NS;
+  config->disk_latency_ns = DISK_LATENCY_NS;
+  config->disk_model = DISK_MODEL_FLAT;
+  config->disk_seek_latency_ns = DISK_SEEK_LATENCY_NS;
+  config->disk_transfer_latency_ns = DISK_TRANSFER_LATENCY_NS;
+  config->shootdown_latency_ns = SHOOTDOWN_LATENCY_NS;
+  config->cache_levels = 0;
+  config->cache_line_bytes = CACHE_LINE_BYTES;
+  config->caches[CACHE_L1D] = (cache_level_config_t){
+      CACHE_L1D_SIZE, CACHE_L1D_WAYS, CACHE_L1D_LATENCY_NS};
+  config->caches[CACHE_L2] = (cache_level_config_t){
+      CACHE_L2_SIZE, CACHE_L2_WAYS, CACHE_L2_LATENCY_NS};
+  config->caches[CACHE_LLC] = (cache_level_config_t){
+      CACHE_LLC_SIZE, CACHE_LLC_WAYS, CACHE_LLC_LATENCY_NS};
+  config->cache_write_through = false;
+  config->cache_write_allocate = true;
+  config->write_buffer_entries = 0;
+  config->dram_address_bits = DRAM_ADDRESS_BITS;
+  config->page_walk = PAGE_WALK_FLAT;
+  config->page_walk_cache_entries = 0;
+  config->page_policy = PAGE_POLICY_REFERENCE;
+  config->wsclock_tau_ns = WSCLOCK_TAU_NS;
+  config->swap_cluster_pages = 0;
+  config->swap_readahead_pages = 1;
+  config->huge_page_sizes = 0;
+  config->huge_page_policy = HUGE_PAGE_POLICY_ALWAYS;
+  config->huge_page_hint_count = 0;
+  config->cores = 1;
+  config->context_switch = CONTEXT_SWITCH_ASID;
+  config->sample_interval = 0;
+  config->sample_window = SAMPLE_WINDOW;
+  config->sample_warmup = SAMPLE_WARMUP;
+  config->seed = 0xcafebabe;
+}
+
+static uint64_t parse_uint(const char* name, const char* value) {
+  char* end;
+  unsigned long long parsed = strtoull(value, &end, 0);
+  if (*value == '\0' || *end != '\0') {
+    panic("Invalid value for --%s: %s", name, value);
+  }
+  return parsed;
+}
+
+static uint32_t parse_uint32(const char* name, const char* value) {
+  uint64_t parsed = parse_uint(name, value);
+  if (parsed > UINT32_MAX) {
+    panic("Invalid value for --%s: %s", name, value);
+  }
+  return (uint32_t)parsed;
+}
+
+// Number of ways, where "full" (or 0) selects a fully associative level.
+static uint32_t parse_ways(const char* name, const char* value) {
+  if (strcmp(value, "full") == 0) {
+    return 0;
+  }
+  return parse_uint32(name, value);
+}
+
+static tlb_policy_t parse_tlb_policy(const char* name, const char* value) {
+  tlb_policy_t policy;
+  if (!tlb_policy_parse(value, &policy)) {
+    panic("Invalid value for --%s: %s", name, value);
+  }
+  return policy;
+}
+
+static tlb_prefetcher_t parse_tlb_prefetcher(const char* name,
+                                             const char* value) {
+  tlb_prefetcher_t prefetcher;
+  if (!tlb_prefetcher_parse(value, &prefetcher)) {
+    panic("Invalid value for --%s: %s", name, value);
+  }
+  return prefetcher;
+}
+
+static page_policy_t parse_page_policy(const char* name, const char* value) {
+  page_policy_t policy;
+  if (!page_policy_parse(value, &policy)) {
+    panic("Invalid value for --%s: %s", name, value);
+  }
+  return policy;
+}
+
+static page_walk_t parse_page_walk(const char* name, const char* value) {
+  if (strcmp(value, "flat") == 0) {
+    return PAGE_WALK_FLAT;
+  }
+  if (strcmp(value, "radix") == 0) {
+    return PAGE_WALK_RADIX;
+  }
+  panic("Invalid value for --%s: %s", name, value);
+}
+
+static const char* disk_model_names[] = {
+    [DISK_MODEL_FLAT] = "flat",
+    [DISK_MODEL_SEEK] = "seek",
+};
+
+const char* disk_model_name(disk_model_t model) {
+  return disk_model_names[model];
+}
+
+static disk_model_t parse_disk_model(const char* name, const char* value) {
+  for (size_t i = 0;
+       i < sizeof(disk_model_names) / sizeof(disk_model_names[0]); i++) {
+    if (strcmp(value, disk_model_names[i]) == 0) {
+      return (disk_model_t)i;
+    }
+  }
+  panic("Invalid value for --%s: %s", name, value);
+}
+
+static const char* context_switch_names[] = {
+    [CONTEXT_SWITCH_ASID] = "asid",
+    [CONTEXT_SWITCH_FLUSH] = "flush",
+};
+
+const char* context_switch_name(context_switch_t mode) {
+  return context_switch_names[mode];
+}
+
+static context_switch_t parse_context_switch(const char* name,
+                                             const char* value) {
+  for (size_t i = 0;
+       i < sizeof(context_switch_names) / sizeof(context_switch_names[0]);
+       i++) {
+    if (strcmp(value, context_switch_names[i]) == 0) {
+      return (context_switch_t)i;
+    }
+  }
+  panic("Invalid value for --%s: %s", name, value);
+}
+
+static const char* huge_page_size_names[] = {
+    [PAGE_SIZE_2M] = "2m",
+    [PAGE_SIZE_1G] = "1g",
+};
+
+static const char* huge_page_policy_names[] = {
+    [HUGE_PAGE_POLICY_ALWAYS] = "always",
+    [HUGE_PAGE_POLICY_PROMOTE] = "promote",
+    [HUGE_PAGE_POLICY_HINT] = "hint",
+};
+
+const char* huge_page_policy_name(huge_page_policy_t policy) {
+  return huge_page_policy_names[policy];
+}
+
+// Comma separated huge page sizes, or "off".
+static uint32_t parse_huge_page_sizes(const char* name, const char* value) {
+  if (strcmp(value, "off") == 0) {
+    return 0;
+  }
+
+  uint32_t sizes = 0;
+  const char* token = value;
+  for (;;) {
+    size_t length = strcspn(token, ",");
+    int size = PAGE_SIZE_2M;
+    while (size < PAGE_SIZES &&
+           (strlen(huge_page_size_names[size]) != length ||
+            strncmp(token, huge_page_size_names[size], length) != 0)) {
+      size++;
+    }
+    if (size == PAGE_SIZES) {
+      panic("Invalid value for --%s: %s (expected off, or 2m and/or 1g)", name,
+            value);
+    }
+    sizes |= 1u << size;
+    if (!token[length]) {
+      return sizes;
+    }
+    token += length + 1;
+  }
+}
+
+static huge_page_policy_t parse_huge_page_policy(const char* name,
+                                                 const char* value) {
+  for (size_t i = 0; i < sizeof(huge_page_policy_names) /
+                             sizeof(huge_page_policy_names[0]);
+       i++) {
+    if (strcmp(value, huge_page_policy_names[i]) == 0) {
+      return (huge_page_policy_t)i;
+    }
+  }
+  panic("Invalid value for --%s: %s", name, value);
+}
+
+// Appends a `<start>-<end>` virtual address range to the hints.
+static void parse_huge_page_hint(config_t* config, const char* name,
+                                 const char* value) {
+  if (config->huge_page_hint_count == MAX_HUGE_PAGE_HINTS) {
+    panic("At most %d --%s ranges can be given", MAX_HUGE_PAGE_HINTS, name);
+  }
+
+  char* end;
+  unsigned long long start = strtoull(value, &end, 0);
+  if (end == value || *end != '-') {
+    panic("Invalid value for --%s: %s (expected <start>-<end>)", name, value);
+  }
+  const char* limit = end + 1;
+  unsigned long long stop = strtoull(limit, &end, 0);
+  if (end == limit || *end != '\0' || stop <= start) {
+    panic("Invalid value for --%s: %s (expected <start>-<end>)", name, value);
+  }
+
+  va_t* hint = config->huge_page_hints[config->huge_page_hint_count++];
+  hint[0] = start;
+  hint[1] = stop;
+}
+
+static bool parse_on_off(const char* name, const char* value) {
+  if (strcmp(value, "on") == 0) {
+    return true;
+  }
+  if (strcmp(value, "off") == 0) {
+    return false;
+  }
+  panic("Invalid value for --%s: %s (expected on or off)", name, value);
+}
+
+static bool parse_cache_write(const char* name, const char* value) {
+  if (strcmp(value, "through") == 0) {
+    return true;
+  }
+  if (strcmp(value, "back") != 0) {
+    panic("Invalid value for --%s: %s (expected back or through)", name,
+          value);
+  }
+  return false;
+}
+
+// Sets a `cache-<level>-{size,ways,latency}` option. Returns false if `name`
+// is not one.
+static bool set_cache_level_option(config_t* config, const char* name,
+                                   const char* value) {
+  if (strncmp(name, "cache-", 6) != 0) {
+    return false;
+  }
+  for (cache_level_t level = 0; level < CACHE_LEVELS; level++) {
+    const char* level_name = cache_level_name(level);
+    size_t length = strlen(level_name);
+    const char* field = name + 6 + length;
+    if (strncmp(name + 6, level_name, length) != 0 || *field != '-') {
+      continue;
+    }
+    cache_level_config_t* cache = &config->caches[level];
+    if (strcmp(field, "-size") == 0) {
+      cache->size = parse_uint32(name, value);
+    } else if (strcmp(field, "-ways") == 0) {
+      cache->ways = parse_ways(name, value);
+    } else if (strcmp(field, "-latency") == 0) {
+      cache->latency_ns = parse_uint(name, value);
+    } else {
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+bool config_set(config_t* config, const char* name, const char* value) {
+  if (strcmp(name, "tlb-l1-size") == 0) {
+    config->tlb_l1.size = parse_uint32(name, value);
+  } else if (strcmp(name, "tlb-l1-ways") == 0) {
+    config->tlb_l1.ways = parse_ways(name, value);
+  } else if (strcmp(name, "tlb-l1-policy") == 0) {
+    config->tlb_l1.policy = parse_tlb_policy(name, value);
+  } else if (strcmp(name, "tlb-l2-size") == 0) {
+    config->tlb_l2.size = parse_uint32(name, value);
+  } else if (strcmp(name, "tlb-l2-ways") == 0) {
+    config->tlb_l2.ways = parse_ways(name, value);
+  } else if (strcmp(name, "tlb-l2-policy") == 0) {
+    config->tlb_l2.policy = parse_tlb_policy(name, value);
+  } else if (strcmp(name, "tlb-l1-huge-size") == 0) {
+    config->tlb_l1_huge.size = parse_uint32(name, value);
+  } else if (strcmp(name, "tlb-l1-huge-ways") == 0) {
+    config->tlb_l1_huge.ways = parse_ways(name, value);
+  } else if (strcmp(name, "tlb-l2-huge-size") == 0) {
+    config->tlb_l2_huge.size = parse_uint32(name, value);
+  } else if (strcmp(name, "tlb-l2-huge-ways") == 0) {
+    config->tlb_l2_huge.ways = parse_ways(name, value);
+  } else if (strcmp(name, "tlb-prefetch") == 0) {
+    config->tlb_prefetcher = parse_tlb_prefetcher(name, value);
+  } else if (strcmp(name, "tlb-prefetch-degree") == 0) {
+    config->tlb_prefetch_degree = parse_uint32(name, value);
+  } else if (strcmp(name, "tlb-prefetch-buffer") == 0) {
+    config->tlb_prefetch_buffer.size = parse_uint32(name, value);
+  } else if (strcmp(name, "huge-pages") == 0) {
+    config->huge_page_sizes = parse_huge_page_sizes(name, value);
+  } else if (strcmp(name, "huge-policy") == 0) {
+    config->huge_page_policy = parse_huge_page_policy(name, value);
+  } else if (strcmp(name, "huge-hint") == 0) {
+    parse_huge_page_hint(config, name, value);
+  } else if (strcmp(name, "tlb-l1-latency") == 0) {
+    config->tlb_l1_latency_ns = parse_uint(name, value);
+  } else if (strcmp(name, "tlb-l2-latency") == 0) {
+    config->tlb_l2_latency_ns = parse_uint(name, value);
+  } else if (strcmp(name, "dram-latency") == 0) {
+    config->dram_latency_ns = parse_uint(name, value);
+  } else if (strcmp(name, "disk-latency") == 0) {
+    config->disk_latency_ns = parse_uint(name, value);
+  } else if (strcmp(name, "disk-model") == 0) {
+    config->disk_model = parse_disk_model(name, value);
+  } else if (strcmp(name, "disk-seek-latency") == 0) {
+    config->disk_seek_latency_ns = parse_uint(name, value);
+  } else if (strcmp(name, "disk-transfer-latency") == 0) {
+    config->disk_transfer_latency_ns = parse_uint(name, value);
+  } else if (strcmp(name, "swap-cluster") == 0) {
+    config->swap_cluster_pages = parse_uint32(name, value);
+  } else if (strcmp(name, "swap-readahead") == 0) {
+    config->swap_readahead_pages = parse_uint32(name, value);
+  } else if (strcmp(name, "context-switch") == 0) {
+    config->context_switch = parse_context_switch(name, value);
+  } else if (strcmp(name, "shootdown-latency") == 0) {
+    config->shootdown_latency_ns = parse_uint(name, value);
+  } else if (strcmp(name, "cache-levels") == 0) {
+    config->cache_levels = parse_uint32(name, value);
+  } else if (strcmp(name, "cache-line") == 0) {
+    config->cache_line_bytes = parse_uint32(name, value);
+  } else if (strcmp(name, "cache-write") == 0) {
+    config->cache_write_through = parse_cache_write(name, value);
+  } else if (strcmp(name, "cache-write-allocate") == 0) {
+    config->cache_write_allocate = parse_on_off(name, value);
+  } else if (strcmp(name, "write-buffer") == 0) {
+    config->write_buffer_entries = parse_uint32(name, value);
+  } else if (strcmp(name, "cores") == 0) {
+    config->cores = parse_uint32(name, value);
+  } else if (strcmp(name, "dram-bits") == 0) {
+    config->dram_address_bits = parse_uint32(name, value);
+  } else if (strcmp(name, "page-walk") == 0) {
+    config->page_walk = parse_page_walk(name, value);
+  } else if (strcmp(name, "page-walk-cache") == 0) {
+    config->page_walk_cache_entries = parse_uint32(name, value);
+  } else if (strcmp(name, "page-policy") == 0) {
+    config->page_policy = parse_page_policy(name, value);
+  } else if (strcmp(name, "wsclock-tau") == 0) {
+    config->wsclock_tau_ns = parse_uint(name, value);
+  } else if (strcmp(name, "sample-interval") == 0) {
+    config->sample_interval = parse_uint(name, value);
+  } else if (strcmp(name, "sample-window") == 0) {
+    config->sample_window = parse_uint(name, value);
+  } else if (strcmp(name, "sample-warmup") == 0) {
+    config->sample_warmup = parse_uint(name, value);
+  } else if (strcmp(name, "seed") == 0) {
+    config->seed = parse_uint(name, value);
+  } else if (!set_cache_level_option(config, name, value)) {
+    return false;
+  }
+  return true;
+}
+
+void config_parse(config_t* config, const char* options, const char* source) {
+  char* copy = strdup(options);
+  if (!copy) {
+    panic("Failed to allocate the options of %s", source);
+  }
+
+  char* saved;
+  for (char* token = strtok_r(copy, " \t\r\n", &saved); token;
+       token = strtok_r(NULL, " \t\r\n", &saved)) {
+    char* value = strchr(token, '=');
+    if (!value) {
+      panic("%s: expected option=value, got %s", source, token);
+    }
+    *value++ = '\0';
+    if (!config_set(config, token, value)) {
+      panic("%s: unknown option %s", source, token);
+    }
+  }
+
+  free(copy);
+}
+
+static bool is_power_of_two(uint64_t value) {
+  return value && !(value & (value - 1));
+}
+
+static void finalize_tlb_level(const char* name, tlb_level_config_t* level) {
+  if (level->ways == 0) {
+    level->ways = level->size;
+  }
+  if (level->size == 0 || level->ways == 0 || level->ways > level->size ||
+      level->size % level->ways != 0) {
+    panic("TLB %s: %u entries cannot be split into %u-way sets", name,
+          level->size, level->ways);
+  }
+  if (!is_power_of_two(level->size / level->ways)) {
+    panic("TLB %s: number of sets (%u) must be a power of two", name,
+          level->size / level->ways);
+  }
+}
+
+static void finalize_cache_level(const char* name, cache_level_config_t* level,
+                                 uint32_t line_bytes) {
+  uint32_t lines = level->size / line_bytes;
+  if (level->ways == 0) {
+    level->ways = lines;
+  }
+  if (level->size % line_bytes != 0 || lines == 0 || level->ways == 0 ||
+      level->ways > lines || lines % level->ways != 0 ||
+      !is_power_of_two(lines / level->ways)) {
+    panic("Cache %s: %u B of %u B lines cannot be split into a power of two "
+          "number of %u-way sets",
+          name, level->size, line_bytes, level->ways);
+  }
+}
+
+void config_finalize(config_t* config) {
+  finalize_tlb_level("L1", &config->tlb_l1);
+  finalize_tlb_level("L2", &config->tlb_l2);
+
+  config->tlb_l1_huge.policy = config->tlb_l1.policy;
+  config->tlb_l2_huge.policy = config->tlb_l2.policy;
+  if (config->huge_page_sizes) {
+    if (config->tlb_l1_huge.size) {
+      finalize_tlb_level("L1 huge page", &config->tlb_l1_huge);
+    }
+    if (config->tlb_l2_huge.size) {
+      finalize_tlb_level("L2 huge page", &config->tlb_l2_huge);
+    }
+  }
+  if (config->tlb_prefetcher != TLB_PREFETCH_NONE) {
+    if (config->tlb_prefetch_degree == 0 ||
+        config->tlb_prefetch_degree > TLB_PREFETCH_MAX_DEGREE) {
+      panic("Between 1 and %d pages can be prefetched per miss, got %u",
+            TLB_PREFETCH_MAX_DEGREE, config->tlb_prefetch_degree);
+    }
+    if (config->tlb_prefetch_buffer.size) {
+      config->tlb_prefetch_buffer.ways = config->tlb_prefetch_buffer.size;
+      finalize_tlb_level("prefetch buffer", &config->tlb_prefetch_buffer);
+    }
+  }
+
+  if ((config->huge_page_sizes & (1u << PAGE_SIZE_1G)) &&
+      config->huge_page_policy == HUGE_PAGE_POLICY_PROMOTE) {
+    panic("1 GiB pages are only mapped by the always and hint policies");
+  }
+
+  if (config->dram_address_bits <= PAGE_SIZE_BITS ||
+      config->dram_address_bits > DISK_ADDRESS_BITS) {
+    panic("DRAM addresses must have between %d and %d bits, got %u",
+          PAGE_SIZE_BITS + 1, DISK_ADDRESS_BITS, config->dram_address_bits);
+  }
+  // Radix page table nodes take DRAM frames and are never evicted. A walk
+  // needs a frame for the root, one for each level below it, and one for the
+  // page it maps.
+  uint64_t radix_frames = 1 + (PAGE_TABLE_LEVELS - 1) + 1;
+  if (config->page_walk == PAGE_WALK_RADIX &&
+      config_dram_page_capacity(config) < radix_frames) {
+    panic("The radix page walk needs at least %" PRIu64 " DRAM frames (%" PRIu64
+          " B) for the page table nodes of a walk and a page, got %" PRIu64
+          " with --dram-bits %u",
+          radix_frames, radix_frames * PAGE_SIZE_BYTES,
+          config_dram_page_capacity(config), config->dram_address_bits);
+  }
+
+  if (config->swap_readahead_pages == 0 ||
+      (config->swap_readahead_pages > 1 &&
+       config->swap_readahead_pages > config->swap_cluster_pages)) {
+    panic("Swap readahead must read between 1 page and the %u pages of a "
+          "swap cluster, got %u",
+          config->swap_cluster_pages, config->swap_readahead_pages);
+  }
+
+  if (config->cache_levels > CACHE_LEVELS) {
+    panic("At most %d cache levels can be simulated, got %u", CACHE_LEVELS,
+          config->cache_levels);
+  }
+  if (config->cache_levels &&
+      (!is_power_of_two(config->cache_line_bytes) ||
+       config->cache_line_bytes > PAGE_SIZE_BYTES)) {
+    panic("Cache lines must be a power of two of at most %" PRIu64
+          " bytes, got %u",
+          PAGE_SIZE_BYTES, config->cache_line_bytes);
+  }
+  for (cache_level_t level = 0; level < config->cache_levels; level++) {
+    finalize_cache_level(cache_level_name(level), &config->caches[level],
+                         config->cache_line_bytes);
+  }
+
+  if (config->write_buffer_entries > WRITE_BUFFER_MAX_ENTRIES) {
+    panic("Write buffers hold at most %d lines, got %u",
+          WRITE_BUFFER_MAX_ENTRIES, config->write_buffer_entries);
+  }
+
+  if (config->cores == 0 || config->cores > MAX_CORES) {
+    panic("Between 1 and %d cores can be simulated, got %u", MAX_CORES,
+          config->cores);
+  }
+
+  if (config->sample_interval &&
+      (config->sample_window == 0 ||
+       config->sample_window > config->sample_interval ||
+       config->sample_warmup >
+           config->sample_interval - config->sample_window)) {
+    panic("Sampling windows of %" PRIu64 " instructions, after %" PRIu64
+          " to warm up, do not fit in units of %" PRIu64 " instructions",
+          config->sample_window, config->sample_warmup,
+          config->sample_interval);
+  }
+}
@@ -0,0 +1,183 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cache.h"
+#include "clock.h"
+#include "constants.h"
+#include "page_replacement.h"
+#include "tlb_prefetch.h"
+#include "tlb_replacement.h"
+
+// How the page table walk performed on a TLB miss is timed.
+typedef enum {
+  // A single read of the page table entry, at PAGE_TABLE_DRAM_ADDRESS.
+  PAGE_WALK_FLAT,
+  // One read per radix tree level, at the address of the entry in the node.
+  PAGE_WALK_RADIX,
+} page_walk_t;
+
+// How disk operations are timed.
+typedef enum {
+  // Every operation takes the disk latency, however many pages it moves.
+  DISK_MODEL_FLAT,
+  // Every operation takes the transfer time of each of its pages, plus a
+  // seek unless it starts where the previous operation ended.
+  DISK_MODEL_SEEK,
+} disk_model_t;
+
+// What the TLBs of a core do when it switches to another process.
+typedef enum {
+  // Nothing: entries are tagged with the address space they belong to, so
+  // the translations of every process can stay cached.
+  CONTEXT_SWITCH_ASID,
+  // Every entry is dropped, along with the page walk cache, like on a TLB
+  // without ASIDs.
+  CONTEXT_SWITCH_FLUSH,
+} context_switch_t;
+
+// When the page table maps huge pages.
+typedef enum {
+  // On the first fault in an untouched, aligned region, if an aligned run of
+  // free frames is left, like transparent huge pages.
+  HUGE_PAGE_POLICY_ALWAYS,
+  // Reservations: the first fault in an untouched 2 MiB region reserves an
+  // aligned run of frames, the pages of the region are placed at their offset
+  // in it, and the region is promoted in place once all of them are resident.
+  // Reservations are broken when DRAM runs out of free frames. Only maps
+  // 2 MiB pages.
+  HUGE_PAGE_POLICY_PROMOTE,
+  // Like HUGE_PAGE_POLICY_ALWAYS, but only for regions within one of the
+  // hinted ranges, like madvise(MADV_HUGEPAGE).
+  HUGE_PAGE_POLICY_HINT,
+} huge_page_policy_t;
+
+// Organization of a single TLB level.
+typedef struct {
+  // Total number of entries.
+  uint32_t size;
+  // Entries per set: 1 is direct-mapped, `size` (or 0) is fully associative.
+  // The resulting number of sets must be a power of two, as the set index is
+  // taken from the low bits of the virtual page number.
+  uint32_t ways;
+  // How the victim is chosen within a full set.
+  tlb_policy_t policy;
+} tlb_level_config_t;
+
+// Organization of a data cache level.
+typedef struct {
+  // Total size in bytes.
+  uint32_t size;
+  // Lines per set, with the same meaning as for the TLB levels.
+  uint32_t ways;
+  time_ns_t latency_ns;
+} cache_level_config_t;
+
+// Runtime configuration of the simulated system.
+// Defaults come from constants.h.
+typedef struct {
+  tlb_level_config_t tlb_l1;
+  tlb_level_config_t tlb_l2;
+  // Huge page arrays of each level, sharing the entries of the level when
+  // their size is 0. Their policy is the one of the level.
+  tlb_level_config_t tlb_l1_huge;
+  tlb_level_config_t tlb_l2_huge;
+
+  // Translation prefetcher run on L2 misses, and pages it prefetches after
+  // each one.
+  tlb_prefetcher_t tlb_prefetcher;
+  uint32_t tlb_prefetch_degree;
+  // Buffer holding the prefetched translations, fully associative FIFO, or
+  // 0 entries to prefetch into L2.
+  tlb_level_config_t tlb_prefetch_buffer;
+
+  time_ns_t tlb_l1_latency_ns;
+  time_ns_t tlb_l2_latency_ns;
+  time_ns_t dram_latency_ns;
+  time_ns_t disk_latency_ns;
+  disk_model_t disk_model;
+  time_ns_t disk_seek_latency_ns;
+  time_ns_t disk_transfer_latency_ns;
+  time_ns_t shootdown_latency_ns;
+
+  // Data cache levels simulated, from the L1D, or 0 for none, and the size
+  // of their lines. Writes hitting a line are written through to the next
+  // level or mark it dirty, and write misses fill the line or not.
+  uint32_t cache_levels;
+  uint32_t cache_line_bytes;
+  cache_level_config_t caches[CACHE_LEVELS];
+  bool cache_write_through;
+  bool cache_write_allocate;
+
+  // Lines of the write buffer of every core, or 0 for none.
+  uint32_t write_buffer_entries;
+
+  // Number of bits of DRAM physical addresses.
+  uint32_t dram_address_bits;
+
+  page_walk_t page_walk;
+  // Entries per interior level of the page walk cache, 0 to disable it. Only
+  // used in the radix walk model.
+  uint32_t page_walk_cache_entries;
+
+  // How the page evicted from DRAM is chosen when no frame is free.
+  page_policy_t page_policy;
+  // Working set window of the WSClock page replacement policy.
+  time_ns_t wsclock_tau_ns;
+
+  // Pages per swap cluster, or 0 to give every swapped out page a slot of
+  // its own, never reused. Swapped out pages are read along with up to
+  // `swap_readahead_pages - 1` of the following pages of their cluster.
+  uint32_t swap_cluster_pages;
+  uint32_t swap_readahead_pages;
+
+  // Huge page sizes the page table may map, one bit per page_size_t, or 0
+  // to only map 4 KiB pages.
+  uint32_t huge_page_sizes;
+  huge_page_policy_t huge_page_policy;
+  // Virtual address ranges [start, end) hinted for HUGE_PAGE_POLICY_HINT.
+  va_t huge_page_hints[MAX_HUGE_PAGE_HINTS][2];
+  uint32_t huge_page_hint_count;
+
+  // Number of simulated cores, each with its own TLB levels.
+  uint32_t cores;
+  context_switch_t context_switch;
+
+  // Sampling units, in instructions, or 0 to simulate every instruction in
+  // detail. The last `sample_window` instructions of each unit are measured,
+  // after `sample_warmup` detailed instructions.
+  uint64_t sample_interval;
+  uint64_t sample_window;
+  uint64_t sample_warmup;
+
+  // Seed of the random replacement policy.
+  uint64_t seed;
+} config_t;
+
+void config_init(config_t* config);
+
+// Sets the option `name` (the long command line option, without the leading
+// dashes) from its textual value. Returns false if there is no such option,
+// and panics if the value is invalid.
+bool config_set(config_t* config, const char* name, const char* value);
+
+// Applies whitespace separated `name=value` pairs, as taken by config_set().
+// Errors are reported as coming from `source`.
+void config_parse(config_t* config, const char* options, const char* source);
+
+// Resolves derived settings and checks the configuration, panicking on the
+// first invalid setting.
+void config_finalize(config_t* config);
+
+const char* disk_model_name(disk_model_t model);
+const char* context_switch_name(context_switch_t mode);
+const char* huge_page_policy_name(huge_page_policy_t policy);
+
+static inline uint64_t config_dram_page_capacity(const config_t* config) {
+  return 1llu << (config->dram_address_bits - PAGE_SIZE_BITS);
+}
+
+static inline uint64_t config_dram_address_mask(const config_t* config) {
+  return (1llu << config->dram_address_bits) - 1;
+}
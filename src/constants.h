@@ -36,13 +36,104 @@
 // hardware.
 #define DISK_ADDRESS_BITS 48
 
+// The page table is a radix tree of PAGE_TABLE_LEVELS levels, each one indexed
+// by PAGE_TABLE_INDEX_BITS bits of the virtual page number. It must cover all
+// VIRTUAL_ADDRESS_BITS - PAGE_SIZE_BITS bits of the virtual page number. Each
+// entry takes PAGE_TABLE_ENTRY_BYTES bytes of the simulated DRAM.
+#define PAGE_TABLE_LEVELS 4
+#define PAGE_TABLE_INDEX_BITS 9
+#define PAGE_TABLE_ENTRY_BYTES 8
+
 #define TLB_L1_SIZE 32
 #define TLB_L2_SIZE 512
 
+// Huge pages map the whole range of a page table node rather than a single
+// page: 2 MiB pages map a leaf, and 1 GiB pages the node above it (with the
+// default page size and radix tree). Each TLB level caches them in an array of
+// its own, unless it is given 0 entries, in which case they share the entries
+// of the level with the 4 KiB pages.
+#define TLB_L1_HUGE_SIZE 32
+#define TLB_L2_HUGE_SIZE 0
+
+// Largest number of virtual address ranges given as huge page hints.
+#define MAX_HUGE_PAGE_HINTS 16
+
+// Translation prefetching, off by default. Prefetched translations go to a
+// small fully associative FIFO buffer looked up on L2 misses, or to L2 itself
+// when the buffer is given 0 entries. Up to TLB_PREFETCH_DEGREE pages are
+// prefetched after a miss. The distance prefetcher keeps a table of
+// TLB_PREFETCH_DISTANCE_TABLE_SIZE distances, each with the last
+// TLB_PREFETCH_DISTANCE_SLOTS distances that followed it.
+#define TLB_PREFETCH_BUFFER_SIZE 16
+#define TLB_PREFETCH_DEGREE 2
+#define TLB_PREFETCH_MAX_DEGREE 16
+#define TLB_PREFETCH_DISTANCE_TABLE_SIZE 64
+#define TLB_PREFETCH_DISTANCE_SLOTS 2
+
 #define TLB_L1_LATENCY_NS 1
 #define TLB_L2_LATENCY_NS 2
 #define DRAM_LATENCY_NS 100
 #define DISK_LATENCY_NS 1000000
+#define PAGE_WALK_CACHE_LATENCY_NS 1
+
+// Seek disk model, off by default: a random page costs about as much as
+// DISK_LATENCY_NS, and a page following the previous operation only
+// DISK_TRANSFER_LATENCY_NS.
+#define DISK_SEEK_LATENCY_NS 960000
+#define DISK_TRANSFER_LATENCY_NS 40000
+
+// Pages read ahead from swap clusters are kept in a swap cache of
+// SWAP_CACHE_PAGES pages until they are faulted in, oldest dropped first.
+#define SWAP_CACHE_PAGES 64
+
+// Data caches, off by default: a private L1D and L2 per core, and a shared
+// LLC, with lines of CACHE_LINE_BYTES bytes.
+#define CACHE_LINE_BYTES 64
+#define CACHE_L1D_SIZE 32768
+#define CACHE_L1D_WAYS 8
+#define CACHE_L1D_LATENCY_NS 1
+#define CACHE_L2_SIZE 262144
+#define CACHE_L2_WAYS 8
+#define CACHE_L2_LATENCY_NS 4
+#define CACHE_LLC_SIZE 2097152
+#define CACHE_LLC_WAYS 16
+#define CACHE_LLC_LATENCY_NS 12
+
+// Write buffers between the MMUs and DRAM, off by default, merge the writes
+// to the same line of 2^WRITE_BUFFER_LINE_BITS bytes.
+#define WRITE_BUFFER_LINE_BITS 6
+#define WRITE_BUFFER_MAX_ENTRIES 1024
+
+// Default working set window of the WSClock page replacement policy: pages
+// not referenced for longer than this are candidates for eviction.
+#define WSCLOCK_TAU_NS 1000000
+
+// Largest number of simulated cores, each one with its own TLBs, sharing the
+// page table and DRAM. A core caching a page evicted by another core is
+// charged SHOOTDOWN_LATENCY_NS to handle the invalidation request.
+#define MAX_CORES 64
+#define SHOOTDOWN_LATENCY_NS 1000
+
+// Traces can run several processes, each one in a virtual address space of
+// its own with its own page table, and all of them sharing DRAM. The TLBs tell
+// the translations of different processes apart by their address space
+// identifier (ASID), of ASID_BITS bits.
+#define ASID_BITS 12
+
+// Sampled simulation, off by default. Every sampling unit of the trace is
+// simulated functionally up to its last SAMPLE_WARMUP + SAMPLE_WINDOW
+// instructions, which run the full timing model; only the last SAMPLE_WINDOW
+// are measured. Estimates are given with confidence intervals of
+// SAMPLE_CONFIDENCE_PERCENT%, SAMPLE_CONFIDENCE_Z standard errors wide.
+#define SAMPLE_WINDOW 1000
+#define SAMPLE_WARMUP 2000
+#define SAMPLE_CONFIDENCE_PERCENT 95
+#define SAMPLE_CONFIDENCE_Z 1.96
+
+// Profiles of a run snapshot the counters every PROFILE_INTERVAL instructions,
+// and list the PROFILE_TOP_PAGES most accessed pages.
+#define PROFILE_INTERVAL 100000
+#define PROFILE_TOP_PAGES 32
 
 // ========================================================================
 // Constants defined from the constants above.
@@ -63,4 +154,16 @@
 #define DRAM_ADDRESS_MASK (DRAM_SIZE_BYTES - 1)
 #define DISK_ADDRESS_MASK (DISK_SIZE_BYTES - 1)
 #define PAGE_INDEX_MASK (TOTAL_PAGES - 1)
+
+#define MAX_ADDRESS_SPACES (1u << ASID_BITS)
+
+#define PAGE_TABLE_FANOUT (1 << PAGE_TABLE_INDEX_BITS)
+
+// Address bits mapped by a page of the given page_size_t.
+#define PAGE_SIZE_BITS_OF(size) \
+  (PAGE_SIZE_BITS + (size) * PAGE_TABLE_INDEX_BITS)
+
+_Static_assert(PAGE_TABLE_LEVELS * PAGE_TABLE_INDEX_BITS >=
+                   VIRTUAL_ADDRESS_BITS - PAGE_SIZE_BITS,
+               "The page table levels must cover the whole virtual page number");
 #define PAGE_OFFSET_MASK (PAGE_SIZE_BYTES - 1)
@@ -0,0 +1,119 @@
+#include "frame_allocator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "log.h"
+
+static inline void mark_allocated(frame_allocator_t* allocator,
+                                  uint64_t frame) {
+  uint64_t word = frame / 64;
+  allocator->words[word] |= 1llu << (frame % 64);
+  if (allocator->words[word] == ~0llu) {
+    allocator->summary[word / 64] |= 1llu << (word % 64);
+  }
+  allocator->allocated++;
+}
+
+void frame_allocator_init(frame_allocator_t* allocator, uint64_t frames,
+                          uint64_t reserved_frames) {
+  frame_allocator_free_all(allocator);
+
+  uint64_t words = (frames + 63) / 64;
+  allocator->frames = frames;
+  allocator->reserved_frames = reserved_frames;
+  allocator->summary_words = (words + 63) / 64;
+  allocator->words = calloc(words, sizeof(uint64_t));
+  allocator->summary = calloc(allocator->summary_words, sizeof(uint64_t));
+  if (!allocator->words || !allocator->summary) {
+    panic("Failed to allocate the DRAM frame bitmap");
+  }
+
+  // Bits past the last frame look allocated, so they are never handed out.
+  if (frames % 64) {
+    allocator->words[words - 1] = ~0llu << (frames % 64);
+  }
+  if (words % 64) {
+    allocator->summary[allocator->summary_words - 1] = ~0llu << (words % 64);
+  }
+
+  for (uint64_t frame = 0; frame < reserved_frames && frame < frames;
+       frame++) {
+    mark_allocated(allocator, frame);
+  }
+  allocator->allocated = 0;
+}
+
+void frame_allocator_free_all(frame_allocator_t* allocator) {
+  free(allocator->words);
+  free(allocator->summary);
+  memset(allocator, 0, sizeof(*allocator));
+}
+
+bool frame_allocator_alloc(frame_allocator_t* allocator, uint64_t* frame) {
+  for (; allocator->cursor < allocator->summary_words; allocator->cursor++) {
+    uint64_t free_words = ~allocator->summary[allocator->cursor];
+    if (free_words) {
+      uint64_t word = allocator->cursor * 64 + __builtin_ctzll(free_words);
+      *frame = word * 64 + __builtin_ctzll(~allocator->words[word]);
+      mark_allocated(allocator, *frame);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool frame_allocator_alloc_aligned(frame_allocator_t* allocator, uint64_t count,
+                                   uint64_t* first_frame) {
+  uint64_t words_per_run = count / 64;
+  for (uint64_t first = 0; first + count <= allocator->frames; first += count) {
+    uint64_t word = first / 64;
+    uint64_t end = word + words_per_run;
+    while (word < end && !allocator->words[word]) {
+      word++;
+    }
+    if (word < end) {
+      continue;
+    }
+
+    for (word = first / 64; word < end; word++) {
+      allocator->words[word] = ~0llu;
+      allocator->summary[word / 64] |= 1llu << (word % 64);
+    }
+    allocator->allocated += count;
+    *first_frame = first;
+    return true;
+  }
+  return false;
+}
+
+void frame_allocator_free(frame_allocator_t* allocator, uint64_t frame) {
+  if (frame < allocator->reserved_frames || frame >= allocator->frames ||
+      !frame_allocator_is_allocated(allocator, frame)) {
+    return;
+  }
+
+  uint64_t word = frame / 64;
+  allocator->words[word] &= ~(1llu << (frame % 64));
+  allocator->summary[word / 64] &= ~(1llu << (word % 64));
+  if (word / 64 < allocator->cursor) {
+    allocator->cursor = word / 64;
+  }
+  allocator->allocated--;
+}
+
+bool frame_allocator_is_allocated(const frame_allocator_t* allocator,
+                                  uint64_t frame) {
+  return (allocator->words[frame / 64] >> (frame % 64)) & 1;
+}
+
+void frame_allocator_checkpoint(struct checkpoint* checkpoint,
+                                frame_allocator_t* allocator) {
+  checkpoint_array(checkpoint, allocator->words, (allocator->frames + 63) / 64,
+                   sizeof(uint64_t));
+  checkpoint_array(checkpoint, allocator->summary, allocator->summary_words,
+                   sizeof(uint64_t));
+  checkpoint_value(checkpoint, allocator->cursor);
+  checkpoint_value(checkpoint, allocator->allocated);
+}
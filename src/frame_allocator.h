@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Bitmap allocator of DRAM page frames.
+//
+// Frames are tracked one bit each, packed in 64-bit words, with a summary
+// level holding one bit per word that is set when the word is full. A cursor
+// remembers the first summary word that may still have free frames. Frames are
+// always handed out lowest number first, so allocation is deterministic.
+typedef struct {
+  uint64_t frames;
+  uint64_t reserved_frames;
+
+  uint64_t* words;
+  uint64_t* summary;
+  uint64_t summary_words;
+  uint64_t cursor;
+
+  uint64_t allocated;
+} frame_allocator_t;
+
+// Frames [0, reserved_frames) are never handed out nor freed.
+void frame_allocator_init(frame_allocator_t* allocator, uint64_t frames,
+                          uint64_t reserved_frames);
+void frame_allocator_free_all(frame_allocator_t* allocator);
+
+// Allocates the lowest free frame. Returns false if DRAM is full.
+bool frame_allocator_alloc(frame_allocator_t* allocator, uint64_t* frame);
+
+// Allocates `count` free frames starting at a multiple of `count`, which must
+// be a power of two of at least 64. Returns false if there is no such run.
+bool frame_allocator_alloc_aligned(frame_allocator_t* allocator, uint64_t count,
+                                   uint64_t* first_frame);
+
+// Frees a frame. Reserved and out of range frames are ignored.
+void frame_allocator_free(frame_allocator_t* allocator, uint64_t frame);
+
+bool frame_allocator_is_allocated(const frame_allocator_t* allocator,
+                                  uint64_t frame);
+
+struct checkpoint;
+// Saves or restores the state of an initialized allocator.
+void frame_allocator_checkpoint(struct checkpoint* checkpoint,
+                                frame_allocator_t* allocator);
@@ -0,0 +1,147 @@
+#include "log.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define LOG_BUFFER_SIZE (1 << 20)
+
+// FNV-1a offset basis and prime, applied a word at a time.
+#define DIGEST_SEED 0xcbf29ce484222325llu
+#define DIGEST_PRIME 0x100000001b3llu
+
+log_level_t log_level = LOG_LEVEL_SUMMARY;
+FILE* log_debug_stream = NULL;
+
+bool log_digest = false;
+static uint64_t digest_interval;
+static uint64_t digest_next;
+static uint64_t digest_events;
+static uint64_t digest_hash;
+
+static char stdout_buffer[LOG_BUFFER_SIZE];
+static char stderr_buffer[LOG_BUFFER_SIZE];
+
+static bool same_file(const struct stat* a, const struct stat* b) {
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino;
+}
+
+void log_init(log_level_t level) {
+  log_level = level;
+  log_debug_stream = stderr;
+
+  setvbuf(stdout, stdout_buffer, _IOFBF, sizeof(stdout_buffer));
+
+  struct stat out_st, err_st, null_st;
+  bool have_out = fstat(fileno(stdout), &out_st) == 0;
+  bool have_err = fstat(fileno(stderr), &err_st) == 0;
+
+  if (have_err && stat("/dev/null", &null_st) == 0 &&
+      same_file(&err_st, &null_st)) {
+    // Nobody will ever read it, so don't even format it.
+    if (log_level > LOG_LEVEL_MEMORY) {
+      log_level = LOG_LEVEL_MEMORY;
+    }
+  } else if (have_out && have_err && same_file(&out_st, &err_st)) {
+    log_debug_stream = stdout;
+  } else {
+    setvbuf(stderr, stderr_buffer, _IOFBF, sizeof(stderr_buffer));
+  }
+}
+
+void log_digest_init(uint64_t interval) {
+  log_digest = true;
+  digest_interval = interval;
+  digest_next = interval ? interval : UINT64_MAX;
+  digest_events = 0;
+  digest_hash = DIGEST_SEED;
+}
+
+// Words are scrambled before being folded in, so that the low bits of every
+// word reach every bit of the digest.
+static inline uint64_t digest_word(uint64_t hash, uint64_t word) {
+  word ^= word >> 30;
+  word *= 0xbf58476d1ce4e5b9llu;
+  word ^= word >> 27;
+  word *= 0x94d049bb133111ebllu;
+  word ^= word >> 31;
+  return (hash ^ word) * DIGEST_PRIME;
+}
+
+// An event is its time, then its address with its kind in the low bits.
+static inline void digest_add(uint64_t time, log_event_t event,
+                              uint64_t address) {
+  digest_hash = digest_word(digest_hash, time);
+  digest_hash = digest_word(digest_hash, address << 2 | event);
+  if (++digest_events == digest_next) {
+    printf("Digest after %" PRIu64 " events: %016" PRIx64 "\n", digest_events,
+           digest_hash);
+    digest_next += digest_interval;
+  }
+}
+
+void log_digest_event(log_event_t event, uint64_t address) {
+  if (!is_warming()) {
+    digest_add(get_time(), event, address);
+  }
+}
+
+void log_digest_finish() {
+  printf("Event digest: %016" PRIx64 " (%" PRIu64 " events)\n", digest_hash,
+         digest_events);
+}
+
+// Parses a `[<time>] R/W DRAM/Disk[<hex>]` line.
+static bool parse_event(const char* line, uint64_t* time, log_event_t* event,
+                        uint64_t* address) {
+  char op;
+  char device[8];
+  if (sscanf(line, "[%" SCNu64 "] %c %7[A-Za-z][%" SCNx64 "]", time, &op,
+             device, address) != 4 ||
+      (op != 'R' && op != 'W')) {
+    return false;
+  }
+  if (strcmp(device, "DRAM") == 0) {
+    *event = op == 'R' ? LOG_EVENT_DRAM_READ : LOG_EVENT_DRAM_WRITE;
+  } else if (strcmp(device, "Disk") == 0) {
+    *event = op == 'R' ? LOG_EVENT_DISK_READ : LOG_EVENT_DISK_WRITE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void log_digest_file(const char* path) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    panic("Failed to open output file %s", path);
+  }
+
+  // The final digest goes where the events end, as it does in a run.
+  bool finished = false;
+  char line[512];
+  while (fgets(line, sizeof(line), file)) {
+    uint64_t time;
+    log_event_t event;
+    uint64_t address;
+    if (!finished && parse_event(line, &time, &event, &address)) {
+      digest_add(time, event, address);
+      continue;
+    }
+    if (!finished) {
+      log_digest_finish();
+      finished = true;
+    }
+    fputs(line, stdout);
+  }
+  if (!finished) {
+    log_digest_finish();
+  }
+  fclose(file);
+}
+
+void log_flush() {
+  fflush(stdout);
+  fflush(stderr);
+}
@@ -1,26 +1,72 @@
 #pragma once
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdio.h>
 
 #include "clock.h"
 
+// Runtime verbosity of the simulator output.
+// Every level includes the output of the levels below it.
+typedef enum {
+  // Only the final report.
+  LOG_LEVEL_SUMMARY,
+  // Timestamped DRAM and disk accesses (the `.out` files).
+  LOG_LEVEL_MEMORY,
+  // Internal simulator events, written to stderr.
+  LOG_LEVEL_DEBUG,
+} log_level_t;
+
+extern log_level_t log_level;
+extern FILE* log_debug_stream;
+
+// Timestamped memory events, the lines of the `.out` files.
+typedef enum {
+  LOG_EVENT_DRAM_READ,
+  LOG_EVENT_DRAM_WRITE,
+  LOG_EVENT_DISK_READ,
+  LOG_EVENT_DISK_WRITE,
+} log_event_t;
+
+// In digest mode the memory events are folded into a running 64-bit hash
+// instead of being printed, whatever the verbosity. The digest is printed
+// every `interval` events, unless 0, and once more when the events end, so
+// two runs are compared by a few lines and a mismatch is located by
+// bisection.
+extern bool log_digest;
+void log_digest_init(uint64_t interval);
+void log_digest_event(log_event_t event, uint64_t address);
+// Prints the final digest.
+void log_digest_finish();
+
+// Digests the events of an output file, as printed at the memory verbosity,
+// and prints its other lines unchanged, so the result can be compared with
+// the output of a run in digest mode.
+void log_digest_file(const char* path);
+
+// Sets up the buffered log sink. Debug output is disabled when stderr points
+// to /dev/null, and shares the stdout buffer when both point to the same file
+// so the interleaving of the two streams is preserved.
+void log_init(log_level_t level);
+void log_flush();
+
 #define log(fmt, ...)                \
   do {                               \
     printf(fmt "\n", ##__VA_ARGS__); \
-    fflush(stdout);                  \
   } while (0);
 
-#define log_clk(fmt, ...)                                         \
-  do {                                                            \
-    printf("[%" PRIu64 "] " fmt "\n", get_time(), ##__VA_ARGS__); \
-    fflush(stdout);                                               \
+#define log_clk(fmt, ...)                                           \
+  do {                                                              \
+    if (log_level >= LOG_LEVEL_MEMORY && !is_warming()) {           \
+      printf("[%" PRIu64 "] " fmt "\n", get_time(), ##__VA_ARGS__); \
+    }                                                               \
   } while (0);
 
-#define log_dbg(fmt, ...)                     \
-  do {                                        \
-    fprintf(stderr, fmt "\n", ##__VA_ARGS__); \
-    fflush(stderr);                           \
+#define log_dbg(fmt, ...)                                 \
+  do {                                                    \
+    if (log_level >= LOG_LEVEL_DEBUG && !is_warming()) {  \
+      fprintf(log_debug_stream, fmt "\n", ##__VA_ARGS__); \
+    }                                                     \
   } while (0);
 
 #define panic(fmt, ...)                        \
@@ -1,93 +1,551 @@
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-#include "clock.h"
+#include "checkpoint.h"
+#include "config.h"
 #include "constants.h"
 #include "log.h"
-#include "memory.h"
-#include "page_table.h"
-#include "tlb.h"
+#include "multicore.h"
+#include "profile.h"
+#include "thread_pool.h"
+#include "simulator.h"
+#include "stack_distance.h"
+#include "sweep.h"
+#include "trace.h"
+
+// Long-only options. Every simulated system parameter shares OPT_CONFIG and
+// is handed to config_set() under its option name.
+enum {
+  OPT_CONFIG = 256,
+  OPT_SWEEP,
+  OPT_JOBS,
+  OPT_STACK_DISTANCE,
+  OPT_THREADS,
+  OPT_CHECKPOINT,
+  OPT_CHECKPOINT_AT,
+  OPT_RESTORE,
+  OPT_PROFILE,
+  OPT_PROFILE_FORMAT,
+  OPT_PROFILE_INTERVAL,
+  OPT_PROFILE_PAGES,
+  OPT_DIGEST,
+  OPT_DIGEST_OF,
+};
+
+static const struct option long_options[] = {
+    {"convert", required_argument, NULL, 'c'},
+    {"verbosity", required_argument, NULL, 'v'},
+    {"sweep", required_argument, NULL, OPT_SWEEP},
+    {"jobs", required_argument, NULL, OPT_JOBS},
+    {"stack-distance", required_argument, NULL, OPT_STACK_DISTANCE},
+    {"threads", no_argument, NULL, OPT_THREADS},
+    {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+    {"checkpoint-at", required_argument, NULL, OPT_CHECKPOINT_AT},
+    {"restore", required_argument, NULL, OPT_RESTORE},
+    {"profile", required_argument, NULL, OPT_PROFILE},
+    {"profile-format", required_argument, NULL, OPT_PROFILE_FORMAT},
+    {"profile-interval", required_argument, NULL, OPT_PROFILE_INTERVAL},
+    {"profile-pages", required_argument, NULL, OPT_PROFILE_PAGES},
+    {"digest", required_argument, NULL, OPT_DIGEST},
+    {"digest-of", required_argument, NULL, OPT_DIGEST_OF},
+    {"cores", required_argument, NULL, OPT_CONFIG},
+    {"shootdown-latency", required_argument, NULL, OPT_CONFIG},
+    {"context-switch", required_argument, NULL, OPT_CONFIG},
+    {"write-buffer", required_argument, NULL, OPT_CONFIG},
+    {"cache-levels", required_argument, NULL, OPT_CONFIG},
+    {"cache-line", required_argument, NULL, OPT_CONFIG},
+    {"cache-write", required_argument, NULL, OPT_CONFIG},
+    {"cache-write-allocate", required_argument, NULL, OPT_CONFIG},
+    {"cache-l1d-size", required_argument, NULL, OPT_CONFIG},
+    {"cache-l1d-ways", required_argument, NULL, OPT_CONFIG},
+    {"cache-l1d-latency", required_argument, NULL, OPT_CONFIG},
+    {"cache-l2-size", required_argument, NULL, OPT_CONFIG},
+    {"cache-l2-ways", required_argument, NULL, OPT_CONFIG},
+    {"cache-l2-latency", required_argument, NULL, OPT_CONFIG},
+    {"cache-llc-size", required_argument, NULL, OPT_CONFIG},
+    {"cache-llc-ways", required_argument, NULL, OPT_CONFIG},
+    {"cache-llc-latency", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l1-size", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l1-ways", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l1-policy", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l1-latency", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l2-size", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l2-ways", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l2-policy", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l2-latency", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l1-huge-size", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l1-huge-ways", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l2-huge-size", required_argument, NULL, OPT_CONFIG},
+    {"tlb-l2-huge-ways", required_argument, NULL, OPT_CONFIG},
+    {"tlb-prefetch", required_argument, NULL, OPT_CONFIG},
+    {"tlb-prefetch-degree", required_argument, NULL, OPT_CONFIG},
+    {"tlb-prefetch-buffer", required_argument, NULL, OPT_CONFIG},
+    {"huge-pages", required_argument, NULL, OPT_CONFIG},
+    {"huge-policy", required_argument, NULL, OPT_CONFIG},
+    {"huge-hint", required_argument, NULL, OPT_CONFIG},
+    {"dram-latency", required_argument, NULL, OPT_CONFIG},
+    {"disk-latency", required_argument, NULL, OPT_CONFIG},
+    {"disk-model", required_argument, NULL, OPT_CONFIG},
+    {"disk-seek-latency", required_argument, NULL, OPT_CONFIG},
+    {"disk-transfer-latency", required_argument, NULL, OPT_CONFIG},
+    {"swap-cluster", required_argument, NULL, OPT_CONFIG},
+    {"swap-readahead", required_argument, NULL, OPT_CONFIG},
+    {"dram-bits", required_argument, NULL, OPT_CONFIG},
+    {"seed", required_argument, NULL, OPT_CONFIG},
+    {"sample-interval", required_argument, NULL, OPT_CONFIG},
+    {"sample-window", required_argument, NULL, OPT_CONFIG},
+    {"sample-warmup", required_argument, NULL, OPT_CONFIG},
+    {"page-policy", required_argument, NULL, OPT_CONFIG},
+    {"wsclock-tau", required_argument, NULL, OPT_CONFIG},
+    {"page-walk", required_argument, NULL, OPT_CONFIG},
+    {"page-walk-cache", required_argument, NULL, OPT_CONFIG},
+    {NULL, 0, NULL, 0},
+};
+
+static const char usage_options[] =
+    "  -c, --convert <binary_trace>     convert a text trace to binary and exit\n"
+    "  -v, --verbosity <level>          summary, memory or debug\n"
+    "      --sweep <configs_file>       simulate every configuration of the "
+    "file\n"
+    "      --jobs <workers>             parallel simulations of a sweep\n"
+    "      --stack-distance <entries>   LRU hit ratios of every TLB size up "
+    "to\n"
+    "                                   <entries> and DRAM size, in one pass\n"
+    "      --cores <cores>              cores, running one trace each or the "
+    "core\n"
+    "                                   column of a single trace\n"
+    "      --threads                    simulate every core on a host thread\n"
+    "      --checkpoint <file>          save the simulation and stop, after\n"
+    "                                   --checkpoint-at instructions or at the "
+    "end\n"
+    "      --checkpoint-at <instructions>\n"
+    "                                   instructions taken from the traces "
+    "before\n"
+    "                                   the checkpoint\n"
+    "      --restore <file>             resume from a checkpoint of the same\n"
+    "                                   traces; only latencies can be changed\n"
+    "      --profile <file>             export interval snapshots, access "
+    "latency\n"
+    "                                   histograms, hot pages and reuse "
+    "distances\n"
+    "      --profile-format <format>    json or csv (one file per table); "
+    "guessed\n"
+    "                                   from the extension by default\n"
+    "      --profile-interval <instructions>\n"
+    "                                   instructions per snapshot, or 0 for "
+    "none\n"
+    "      --profile-pages <pages>      most accessed pages to export\n"
+    "      --digest <events>            hash the DRAM and disk accesses "
+    "instead of\n"
+    "                                   printing them, with a digest every\n"
+    "                                   <events>, or 0 for only the final one\n"
+    "      --digest-of <output_file>    digest the accesses of an output file "
+    "as\n"
+    "                                   --digest does, and exit\n"
+    "      --shootdown-latency <ns>     TLB shootdown cost of a remote core\n"
+    "      --context-switch <mode>      asid (keep the TLB entries of every "
+    "process)\n"
+    "                                   or flush (drop them on every switch)\n"
+    "      --tlb-l{1,2}-size <entries>  entries of a TLB level\n"
+    "      --tlb-l{1,2}-ways <ways>     ways per set of a TLB level, or full\n"
+    "      --tlb-l{1,2}-policy <policy> lru, plru, clock, fifo or random\n"
+    "      --tlb-l{1,2}-latency <ns>    access latency of a TLB level\n"
+    "      --tlb-l{1,2}-huge-size <entries>\n"
+    "                                   huge page entries of a TLB level, or 0 "
+    "to\n"
+    "                                   share the entries of the level\n"
+    "      --tlb-l{1,2}-huge-ways <ways>\n"
+    "                                   ways per set of the huge page entries\n"
+    "      --tlb-prefetch <prefetcher>  none, next, stride or distance\n"
+    "      --tlb-prefetch-degree <pages>\n"
+    "                                   pages prefetched after a TLB miss\n"
+    "      --tlb-prefetch-buffer <entries>\n"
+    "                                   prefetch buffer entries, or 0 to "
+    "prefetch\n"
+    "                                   into TLB L2\n"
+    "      --huge-pages <sizes>         off, or 2m and/or 1g, comma separated\n"
+    "      --huge-policy <policy>       always, promote or hint\n"
+    "      --huge-hint <start>-<end>    virtual address range for the hint "
+    "policy\n"
+    "      --dram-latency <ns>          access latency of DRAM\n"
+    "      --disk-latency <ns>          access latency of the disk\n"
+    "      --disk-model <model>         flat (disk latency per operation) or "
+    "seek\n"
+    "      --disk-seek-latency <ns>     seek time of the seek disk model\n"
+    "      --disk-transfer-latency <ns> transfer time of a page in the seek "
+    "model\n"
+    "      --swap-cluster <pages>       place swapped out pages in clusters of "
+    "this\n"
+    "                                   many slots, 0 for the reference "
+    "allocator\n"
+    "      --swap-readahead <pages>     pages of a cluster read per swap-in\n"
+    "      --cache-levels <levels>      data cache levels after translation, "
+    "from\n"
+    "                                   L1D to L2 and LLC, 0 for none\n"
+    "      --cache-line <bytes>         line size of the data caches\n"
+    "      --cache-write <policy>       back or through\n"
+    "      --cache-write-allocate <on|off>\n"
+    "                                   fill the line on a write miss\n"
+    "      --cache-{l1d,l2,llc}-size <bytes>\n"
+    "                                   size of a data cache level\n"
+    "      --cache-{l1d,l2,llc}-ways <ways>\n"
+    "                                   ways per set of a data cache level, or "
+    "full\n"
+    "      --cache-{l1d,l2,llc}-latency <ns>\n"
+    "                                   access latency of a data cache level\n"
+    "      --write-buffer <lines>       per core DRAM write buffer merging "
+    "page\n"
+    "                                   table and write-back traffic, 0 for "
+    "none\n"
+    "      --dram-bits <bits>           DRAM address bits\n"
+    "      --seed <seed>                seed of the random policies\n"
+    "      --sample-interval <instructions>\n"
+    "                                   estimate the run from a detailed "
+    "window\n"
+    "                                   of every <instructions>, warming up "
+    "the\n"
+    "                                   rest functionally\n"
+    "      --sample-window <instructions>\n"
+    "                                   instructions measured per window\n"
+    "      --sample-warmup <instructions>\n"
+    "                                   detailed instructions before each "
+    "window\n"
+    "      --page-policy <policy>       reference, fifo, clock, aging or "
+    "wsclock\n"
+    "      --wsclock-tau <ns>           working set window of wsclock\n"
+    "      --page-walk <model>          flat or radix\n"
+    "      --page-walk-cache <entries>  page walk cache entries per level\n";
+
+// Generators that can stand in for any instructions file.
+static const char usage_workloads[] =
+    "\nAn instructions file of - is read from the standard input, so traces "
+    "can\nbe piped in, for example from zstdcat.\n"
+    "\nWorkloads, <kind>[:<parameter>=<value>,...], in place of a file:\n"
+    "  sequential, strided, uniform, zipf, phased or chase\n"
+    "  every kind:  count, seed, base (first page), pages, cores, writes "
+    "(fraction),\n"
+    "               processes, quantum (accesses between context switches)\n"
+    "  sequential, strided: stride (bytes)\n"
+    "  zipf:        alpha, scatter (0 keeps hot pages together)\n"
+    "  phased:      phase (accesses), phases, shift (pages)\n";
+
+static void usage(const char* program) {
+  printf("PANIC: Usage: %s [options] <instructions_file>...\n%s%s", program,
+         usage_options, usage_workloads);
+  exit(EXIT_FAILURE);
+}
+
+static unsigned parse_jobs(const char* value) {
+  char* end;
+  unsigned long parsed = strtoul(value, &end, 0);
+  if (*value == '\0' || *end != '\0' || parsed == 0 || parsed > 1024) {
+    panic("Invalid value for --jobs: %s", value);
+  }
+  return (unsigned)parsed;
+}
+
+static uint64_t parse_stack_distance(const char* value) {
+  char* end;
+  unsigned long long parsed = strtoull(value, &end, 0);
+  if (*value == '\0' || *end != '\0' || parsed == 0 || parsed > UINT32_MAX) {
+    panic("Invalid value for --stack-distance: %s", value);
+  }
+  return parsed;
+}
+
+static uint64_t parse_checkpoint_at(const char* value) {
+  char* end;
+  unsigned long long parsed = strtoull(value, &end, 0);
+  if (*value == '\0' || *end != '\0' || parsed == 0) {
+    panic("Invalid value for --checkpoint-at: %s", value);
+  }
+  return parsed;
+}
+
+static uint64_t parse_count(const char* option, const char* value,
+                            uint64_t max) {
+  char* end;
+  unsigned long long parsed = strtoull(value, &end, 0);
+  if (*value == '\0' || *end != '\0' || parsed > max) {
+    panic("Invalid value for --%s: %s", option, value);
+  }
+  return parsed;
+}
+
+static profile_format_t parse_profile_format(const char* name) {
+  profile_format_t format;
+  if (!profile_format_parse(name, &format)) {
+    panic("Unknown profile format: %s (expected json or csv)", name);
+  }
+  return format;
+}
+
+static log_level_t parse_log_level(const char* name) {
+  if (strcmp(name, "summary") == 0 || strcmp(name, "0") == 0) {
+    return LOG_LEVEL_SUMMARY;
+  }
+  if (strcmp(name, "memory") == 0 || strcmp(name, "1") == 0) {
+    return LOG_LEVEL_MEMORY;
+  }
+  if (strcmp(name, "debug") == 0 || strcmp(name, "2") == 0) {
+    return LOG_LEVEL_DEBUG;
+  }
+  panic("Unknown verbosity level: %s (expected summary, memory or debug)",
+        name);
+}
+
+static void run_trace(const char* trace_path, checkpoint_run_t* run) {
+  trace_t trace;
+  checkpoint_run_open(run, 0, &trace, trace_path);
+
+  instruction_t instruction;
+  while (trace_next(&trace, &instruction)) {
+    log_dbg("* %c %" PRIx64, instruction_op_char(instruction.op),
+            instruction.address);
+    simulator_access(instruction.core, instruction.asid, instruction.op,
+                     instruction.address);
+    if (checkpoint_run_step(run, 0, 0)) {
+      break;
+    }
+  }
+
+  trace_close(&trace);
+}
 
 int main(int argc, char* argv[]) {
+  config_t config;
+  const char* convert_path = NULL;
+  const char* sweep_path = NULL;
+  unsigned jobs = thread_pool_default_jobs();
+  uint64_t stack_distance_entries = 0;
+  bool threaded = false;
+  const char* checkpoint_path = NULL;
+  uint64_t checkpoint_at = UINT64_MAX;
+  const char* restore_path = NULL;
+  const char* profile_path = NULL;
+  const char* profile_format = NULL;
+  uint64_t profile_interval = PROFILE_INTERVAL;
+  uint32_t profile_pages = PROFILE_TOP_PAGES;
+  bool digest = false;
+  uint64_t digest_interval = 0;
+  const char* digest_of_path = NULL;
+  log_level_t level = LOG_LEVEL_DEBUG;
+
+  // Options are applied as they come, to report invalid ones early, and
+  // again over the configuration of a restored checkpoint.
+  struct {
+    const char* name;
+    const char* value;
+  }* config_options = malloc(argc * sizeof(*config_options));
+  int total_config_options = 0;
+  if (!config_options) {
+    panic("Failed to allocate the command line options");
+  }
+
+  config_init(&config);
+
+  int option;
+  int option_index;
+  while ((option = getopt_long(argc, argv, "c:v:", long_options,
+                               &option_index)) != -1) {
+    switch (option) {
+      case 'c':
+        convert_path = optarg;
+        break;
+      case 'v':
+        level = parse_log_level(optarg);
+        break;
+      case OPT_SWEEP:
+        sweep_path = optarg;
+        break;
+      case OPT_JOBS:
+        jobs = parse_jobs(optarg);
+        break;
+      case OPT_STACK_DISTANCE:
+        stack_distance_entries = parse_stack_distance(optarg);
+        break;
+      case OPT_THREADS:
+        threaded = true;
+        break;
+      case OPT_CHECKPOINT:
+        checkpoint_path = optarg;
+        break;
+      case OPT_CHECKPOINT_AT:
+        checkpoint_at = parse_checkpoint_at(optarg);
+        break;
+      case OPT_RESTORE:
+        restore_path = optarg;
+        break;
+      case OPT_PROFILE:
+        profile_path = optarg;
+        break;
+      case OPT_PROFILE_FORMAT:
+        profile_format = optarg;
+        parse_profile_format(optarg);
+        break;
+      case OPT_PROFILE_INTERVAL:
+        profile_interval = parse_count("profile-interval", optarg, UINT64_MAX);
+        break;
+      case OPT_PROFILE_PAGES:
+        profile_pages = parse_count("profile-pages", optarg, UINT32_MAX);
+        break;
+      case OPT_DIGEST:
+        digest = true;
+        digest_interval = parse_count("digest", optarg, UINT64_MAX);
+        break;
+      case OPT_DIGEST_OF:
+        digest_of_path = optarg;
+        break;
+      case OPT_CONFIG:
+        config_set(&config, long_options[option_index].name, optarg);
+        config_options[total_config_options].name =
+            long_options[option_index].name;
+        config_options[total_config_options++].value = optarg;
+        break;
+      default:
+        usage(argv[0]);
+    }
+  }
+
+  log_init(level);
+
+  if (digest_of_path) {
+    free(config_options);
+    log_digest_init(digest_interval);
+    log_digest_file(digest_of_path);
+    log_flush();
+    return 0;
+  }
+
+  // Sweep configurations are applied over the command line options before
+  // being finalized, and only the CSV is printed.
+  if (sweep_path) {
+    if (optind >= argc) {
+      usage(argv[0]);
+    }
+    if (digest) {
+      panic("Sweeps only print their statistics, so they have no digest");
+    }
+    sweep_run(&config, sweep_path, argv[optind], jobs);
+    log_flush();
+    return 0;
+  }
+
+  if (restore_path) {
+    checkpoint_read_config(restore_path, &config);
+    for (int i = 0; i < total_config_options; i++) {
+      config_set(&config, config_options[i].name, config_options[i].value);
+    }
+  }
+  free(config_options);
+
+  // One trace per core.
+  unsigned traces = optind < argc ? argc - optind : 1;
+  if (traces > 1 && config.cores == 1) {
+    config.cores = traces;
+  }
+  config_finalize(&config);
+
   log_dbg("=========== System Properties ===========");
   log_dbg("Virtual address:       %d bits", VIRTUAL_ADDRESS_BITS);
   log_dbg("Page index:            %d bits", PAGE_SIZE_BITS);
-  log_dbg("DRAM address:          %d bits", DRAM_ADDRESS_BITS);
+  log_dbg("DRAM address:          %u bits", config.dram_address_bits);
   log_dbg("Disk address:          %d bits", DISK_ADDRESS_BITS);
   log_dbg("Virtual address space: %" PRIu64 " B", VIRTUAL_SIZE_BYTES);
-  log_dbg("DRAM address space:    %" PRIu64 " B", DRAM_SIZE_BYTES);
+  log_dbg("DRAM address space:    %" PRIu64 " B",
+          (uint64_t)1 << config.dram_address_bits);
   log_dbg("Disk address space:    %" PRIu64 " B", DISK_SIZE_BYTES);
   log_dbg("Page size:             %" PRIu64 " B", PAGE_SIZE_BYTES);
   log_dbg("Total pages:           %" PRIu64, TOTAL_PAGES);
   log_dbg("=========================================");
 
-  if (argc < 2) {
-    panic("Usage: %s <instructions_file>", argv[0]);
+  if (optind >= argc) {
+    usage(argv[0]);
   }
 
-  srand(0xcafebabe);
-  reset_time();
-  page_table_init();
-  tlb_init();
-
-  FILE* file = fopen(argv[1], "r");
-  if (!file) {
-    panic("Failed to open instructions file %s", argv[1]);
+  if (convert_path) {
+    uint64_t converted = trace_convert(argv[optind], convert_path);
+    log("Converted %" PRIu64 " instructions to %s", converted, convert_path);
+    return 0;
   }
 
-  uint64_t total_instructions = 0;
+  if (stack_distance_entries) {
+    stack_distance_run(argv[optind], stack_distance_entries,
+                       config_dram_page_capacity(&config));
+    log_flush();
+    return 0;
+  }
 
-  char line[256];
-  while (fgets(line, sizeof(line), file)) {
-    char instruction;
-    uint64_t address;
-    if (sscanf(line, "%c %" PRIx64, &instruction, &address) != 2) {
-      panic("Invalid instruction format: %s", line);
-    }
+  if (config.sample_interval && threaded) {
+    panic("Sampling needs a single order of the instructions, so it cannot "
+          "be used with --threads");
+  }
+  if ((checkpoint_path || restore_path) && threaded) {
+    panic("Checkpoints need a deterministic order of the cores, so they "
+          "cannot be used with --threads");
+  }
+  if (profile_path && threaded) {
+    panic("Profiles time every access against counters the cores share, so "
+          "they cannot be used with --threads");
+  }
+  if (digest && threaded) {
+    panic("Digests need a deterministic order of the accesses, so they "
+          "cannot be used with --threads");
+  }
+  if (digest) {
+    log_digest_init(digest_interval);
+  }
+  checkpoint_run_t run = {0};
+  run.position.traces = traces;
+  run.save_path = checkpoint_path;
+  run.save_at = checkpoint_at;
 
-    log_dbg("* %c %" PRIx64, instruction, address);
+  sim = simulator_create(&config);
 
-    switch (instruction) {
-      case 'R':
-        read(address);
-        break;
-      case 'W':
-        write(address);
-        break;
-      default:
-        panic("Unknown instruction: %c", instruction);
+  // Checkpoints saved through the library hold no position, and start the
+  // traces from the beginning.
+  if (restore_path) {
+    checkpoint_restore(restore_path, &run.position);
+    if (!run.position.traces) {
+      run.position.traces = traces;
+    } else if (run.position.traces != traces) {
+      panic("Checkpoint %s was saved from a run of %u traces, got %u",
+            restore_path, run.position.traces, traces);
     }
-
-    total_instructions++;
   }
 
-  fclose(file);
-
-  time_ns_t elapsed_time = get_time();
-  uint64_t page_faults = get_total_page_faults();
-  uint64_t page_evictions = get_total_page_evictions();
+  // Profiles only cover the instructions run after the restore point.
+  if (profile_path) {
+    profile_init(profile_interval, profile_pages);
+  }
 
-  uint64_t l1_hits = get_total_tlb_l1_hits();
-  uint64_t l1_misses = get_total_tlb_l1_misses();
-  uint64_t l1_invalidations = get_total_tlb_l1_invalidations();
-  uint64_t l2_hits = get_total_tlb_l2_hits();
-  uint64_t l2_misses = get_total_tlb_l2_misses();
-  uint64_t l2_invalidations = get_total_tlb_l2_invalidations();
+  if (config.cores > 1 || threaded) {
+    multicore_run((const char* const*)&argv[optind], traces, threaded, &run);
+  } else {
+    run_trace(argv[optind], &run);
+  }
+  checkpoint_run_finish(&run);
+  if (digest) {
+    log_digest_finish();
+  }
 
-  float l1_hit_rate =
-      (l1_hits + l1_misses) > 0 ? 100.0 * l1_hits / (l1_hits + l1_misses) : 0.0;
+  sim_stats_t stats;
+  simulator_get_stats(&stats);
+  simulator_report(&stats);
 
-  float l2_hit_rate =
-      (l2_hits + l2_misses) > 0 ? 100.0 * l2_hits / (l2_hits + l2_misses) : 0.0;
+  if (profile_path) {
+    const char* extension = strrchr(profile_path, '.');
+    bool csv = extension && strcmp(extension, ".csv") == 0;
+    profile_export(profile_path,
+                   profile_format ? parse_profile_format(profile_format)
+                   : csv          ? PROFILE_FORMAT_CSV
+                                  : PROFILE_FORMAT_JSON);
+  }
 
-  log("Elapsed: %" PRIu64 " ns", elapsed_time);
-  log("Total instructions executed: %" PRIu64, total_instructions);
-  log("Total page faults: %" PRIu64, page_faults);
-  log("Total page evictions: %" PRIu64, page_evictions);
-  log("Total TLB L1 hits: %" PRIu64 " (%.2f%%)", l1_hits, l1_hit_rate);
-  log("Total TLB L2 hits: %" PRIu64 " (%.2f%%)", l2_hits, l2_hit_rate);
-  log("Total TLB L1 invalidations: %" PRIu64, l1_invalidations);
-  log("Total TLB L2 invalidations: %" PRIu64, l2_invalidations);
+  tlbsim_destroy(sim);
+  log_flush();
 
   return 0;
-}
\ No newline at end of file
+}
@@ -1,13 +1,22 @@
 #include "memory.h"
 
+#include "cache.h"
 #include "clock.h"
+#include "config.h"
 #include "constants.h"
 #include "log.h"
 #include "page_table.h"
+#include "simulator.h"
 #include "tlb.h"
+#include "write_buffer.h"
 
 void log_dram_access(pa_dram_t address, op_t op) {
-  address &= DRAM_ADDRESS_MASK;
+  address &= config_dram_address_mask(&sim->config);
+  if (log_digest) {
+    log_digest_event(
+        op == OP_WRITE ? LOG_EVENT_DRAM_WRITE : LOG_EVENT_DRAM_READ, address);
+    return;
+  }
   switch (op) {
     case OP_READ:
       log_clk("R DRAM[%" PRIx64 "]", address);
@@ -20,6 +29,11 @@ void log_dram_access(pa_dram_t address, op_t op) {
 
 void log_disk_access(pa_disk_t address, op_t op) {
   address &= DISK_ADDRESS_MASK;
+  if (log_digest) {
+    log_digest_event(
+        op == OP_WRITE ? LOG_EVENT_DISK_WRITE : LOG_EVENT_DISK_READ, address);
+    return;
+  }
   switch (op) {
     case OP_READ:
       log_clk("R Disk[%" PRIx64 "]", address);
@@ -34,20 +48,83 @@ void read(va_t address) {
   address &= VIRTUAL_ADDRESS_MASK;
   pa_dram_t physical_address = tlb_translate(address, OP_READ);
   log_dram_access(physical_address, OP_READ);
+  if (sim->caches) {
+    cache_access(physical_address, OP_READ, false);
+  }
 }
 
 void write(va_t address) {
   address &= VIRTUAL_ADDRESS_MASK;
   pa_dram_t physical_address = tlb_translate(address, OP_WRITE);
   log_dram_access(physical_address, OP_WRITE);
+  if (sim->caches) {
+    cache_access(physical_address, OP_WRITE, false);
+  }
+}
+
+void warm(va_t address, op_t op) {
+  address &= VIRTUAL_ADDRESS_MASK;
+  pa_dram_t physical_address = tlb_warm(address, op);
+  if (sim->caches) {
+    cache_access(physical_address, op, false);
+  }
 }
 
 void dram_access(pa_dram_t address, op_t op) {
+  if (sim->warming) {
+    // Only the caches hold state that later accesses depend on.
+    if (sim->caches) {
+      cache_access(address, op, true);
+    }
+    return;
+  }
   log_dram_access(address, op);
-  increment_time(DRAM_LATENCY_NS);
+  if (sim->caches) {
+    cache_access(address, op, true);
+  } else {
+    dram_access_uncached(address, op);
+  }
+}
+
+void dram_access_uncached(pa_dram_t address, op_t op) {
+  if (sim->write_buffer && write_buffer_access(address, op)) {
+    return;
+  }
+  increment_time(sim->config.dram_latency_ns);
 }
 
 void disk_access(pa_disk_t address, op_t op) {
+  disk_access_pages(address, 1, op);
+}
+
+void disk_access_pages(pa_disk_t address, uint64_t pages, op_t op) {
   log_disk_access(address, op);
-  increment_time(DISK_LATENCY_NS);
+  if (op == OP_READ) {
+    sim->disk_reads++;
+  } else {
+    sim->disk_writes++;
+  }
+
+  if (sim->config.disk_model == DISK_MODEL_FLAT) {
+    increment_time(sim->config.disk_latency_ns);
+    return;
+  }
+  time_ns_t latency = pages * sim->config.disk_transfer_latency_ns;
+  if (address != sim->disk_head) {
+    latency += sim->config.disk_seek_latency_ns;
+    sim->disk_seeks++;
+  }
+  sim->disk_head = address + pages * PAGE_SIZE_BYTES;
+  increment_time(latency);
 }
+
+void memory_init() {
+  sim->disk_reads = 0;
+  sim->disk_writes = 0;
+  sim->disk_seeks = 0;
+  sim->disk_head = 0;
+}
+
+uint64_t get_total_disk_reads() { return sim->disk_reads; }
+uint64_t get_total_disk_writes() { return sim->disk_writes; }
+uint64_t get_total_disk_seeks() { return sim->disk_seeks; }
@@ -14,9 +14,36 @@ typedef uint64_t pa_dram_t;
 // Pertains to the physical address space of the disk storage.
 typedef uint64_t pa_disk_t;
 
+// Address space identifier, naming the process an address belongs to.
+typedef uint32_t asid_t;
+
 typedef enum { OP_READ, OP_WRITE } op_t;
 
+// Sizes a virtual page can be mapped with. Each one maps the range of a page
+// table node one level further from the leaves than the previous one; the
+// names are the sizes with the default constants.
+typedef enum {
+  PAGE_SIZE_4K,
+  PAGE_SIZE_2M,
+  PAGE_SIZE_1G,
+  PAGE_SIZES,
+} page_size_t;
+
 void read(va_t address);
 void write(va_t address);
+// An access made while sampling warms up: it updates the TLBs, page table and
+// caches, but is neither logged, counted nor timed.
+void warm(va_t address, op_t op);
+// An access of the MMU to DRAM, through the caches when there are some.
 void dram_access(pa_dram_t address, op_t op);
-void disk_access(pa_disk_t address, op_t op);
\ No newline at end of file
+// An access to DRAM itself, below the caches.
+void dram_access_uncached(pa_dram_t address, op_t op);
+void disk_access(pa_disk_t address, op_t op);
+// A single disk operation on `pages` consecutive pages.
+void disk_access_pages(pa_disk_t address, uint64_t pages, op_t op);
+
+void memory_init();
+
+uint64_t get_total_disk_reads();
+uint64_t get_total_disk_writes();
+uint64_t get_total_disk_seeks();
\ No newline at end of file
@@ -0,0 +1,199 @@
+#include "multicore.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "config.h"
+#include "log.h"
+#include "simulator.h"
+#include "trace.h"
+
+// Instructions of a core demultiplexed from a shared trace are packed in a
+// single word, with the ASID above the address and the operation in the top
+// bit.
+#define PACKED_OP_WRITE (1llu << 63)
+#define PACKED_ASID_SHIFT VIRTUAL_ADDRESS_BITS
+
+_Static_assert(PACKED_ASID_SHIFT + ASID_BITS < 63,
+               "Packed instructions do not fit in 64 bits");
+
+typedef struct {
+  tlbsim_ctx* ctx;
+  unsigned core;
+
+  // Either the trace of the core, or its instructions taken from a trace
+  // shared by all cores.
+  const char* trace_path;
+  uint64_t* instructions;
+  uint64_t total_instructions;
+  uint64_t capacity;
+
+  pthread_t thread;
+} core_stream_t;
+
+static inline void run_instruction(unsigned core,
+                                   const instruction_t* instruction) {
+  log_dbg("* %u %c %" PRIx64, core, instruction_op_char(instruction->op),
+          instruction->address);
+  simulator_access(core, instruction->asid, instruction->op,
+                   instruction->address);
+}
+
+static void run_shared_trace(const char* trace_path, checkpoint_run_t* run) {
+  trace_t trace;
+  checkpoint_run_open(run, 0, &trace, trace_path);
+
+  instruction_t instruction;
+  while (trace_next(&trace, &instruction)) {
+    run_instruction(instruction.core, &instruction);
+    if (checkpoint_run_step(run, 0, 0)) {
+      break;
+    }
+  }
+
+  trace_close(&trace);
+}
+
+static void run_interleaved_traces(const char* const* trace_paths,
+                                   unsigned traces, checkpoint_run_t* run) {
+  trace_t* trace = calloc(traces, sizeof(trace_t));
+  bool* done = calloc(traces, sizeof(bool));
+  if (!trace || !done) {
+    panic("Failed to allocate %u traces", traces);
+  }
+  for (unsigned core = 0; core < traces; core++) {
+    checkpoint_run_open(run, core, &trace[core], trace_paths[core]);
+  }
+
+  // A restored run picks up in the middle of the round it was saved in.
+  instruction_t instruction;
+  unsigned core = run->position.next_trace;
+  for (unsigned running = traces; running > 0; core = 0) {
+    for (; core < traces; core++) {
+      if (done[core]) {
+        continue;
+      }
+      if (trace_next(&trace[core], &instruction)) {
+        run_instruction(core, &instruction);
+        if (checkpoint_run_step(run, core, (core + 1) % traces)) {
+          running = 0;
+          break;
+        }
+      } else {
+        done[core] = true;
+        running--;
+      }
+    }
+  }
+
+  for (unsigned core = 0; core < traces; core++) {
+    trace_close(&trace[core]);
+  }
+  free(trace);
+  free(done);
+}
+
+// Splits a shared trace into the instructions of every core.
+static void demultiplex_trace(const char* trace_path, core_stream_t* streams) {
+  trace_t trace;
+  trace_open(&trace, trace_path);
+
+  instruction_t instruction;
+  while (trace_next(&trace, &instruction)) {
+    if (instruction.core >= sim->config.cores) {
+      panic("Instruction for core %u, but only %u cores are simulated",
+            instruction.core, sim->config.cores);
+    }
+
+    core_stream_t* stream = &streams[instruction.core];
+    if (stream->total_instructions == stream->capacity) {
+      stream->capacity = stream->capacity ? 2 * stream->capacity : 1 << 16;
+      stream->instructions = realloc(stream->instructions,
+                                     stream->capacity * sizeof(uint64_t));
+      if (!stream->instructions) {
+        panic("Failed to allocate the instructions of core %u",
+              instruction.core);
+      }
+    }
+    stream->instructions[stream->total_instructions++] =
+        (instruction.address & VIRTUAL_ADDRESS_MASK) |
+        ((uint64_t)instruction.asid << PACKED_ASID_SHIFT) |
+        (instruction.op == OP_WRITE ? PACKED_OP_WRITE : 0);
+  }
+
+  trace_close(&trace);
+}
+
+static void* run_core_thread(void* arg) {
+  core_stream_t* stream = arg;
+  sim = stream->ctx;
+
+  if (stream->trace_path) {
+    trace_t trace;
+    trace_open(&trace, stream->trace_path);
+
+    instruction_t instruction;
+    while (trace_next(&trace, &instruction)) {
+      run_instruction(stream->core, &instruction);
+    }
+
+    trace_close(&trace);
+  } else {
+    for (uint64_t i = 0; i < stream->total_instructions; i++) {
+      uint64_t packed = stream->instructions[i];
+      simulator_access(stream->core,
+                       (packed & ~PACKED_OP_WRITE) >> PACKED_ASID_SHIFT,
+                       (packed & PACKED_OP_WRITE) ? OP_WRITE : OP_READ,
+                       packed & VIRTUAL_ADDRESS_MASK);
+    }
+  }
+
+  return NULL;
+}
+
+static void run_threaded(const char* const* trace_paths, unsigned traces) {
+  core_stream_t* streams = calloc(sim->config.cores, sizeof(core_stream_t));
+  if (!streams) {
+    panic("Failed to allocate %u cores", sim->config.cores);
+  }
+
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    streams[core].ctx = sim;
+    streams[core].core = core;
+    if (traces > 1) {
+      streams[core].trace_path = trace_paths[core];
+    }
+  }
+  if (traces == 1) {
+    demultiplex_trace(trace_paths[0], streams);
+  }
+
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    if (pthread_create(&streams[core].thread, NULL, run_core_thread,
+                       &streams[core]) != 0) {
+      panic("Failed to start the thread of core %u", core);
+    }
+  }
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    pthread_join(streams[core].thread, NULL);
+    free(streams[core].instructions);
+  }
+  free(streams);
+}
+
+void multicore_run(const char* const* trace_paths, unsigned traces,
+                   bool threaded, checkpoint_run_t* run) {
+  if (traces > 1 && traces != sim->config.cores) {
+    panic("%u traces given for %u cores", traces, sim->config.cores);
+  }
+
+  if (threaded) {
+    run_threaded(trace_paths, traces);
+  } else if (traces > 1) {
+    run_interleaved_traces(trace_paths, traces, run);
+  } else {
+    run_shared_trace(trace_paths[0], run);
+  }
+
+  simulator_finish();
+}
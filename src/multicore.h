@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "checkpoint.h"
+
+// Runs the traces on `config.cores` cores, each with its own TLBs, sharing the
+// page table and DRAM.
+//
+// With a single trace, every instruction runs on the core given by its core
+// column, in trace order. With one trace per core, core `i` runs trace `i`,
+// and the cores take turns one instruction at a time.
+//
+// When `threaded` is set, every core is simulated on a host thread of its own
+// instead. Cores then reach the shared page table in an order that depends on
+// the host scheduler, so results can vary between runs.
+//
+// Runs that are not threaded start from the position of `run`, and stop once
+// its checkpoint is saved.
+void multicore_run(const char* const* trace_paths, unsigned traces,
+                   bool threaded, checkpoint_run_t* run);
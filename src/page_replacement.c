@@ -0,0 +1,443 @@
+#include "page_replacement.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "log.h"
+
+#define NO_PAGE UINT64_MAX
+#define NO_FRAME UINT64_MAX
+
+// Once WSClock has found a dirty page outside of the working set, how many
+// more frames it looks at for a clean one before settling for the dirty one.
+#define WSCLOCK_CLEAN_SEARCH 32
+
+static const char* policy_names[] = {
+    [PAGE_POLICY_REFERENCE] = "reference", [PAGE_POLICY_FIFO] = "fifo",
+    [PAGE_POLICY_CLOCK] = "clock",         [PAGE_POLICY_AGING] = "aging",
+    [PAGE_POLICY_WSCLOCK] = "wsclock",
+};
+
+const char* page_policy_name(page_policy_t policy) {
+  return policy_names[policy];
+}
+
+bool page_policy_parse(const char* name, page_policy_t* policy) {
+  for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++) {
+    if (strcmp(name, policy_names[i]) == 0) {
+      *policy = (page_policy_t)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void* zalloc(size_t count, size_t size) {
+  void* memory = calloc(count, size);
+  if (!memory) {
+    panic("Failed to allocate page replacement state");
+  }
+  return memory;
+}
+
+// ========================================================================
+// REFERENCE: lowest resident virtual page first.
+// ========================================================================
+
+static void heap_push(page_replacement_t* r, va_t virtual_page_number) {
+  if (r->heap_size == r->heap_capacity) {
+    r->heap_capacity = r->heap_capacity ? 2 * r->heap_capacity : 1024;
+    r->heap = realloc(r->heap, r->heap_capacity * sizeof(va_t));
+    if (!r->heap) {
+      panic("Failed to allocate page replacement state");
+    }
+  }
+
+  uint64_t i = r->heap_size++;
+  while (i > 0 && r->heap[(i - 1) / 2] > virtual_page_number) {
+    r->heap[i] = r->heap[(i - 1) / 2];
+    i = (i - 1) / 2;
+  }
+  r->heap[i] = virtual_page_number;
+}
+
+static va_t heap_pop(page_replacement_t* r) {
+  if (!r->heap_size) {
+    panic("No resident page to evict");
+  }
+  va_t top = r->heap[0];
+  va_t last = r->heap[--r->heap_size];
+
+  uint64_t i = 0;
+  for (;;) {
+    uint64_t child = 2 * i + 1;
+    if (child >= r->heap_size) {
+      break;
+    }
+    if (child + 1 < r->heap_size && r->heap[child + 1] < r->heap[child]) {
+      child++;
+    }
+    if (last <= r->heap[child]) {
+      break;
+    }
+    r->heap[i] = r->heap[child];
+    i = child;
+  }
+  if (r->heap_size) {
+    r->heap[i] = last;
+  }
+  return top;
+}
+
+// ========================================================================
+// FIFO.
+// ========================================================================
+
+static void fifo_push(page_replacement_t* r, uint64_t frame) {
+  r->next[frame] = NO_FRAME;
+  if (r->fifo_tail == NO_FRAME) {
+    r->fifo_head = frame;
+  } else {
+    r->next[r->fifo_tail] = frame;
+  }
+  r->fifo_tail = frame;
+}
+
+static uint64_t fifo_pop(page_replacement_t* r) {
+  if (r->fifo_head == NO_FRAME) {
+    panic("No resident page to evict");
+  }
+  uint64_t frame = r->fifo_head;
+  r->fifo_head = r->next[frame];
+  if (r->fifo_head == NO_FRAME) {
+    r->fifo_tail = NO_FRAME;
+  }
+  return frame;
+}
+
+// ========================================================================
+// CLOCK.
+// ========================================================================
+
+static uint64_t clock_victim(page_replacement_t* r) {
+  // Terminates within two turns of the hand, as every visited page loses its
+  // referenced bit, unless a whole turn finds no page at all.
+  bool resident = false;
+  for (uint64_t step = 0;; step++) {
+    if (step == r->frames && !resident) {
+      panic("No resident page to evict");
+    }
+    uint64_t frame = r->hand;
+    r->hand = (r->hand + 1) % r->frames;
+    if (r->page_number[frame] == NO_PAGE) {
+      continue;
+    }
+    resident = true;
+    if (!r->referenced[frame]) {
+      return frame;
+    }
+    r->referenced[frame] = 0;
+  }
+}
+
+// ========================================================================
+// AGING.
+// ========================================================================
+
+static void aging_tick(page_replacement_t* r) {
+  uint64_t counts[257] = {0};
+
+  for (uint64_t frame = 0; frame < r->frames; frame++) {
+    if (r->page_number[frame] == NO_PAGE) {
+      continue;
+    }
+    r->age[frame] = (r->age[frame] >> 1) | (r->referenced[frame] << 7);
+    r->referenced[frame] = 0;
+    counts[r->age[frame] + 1]++;
+  }
+
+  // Counting sort of the resident frames by age, youngest frames last. Ties
+  // keep frame order so the choice is deterministic.
+  for (int age = 0; age < 256; age++) {
+    counts[age + 1] += counts[age];
+  }
+  r->aging_order_size = counts[256];
+
+  for (uint64_t frame = 0; frame < r->frames; frame++) {
+    if (r->page_number[frame] != NO_PAGE) {
+      r->aging_order[counts[r->age[frame]]++] = frame;
+    }
+  }
+
+  r->aging_order_cursor = 0;
+  r->references_since_tick = 0;
+}
+
+static uint64_t aging_victim(page_replacement_t* r) {
+  for (;;) {
+    while (r->aging_order_cursor < r->aging_order_size) {
+      uint64_t frame = r->aging_order[r->aging_order_cursor++];
+      if (r->page_number[frame] != NO_PAGE) {
+        return frame;
+      }
+    }
+    aging_tick(r);
+    if (!r->aging_order_size) {
+      panic("No resident page to evict");
+    }
+  }
+}
+
+// ========================================================================
+// WSCLOCK.
+// ========================================================================
+
+static uint64_t wsclock_victim(page_replacement_t* r) {
+  time_ns_t now = get_time();
+  uint64_t old_dirty_frame = NO_FRAME;
+  uint64_t oldest_frame = NO_FRAME;
+  uint64_t steps = r->frames;
+
+  for (uint64_t step = 0; step < steps; step++) {
+    uint64_t frame = r->hand;
+    r->hand = (r->hand + 1) % r->frames;
+    if (r->page_number[frame] == NO_PAGE) {
+      continue;
+    }
+
+    if (r->referenced[frame]) {
+      r->referenced[frame] = 0;
+      r->last_use[frame] = now;
+    } else if (now - r->last_use[frame] > r->wsclock_tau) {
+      if (!r->dirty[frame]) {
+        return frame;
+      }
+      if (old_dirty_frame == NO_FRAME) {
+        old_dirty_frame = frame;
+        if (step + WSCLOCK_CLEAN_SEARCH < steps) {
+          steps = step + WSCLOCK_CLEAN_SEARCH;
+        }
+      }
+    }
+
+    if (oldest_frame == NO_FRAME ||
+        r->last_use[frame] < r->last_use[oldest_frame]) {
+      oldest_frame = frame;
+    }
+  }
+
+  if (oldest_frame == NO_FRAME) {
+    panic("No resident page to evict");
+  }
+
+  // No clean page outside of the working set: evict a dirty one, or the
+  // least recently used page if the whole of DRAM is in the working set.
+  uint64_t frame = old_dirty_frame != NO_FRAME ? old_dirty_frame : oldest_frame;
+  r->hand = (frame + 1) % r->frames;
+  return frame;
+}
+
+// ========================================================================
+// Policy interface.
+// ========================================================================
+
+void page_replacement_init(page_replacement_t* r, page_policy_t policy,
+                           uint64_t frames, time_ns_t wsclock_tau) {
+  page_replacement_free(r);
+
+  r->policy = policy;
+  r->frames = frames;
+  r->wsclock_tau = wsclock_tau;
+  r->fifo_head = NO_FRAME;
+  r->fifo_tail = NO_FRAME;
+
+  if (policy == PAGE_POLICY_REFERENCE) {
+    return;
+  }
+
+  r->page_number = zalloc(frames, sizeof(va_t));
+  r->referenced = zalloc(frames, sizeof(uint8_t));
+  r->dirty = zalloc(frames, sizeof(uint8_t));
+  for (uint64_t frame = 0; frame < frames; frame++) {
+    r->page_number[frame] = NO_PAGE;
+  }
+
+  switch (policy) {
+    case PAGE_POLICY_REFERENCE:
+      break;
+    case PAGE_POLICY_FIFO:
+      r->next = zalloc(frames, sizeof(uint64_t));
+      break;
+    case PAGE_POLICY_CLOCK:
+      break;
+    case PAGE_POLICY_AGING:
+      r->age = zalloc(frames, sizeof(uint8_t));
+      r->aging_order = zalloc(frames, sizeof(uint64_t));
+      break;
+    case PAGE_POLICY_WSCLOCK:
+      r->last_use = zalloc(frames, sizeof(time_ns_t));
+      break;
+  }
+}
+
+void page_replacement_free(page_replacement_t* r) {
+  free(r->page_number);
+  free(r->referenced);
+  free(r->dirty);
+  free(r->heap);
+  free(r->next);
+  free(r->age);
+  free(r->aging_order);
+  free(r->last_use);
+  memset(r, 0, sizeof(*r));
+}
+
+void page_replacement_loaded(page_replacement_t* r, va_t virtual_page_number,
+                             uint64_t frame) {
+  r->resident++;
+  if (r->policy == PAGE_POLICY_REFERENCE) {
+    // The reference model does not track frames: it may hand out a frame
+    // number that is not backed by the frame allocator.
+    heap_push(r, virtual_page_number);
+    return;
+  }
+
+  r->page_number[frame] = virtual_page_number;
+  r->referenced[frame] = 1;
+  r->dirty[frame] = 0;
+
+  switch (r->policy) {
+    case PAGE_POLICY_FIFO:
+      fifo_push(r, frame);
+      break;
+    case PAGE_POLICY_AGING:
+      r->age[frame] = 0;
+      break;
+    case PAGE_POLICY_WSCLOCK:
+      r->last_use[frame] = get_time();
+      break;
+    default:
+      break;
+  }
+}
+
+void page_replacement_referenced(page_replacement_t* r, uint64_t frame,
+                                 op_t op) {
+  if (r->policy == PAGE_POLICY_REFERENCE) {
+    return;
+  }
+
+  r->referenced[frame] = 1;
+  if (op == OP_WRITE) {
+    r->dirty[frame] = 1;
+  }
+
+  if (r->policy == PAGE_POLICY_AGING &&
+      ++r->references_since_tick >= r->frames) {
+    aging_tick(r);
+  }
+}
+
+va_t page_replacement_victim(page_replacement_t* r) {
+  if (!r->resident) {
+    panic("No resident page to evict");
+  }
+  r->resident--;
+
+  uint64_t frame = 0;
+  switch (r->policy) {
+    case PAGE_POLICY_REFERENCE:
+      return heap_pop(r);
+    case PAGE_POLICY_FIFO:
+      frame = fifo_pop(r);
+      break;
+    case PAGE_POLICY_CLOCK:
+      frame = clock_victim(r);
+      break;
+    case PAGE_POLICY_AGING:
+      frame = aging_victim(r);
+      break;
+    case PAGE_POLICY_WSCLOCK:
+      frame = wsclock_victim(r);
+      break;
+  }
+
+  va_t virtual_page_number = r->page_number[frame];
+  r->page_number[frame] = NO_PAGE;
+  return virtual_page_number;
+}
+
+// The state of a resident frame, saved as a record of its own.
+static void checkpoint_frame(struct checkpoint* checkpoint,
+                             page_replacement_t* r, uint64_t frame) {
+  checkpoint_value(checkpoint, r->page_number[frame]);
+  checkpoint_value(checkpoint, r->referenced[frame]);
+  checkpoint_value(checkpoint, r->dirty[frame]);
+  if (r->next) {
+    checkpoint_value(checkpoint, r->next[frame]);
+  }
+  if (r->age) {
+    checkpoint_value(checkpoint, r->age[frame]);
+  }
+  if (r->last_use) {
+    checkpoint_value(checkpoint, r->last_use[frame]);
+  }
+}
+
+void page_replacement_checkpoint(struct checkpoint* checkpoint,
+                                 page_replacement_t* r) {
+  checkpoint_value(checkpoint, r->resident);
+
+  checkpoint_value(checkpoint, r->heap_size);
+  checkpoint_vector(checkpoint, (void**)&r->heap, r->heap_size, sizeof(va_t));
+  if (checkpoint->restoring) {
+    r->heap_capacity = r->heap_size;
+  }
+
+  // Only the frames holding a page are saved, each one with its number, as
+  // the state of the other frames is never read before they are loaded.
+  // Restoring happens over freshly initialized frames.
+  if (r->page_number) {
+    uint64_t frames = 0;
+    if (!checkpoint->restoring) {
+      for (uint64_t frame = 0; frame < r->frames; frame++) {
+        frames += r->page_number[frame] != NO_PAGE;
+      }
+    }
+    checkpoint_value(checkpoint, frames);
+    if (checkpoint->restoring) {
+      if (frames > r->frames) {
+        panic("Corrupted checkpoint %s", checkpoint->path);
+      }
+      for (uint64_t i = 0; i < frames; i++) {
+        uint64_t frame;
+        checkpoint_value(checkpoint, frame);
+        if (frame >= r->frames) {
+          panic("Corrupted checkpoint %s", checkpoint->path);
+        }
+        checkpoint_frame(checkpoint, r, frame);
+      }
+    } else {
+      for (uint64_t frame = 0; frame < r->frames; frame++) {
+        if (r->page_number[frame] != NO_PAGE) {
+          checkpoint_value(checkpoint, frame);
+          checkpoint_frame(checkpoint, r, frame);
+        }
+      }
+    }
+  }
+
+  checkpoint_value(checkpoint, r->fifo_head);
+  checkpoint_value(checkpoint, r->fifo_tail);
+  checkpoint_value(checkpoint, r->hand);
+
+  checkpoint_value(checkpoint, r->aging_order_size);
+  if (r->aging_order_size > r->frames) {
+    panic("Corrupted checkpoint %s", checkpoint->path);
+  }
+  checkpoint_array(checkpoint, r->aging_order, r->aging_order_size,
+                   sizeof(uint64_t));
+  checkpoint_value(checkpoint, r->aging_order_cursor);
+  checkpoint_value(checkpoint, r->references_since_tick);
+}
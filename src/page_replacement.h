@@ -0,0 +1,98 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "clock.h"
+#include "memory.h"
+
+// Policies used to pick the page evicted from DRAM when no frame is free.
+typedef enum {
+  // Evicts the lowest resident virtual page, like the reference simulator the
+  // expected outputs were produced with.
+  PAGE_POLICY_REFERENCE,
+  // Evicts the page that was loaded the longest time ago.
+  PAGE_POLICY_FIFO,
+  // Second chance: a hand sweeps the frames, clearing referenced bits, and
+  // evicts the first page that was not referenced since the last sweep.
+  PAGE_POLICY_CLOCK,
+  // LRU approximation: every tick, each frame's age counter is shifted right
+  // with its referenced bit moved into the top bit. Evicts the lowest age.
+  PAGE_POLICY_AGING,
+  // WSClock: like CLOCK, but only evicts pages that fell out of the working
+  // set window, preferring clean ones.
+  PAGE_POLICY_WSCLOCK,
+} page_policy_t;
+
+typedef struct {
+  page_policy_t policy;
+  uint64_t frames;
+
+  // Per frame state, not allocated for REFERENCE. Frames that hold no page
+  // have `page_number` set to UINT64_MAX.
+  va_t* page_number;
+  uint8_t* referenced;
+  uint8_t* dirty;
+  // Pages loaded and not evicted yet.
+  uint64_t resident;
+
+  // REFERENCE: binary min-heap of resident virtual page numbers. It can grow
+  // past the number of frames, as the reference model reuses frames
+  // without going through the frame allocator.
+  va_t* heap;
+  uint64_t heap_size;
+  uint64_t heap_capacity;
+
+  // FIFO: intrusive queue of frames in load order.
+  uint64_t* next;
+  uint64_t fifo_head;
+  uint64_t fifo_tail;
+
+  // CLOCK/WSCLOCK: the hand.
+  uint64_t hand;
+
+  // AGING: age counter per frame, and the frames sorted by age at the last
+  // tick, consumed in order by the following evictions.
+  uint8_t* age;
+  uint64_t* aging_order;
+  uint64_t aging_order_size;
+  uint64_t aging_order_cursor;
+  uint64_t references_since_tick;
+
+  // WSCLOCK: time of last use per frame, and the working set window.
+  time_ns_t* last_use;
+  time_ns_t wsclock_tau;
+} page_replacement_t;
+
+void page_replacement_init(page_replacement_t* replacement,
+                           page_policy_t policy, uint64_t frames,
+                           time_ns_t wsclock_tau);
+void page_replacement_free(page_replacement_t* replacement);
+
+struct checkpoint;
+// Saves or restores the state of an initialized policy.
+void page_replacement_checkpoint(struct checkpoint* checkpoint,
+                                 page_replacement_t* replacement);
+
+// A page has been loaded into a frame.
+void page_replacement_loaded(page_replacement_t* replacement,
+                             va_t virtual_page_number, uint64_t frame);
+
+// A resident page has been referenced by a page table walk.
+void page_replacement_referenced(page_replacement_t* replacement,
+                                 uint64_t frame, op_t op);
+
+// Picks the resident page to evict and forgets about it.
+// Panics when no page is resident.
+va_t page_replacement_victim(page_replacement_t* replacement);
+
+// Pages that can be evicted.
+static inline uint64_t page_replacement_resident(
+    const page_replacement_t* replacement) {
+  return replacement->resident;
+}
+
+const char* page_policy_name(page_policy_t policy);
+
+// Returns false if the name does not match any policy.
+bool page_policy_parse(const char* name, page_policy_t* policy);
@@ -6,18 +6,21 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "cache.h"
+#include "checkpoint.h"
 #include "clock.h"
 #include "constants.h"
+#include "config.h"
+#include "frame_allocator.h"
 #include "log.h"
+#include "page_replacement.h"
+#include "simulator.h"
+#include "swap.h"
 #include "tlb.h"
 
 #define PAGE_TABLE_DRAM_ADDRESS (0)
 
 pa_dram_t RANDOM_PAGE_ADDRESS_BASE = 0xcafebabe;
-pa_dram_t RANDOM_PAGE_ADDRESS_IT = 0;
-
-uint64_t page_faults = 0;
-uint64_t page_evictions = 0;
 
 typedef struct {
   // This only stored the page index, not the full address.
@@ -33,44 +36,379 @@ typedef struct {
   bool dirty;
 } page_table_entry_t;
 
-page_table_entry_t page_table[TOTAL_PAGES];
-
 typedef struct {
   bool is_swapped;
   pa_disk_t disk_page_number;
 } pte_metadata_t;
 
-pte_metadata_t pte_metadata[TOTAL_PAGES];
+// Head of every page table node.
+typedef struct {
+  // Frame holding this node in the simulated DRAM.
+  pa_dram_t dram_page_number;
+
+  // Huge page mapping the whole range of the node, when valid. Its DRAM page
+  // number is the first of a run of aligned frames.
+  page_table_entry_t huge;
+} page_table_header_t;
+
+// The page table is a radix tree of PAGE_TABLE_LEVELS levels, each one indexed
+// by PAGE_TABLE_INDEX_BITS bits of the virtual page number, most significant
+// first. Nodes are only allocated once a page below them is touched, so the
+// simulator memory grows with the footprint of the trace rather than with the
+// size of the virtual address space.
+typedef struct {
+  page_table_header_t header;
+  // Nodes of the next level, or leaves below the last interior level.
+  void* children[PAGE_TABLE_FANOUT];
+} page_table_node_t;
+
+typedef struct {
+  page_table_header_t header;
+  page_table_entry_t entries[PAGE_TABLE_FANOUT];
+  pte_metadata_t metadata[PAGE_TABLE_FANOUT];
+
+  // Pages of the leaf that are resident in DRAM, and swapped out to disk.
+  uint32_t resident;
+  uint32_t swapped;
+
+  // Run of frames reserved for the pages of the leaf by
+  // HUGE_PAGE_POLICY_PROMOTE, starting at `reservation`.
+  bool reserved;
+  pa_dram_t reservation;
+} page_table_leaf_t;
+
+// A reservation, queued in the order it was made so the oldest one is broken
+// first. Reservations that have since been broken or promoted no longer match
+// their leaf, and are skipped.
+typedef struct {
+  page_table_leaf_t* leaf;
+  pa_dram_t reservation;
+} page_table_reservation_t;
+
+// Page walk cache: a small FIFO cache per interior level, mapping the prefix of
+// a virtual page number down to that level onto the node it points to, so
+// walks can skip the upper levels.
+typedef struct {
+  va_t* tags;
+  void** nodes;
+  uint32_t size;
+  uint32_t used;
+  uint32_t next;
+} page_walk_cache_t;
+
+// Page table state of a simulation.
+struct page_table_state {
+  // Page table of every address space, created on its first access. All of
+  // them share the DRAM frames and the replacement policy.
+  page_table_node_t* roots[MAX_ADDRESS_SPACES];
+  page_walk_cache_t walk_cache[PAGE_TABLE_LEVELS - 1];
+
+  frame_allocator_t dram_frames;
+  page_replacement_t replacement;
+
+  pa_dram_t random_page_address_it;
+
+  page_table_reservation_t* reservations;
+  uint64_t reservations_head;
+  uint64_t reservations_tail;
+  uint64_t reservations_capacity;
+
+  uint64_t page_faults;
+  uint64_t page_evictions;
+  uint64_t huge_pages[PAGE_SIZES];
+  uint64_t huge_page_promotions;
+  uint64_t huge_page_splits;
+};
+
+static inline uint64_t page_table_index(va_t virtual_page_number, int level) {
+  int shift = (PAGE_TABLE_LEVELS - 1 - level) * PAGE_TABLE_INDEX_BITS;
+  return (virtual_page_number >> shift) & (PAGE_TABLE_FANOUT - 1);
+}
+
+// Number of base pages mapped by a page of the given size.
+static inline uint64_t pages_per_page_of(page_size_t size) {
+  return 1llu << (size * PAGE_TABLE_INDEX_BITS);
+}
+
+static inline bool huge_pages_enabled(page_size_t size) {
+  return sim->config.huge_page_sizes & (1u << size);
+}
+
+static bool break_oldest_reservation();
+
+bool allocate_dram_page(pa_dram_t* dram_page_address) {
+  pa_dram_t dram_page_number;
+  if (!frame_allocator_alloc(&sim->page_table->dram_frames, &dram_page_number)) {
+    // The frames of reservations are handed out before any page is evicted.
+    if (!break_oldest_reservation() ||
+        !frame_allocator_alloc(&sim->page_table->dram_frames,
+                               &dram_page_number)) {
+      return false;
+    }
+  }
+  *dram_page_address = dram_page_number << PAGE_SIZE_BITS;
+  return true;
+}
+
+// Gives a newly created page table node its own frame. Only done in the radix
+// walk model; the flat model keeps the whole page table in the frame at
+// PAGE_TABLE_DRAM_ADDRESS.
+pa_dram_t allocate_page_table_frame() {
+  if (sim->config.page_walk != PAGE_WALK_RADIX) {
+    return PAGE_TABLE_DRAM_ADDRESS;
+  }
+
+  pa_dram_t node_dram_address;
+  if (!allocate_dram_page(&node_dram_address)) {
+    node_dram_address = evict_page_from_dram();
+  }
+  return node_dram_address >> PAGE_SIZE_BITS;
+}
+
+static void* allocate_page_table_node(int level) {
+  size_t size = level == PAGE_TABLE_LEVELS - 1 ? sizeof(page_table_leaf_t)
+                                                : sizeof(page_table_node_t);
+  // Both node types start with their header.
+  page_table_header_t* node = calloc(1, size);
+  if (!node) {
+    panic("Failed to allocate a page table node");
+  }
+  node->dram_page_number = allocate_page_table_frame();
+  return node;
+}
+
+static void free_page_table_node(void* node, int level) {
+  if (!node) {
+    return;
+  }
+  if (level < PAGE_TABLE_LEVELS - 1) {
+    for (int i = 0; i < PAGE_TABLE_FANOUT; i++) {
+      free_page_table_node(((page_table_node_t*)node)->children[i], level + 1);
+    }
+  }
+  free(node);
+}
 
-bool allocated_dram_pages[DRAM_PAGE_CAPACITY];
+// Address of the word read at `level` when walking to the page.
+static inline pa_dram_t page_table_word_address(const void* node,
+                                                va_t virtual_page_number,
+                                                int level) {
+  pa_dram_t node_dram_page_number =
+      ((const page_table_header_t*)node)->dram_page_number;
+  return (node_dram_page_number << PAGE_SIZE_BITS) |
+         page_table_index(virtual_page_number, level) * PAGE_TABLE_ENTRY_BYTES;
+}
+
+static inline va_t page_walk_cache_tag(asid_t asid, va_t virtual_page_number,
+                                       int level) {
+  int shift = (PAGE_TABLE_LEVELS - 1 - level) * PAGE_TABLE_INDEX_BITS;
+  return page_key(asid, virtual_page_number >> shift);
+}
 
-page_table_entry_t* get_free_page_table_entry() {
-  for (va_t virtual_page_number = 0; virtual_page_number < TOTAL_PAGES;
-       virtual_page_number++) {
-    if (!page_table[virtual_page_number].valid) {
-      return &page_table[virtual_page_number];
+static void* page_walk_cache_lookup(int level, asid_t asid,
+                                    va_t virtual_page_number) {
+  page_walk_cache_t* cache = &sim->page_table->walk_cache[level];
+  va_t tag = page_walk_cache_tag(asid, virtual_page_number, level);
+  for (uint32_t i = 0; i < cache->used; i++) {
+    if (cache->tags[i] == tag) {
+      return cache->nodes[i];
     }
   }
   return NULL;
 }
 
-bool allocate_dram_page(pa_dram_t* dram_page_address) {
-  // Very inefficient (but simple) way of finding a free DRAM page.
-  for (pa_dram_t dram_page_number = 0; dram_page_number < DRAM_PAGE_CAPACITY;
-       dram_page_number++) {
-    if (dram_page_number == PAGE_TABLE_DRAM_ADDRESS) {
-      continue;
+static void page_walk_cache_insert(int level, asid_t asid,
+                                   va_t virtual_page_number, void* node) {
+  page_walk_cache_t* cache = &sim->page_table->walk_cache[level];
+  if (!cache->size ||
+      page_walk_cache_lookup(level, asid, virtual_page_number) == node) {
+    return;
+  }
+  cache->tags[cache->next] =
+      page_walk_cache_tag(asid, virtual_page_number, level);
+  cache->nodes[cache->next] = node;
+  cache->next = (cache->next + 1) % cache->size;
+  if (cache->used < cache->size) {
+    cache->used++;
+  }
+}
+
+static void page_walk_cache_init(uint32_t size) {
+  for (int level = 0; level < PAGE_TABLE_LEVELS - 1; level++) {
+    page_walk_cache_t* cache = &sim->page_table->walk_cache[level];
+    free(cache->tags);
+    free(cache->nodes);
+    memset(cache, 0, sizeof(*cache));
+    if (size) {
+      cache->size = size;
+      cache->tags = calloc(size, sizeof(va_t));
+      cache->nodes = calloc(size, sizeof(void*));
+      if (!cache->tags || !cache->nodes) {
+        panic("Failed to allocate the page walk cache");
+      }
     }
+  }
+}
 
-    if (!allocated_dram_pages[dram_page_number]) {
-      allocated_dram_pages[dram_page_number] = true;
-      *dram_page_address = dram_page_number << PAGE_SIZE_BITS;
+void page_table_flush_walk_cache() {
+  for (int level = 0; level < PAGE_TABLE_LEVELS - 1; level++) {
+    sim->page_table->walk_cache[level].used = 0;
+    sim->page_table->walk_cache[level].next = 0;
+  }
+}
+
+// Whether the region of `size` holding the page lies within a hinted range.
+static bool huge_page_hinted(va_t virtual_page_number, page_size_t size) {
+  va_t start = (virtual_page_number & ~(pages_per_page_of(size) - 1))
+               << PAGE_SIZE_BITS;
+  va_t end = start + (1llu << PAGE_SIZE_BITS_OF(size));
+  for (uint32_t i = 0; i < sim->config.huge_page_hint_count; i++) {
+    const va_t* hint = sim->config.huge_page_hints[i];
+    if (hint[0] <= start && end <= hint[1]) {
       return true;
     }
   }
   return false;
 }
 
+// Maps the whole range of a node at `level` with a huge page, if the policy
+// allows it and an aligned run of free frames is left. `fresh` tells whether
+// the range is untouched. Returns whether the page was mapped, which counts as
+// the page fault of the access. `entry_address` is the page table word
+// pointing to the node.
+static bool huge_page_fault(page_table_header_t* node, int level, bool fresh,
+                            asid_t asid, va_t virtual_page_number,
+                            pa_dram_t entry_address) {
+  page_size_t size = (page_size_t)(PAGE_TABLE_LEVELS - level);
+  if (!fresh || !huge_pages_enabled(size) ||
+      sim->config.huge_page_policy == HUGE_PAGE_POLICY_PROMOTE ||
+      (sim->config.huge_page_policy == HUGE_PAGE_POLICY_HINT &&
+       !huge_page_hinted(virtual_page_number, size))) {
+    return false;
+  }
+
+  uint64_t pages = pages_per_page_of(size);
+  pa_dram_t first_dram_page_number;
+  if (!frame_allocator_alloc_aligned(&sim->page_table->dram_frames, pages,
+                                     &first_dram_page_number)) {
+    return false;
+  }
+
+  log_dbg("***** Page fault! *****");
+  log_dbg("***** Mapping huge page %" PRIx64 " of %" PRIu64 " pages *****",
+          virtual_page_number >> (size * PAGE_TABLE_INDEX_BITS), pages);
+  sim->page_table->page_faults++;
+  sim->page_table->huge_pages[size]++;
+
+  node->huge.dram_page_number = first_dram_page_number;
+  node->huge.valid = true;
+  node->huge.dirty = false;
+
+  // 2 MiB pages are split and evicted page by page under memory pressure,
+  // while 1 GiB pages stay pinned in DRAM, like hugetlbfs pages.
+  if (size == PAGE_SIZE_2M) {
+    va_t first_virtual_page_number = virtual_page_number & ~(pages - 1);
+    for (uint64_t i = 0; i < pages; i++) {
+      page_replacement_loaded(&sim->page_table->replacement,
+                              page_key(asid, first_virtual_page_number + i),
+                              first_dram_page_number + i);
+    }
+  }
+
+  dram_access(entry_address, OP_WRITE);
+  return true;
+}
+
+// Root of the page table of an address space, created on its first access.
+static page_table_node_t* page_table_root(asid_t asid) {
+  page_table_node_t** root = &sim->page_table->roots[asid];
+  if (!*root) {
+    *root = allocate_page_table_node(0);
+  }
+  return *root;
+}
+
+// Finds the node mapping the page, creating the missing nodes on the way:
+// either its leaf, or the node mapping it with a huge page. `*level` is set to
+// the level of the returned node.
+// When `charge` is set, the walk is timed according to the page walk model:
+// the radix model reads one word per level, skipping the levels found in the
+// page walk cache, and writes the link to every node it has to create. Such
+// walks also map untouched regions with huge pages, and set `*huge_fault` if
+// they did.
+static page_table_header_t* page_table_walk(asid_t asid,
+                                            va_t virtual_page_number,
+                                            bool charge, int* level,
+                                            bool* huge_fault) {
+  bool radix = charge && sim->config.page_walk == PAGE_WALK_RADIX;
+  bool huge = charge && sim->config.huge_page_sizes;
+
+  *level = 0;
+  page_table_header_t* node = &page_table_root(asid)->header;
+
+  if (radix && sim->config.page_walk_cache_entries) {
+    increment_time(PAGE_WALK_CACHE_LATENCY_NS);
+    for (int cached = PAGE_TABLE_LEVELS - 2; cached >= 0; cached--) {
+      void* child = page_walk_cache_lookup(cached, asid, virtual_page_number);
+      if (child) {
+        *level = cached + 1;
+        node = child;
+        break;
+      }
+    }
+  }
+
+  for (; *level < PAGE_TABLE_LEVELS - 1 && !node->huge.valid; (*level)++) {
+    void** slot =
+        &((page_table_node_t*)node)
+             ->children[page_table_index(virtual_page_number, *level)];
+    pa_dram_t entry_address =
+        radix ? page_table_word_address(node, virtual_page_number, *level)
+              : PAGE_TABLE_DRAM_ADDRESS;
+    bool fresh = !*slot;
+    if (!fresh) {
+      if (radix) {
+        dram_access(entry_address, OP_READ);
+      }
+    } else {
+      *slot = allocate_page_table_node(*level + 1);
+      if (radix) {
+        dram_access(entry_address, OP_WRITE);
+      }
+    }
+    if (radix) {
+      page_walk_cache_insert(*level, asid, virtual_page_number, *slot);
+    }
+    node = *slot;
+
+    if (huge && *level + 1 >= PAGE_TABLE_LEVELS - (PAGE_SIZES - 1)) {
+      if (*level + 1 == PAGE_TABLE_LEVELS - 1) {
+        // Leaves whose pages have all been evicted clean are as good as
+        // untouched.
+        const page_table_leaf_t* leaf = (const page_table_leaf_t*)node;
+        fresh |= !leaf->header.huge.valid && !leaf->resident &&
+                 !leaf->swapped && !leaf->reserved;
+      }
+      if (huge_page_fault(node, *level + 1, fresh, asid, virtual_page_number,
+                          entry_address)) {
+        *huge_fault = true;
+      }
+    }
+  }
+
+  return node;
+}
+
+// Address of the page table entry of the page, as seen by the DRAM model.
+static inline pa_dram_t page_table_entry_address(
+    const page_table_leaf_t* leaf, va_t virtual_page_number) {
+  if (sim->config.page_walk != PAGE_WALK_RADIX) {
+    return PAGE_TABLE_DRAM_ADDRESS;
+  }
+  return page_table_word_address(leaf, virtual_page_number,
+                                 PAGE_TABLE_LEVELS - 1);
+}
+
 pa_disk_t allocate_disk_page() {
   // Let's assume there is always a free disk page available, and ignore all the
   // complexity behind the actual process of finding an available disk page (for
@@ -78,30 +416,154 @@ pa_disk_t allocate_disk_page() {
   // address.
   pa_disk_t disk_page_address = RANDOM_PAGE_ADDRESS_BASE;
   disk_page_address <<= 32;
-  disk_page_address |= RANDOM_PAGE_ADDRESS_IT;
+  disk_page_address |= sim->page_table->random_page_address_it;
   disk_page_address &= DISK_ADDRESS_MASK;
 
-  RANDOM_PAGE_ADDRESS_IT += PAGE_SIZE_BYTES;
+  sim->page_table->random_page_address_it += PAGE_SIZE_BYTES;
 
   return disk_page_address;
 }
 
-pa_dram_t randomly_evict_page_from_dram() {
-  page_evictions++;
+// Splits a 2 MiB page back into the pages of its leaf, which keep its frames.
+static void split_huge_page(page_table_leaf_t* leaf, asid_t asid,
+                            va_t virtual_page_number) {
+  log_dbg("***** Splitting huge page %" PRIx64 " *****",
+          virtual_page_number >> PAGE_TABLE_INDEX_BITS);
+  sim->page_table->huge_page_splits++;
+
+  for (uint64_t i = 0; i < PAGE_TABLE_FANOUT; i++) {
+    leaf->entries[i].dram_page_number = leaf->header.huge.dram_page_number + i;
+    leaf->entries[i].valid = true;
+    leaf->entries[i].dirty = leaf->header.huge.dirty;
+  }
+  leaf->resident = PAGE_TABLE_FANOUT;
+  leaf->header.huge.valid = false;
+
+  tlb_invalidate_huge_page(asid, virtual_page_number >> PAGE_TABLE_INDEX_BITS,
+                           PAGE_SIZE_2M);
+  dram_access(page_table_entry_address(leaf, virtual_page_number), OP_WRITE);
+}
+
+// Reserves an aligned run of frames for the pages of the leaf, if one is free.
+static void reserve_huge_page(page_table_leaf_t* leaf) {
+  struct page_table_state* state = sim->page_table;
+  pa_dram_t reservation;
+  if (!frame_allocator_alloc_aligned(&state->dram_frames, PAGE_TABLE_FANOUT,
+                                     &reservation)) {
+    return;
+  }
+  leaf->reserved = true;
+  leaf->reservation = reservation;
+
+  if (state->reservations_tail == state->reservations_capacity) {
+    // Drop the consumed head of the queue before growing it.
+    uint64_t queued = state->reservations_tail - state->reservations_head;
+    if (queued) {
+      memmove(state->reservations,
+              state->reservations + state->reservations_head,
+              queued * sizeof(page_table_reservation_t));
+    }
+    state->reservations_head = 0;
+    state->reservations_tail = queued;
+    if (2 * queued >= state->reservations_capacity) {
+      state->reservations_capacity =
+          state->reservations_capacity ? 2 * state->reservations_capacity : 64;
+      state->reservations =
+          realloc(state->reservations, state->reservations_capacity *
+                                           sizeof(page_table_reservation_t));
+      if (!state->reservations) {
+        panic("Failed to allocate the huge page reservations");
+      }
+    }
+  }
+  state->reservations[state->reservations_tail++] =
+      (page_table_reservation_t){leaf, reservation};
+}
+
+// Gives the frames of a reservation that no page uses back to the allocator.
+static void break_reservation(page_table_leaf_t* leaf) {
+  log_dbg("***** Breaking huge page reservation %" PRIx64 " *****",
+          leaf->reservation);
+  for (uint64_t i = 0; i < PAGE_TABLE_FANOUT; i++) {
+    if (!leaf->entries[i].valid) {
+      frame_allocator_free(&sim->page_table->dram_frames,
+                           leaf->reservation + i);
+    }
+  }
+  leaf->reserved = false;
+}
+
+static bool break_oldest_reservation() {
+  struct page_table_state* state = sim->page_table;
+  while (state->reservations_head < state->reservations_tail) {
+    page_table_reservation_t* oldest =
+        &state->reservations[state->reservations_head++];
+    if (oldest->leaf->reserved &&
+        oldest->leaf->reservation == oldest->reservation) {
+      break_reservation(oldest->leaf);
+      return true;
+    }
+  }
+  return false;
+}
+
+// Maps the leaf with a 2 MiB page over its reservation, now that all of its
+// pages are resident at their place in it.
+static void promote_huge_page(page_table_leaf_t* leaf,
+                              va_t virtual_page_number) {
+  log_dbg("***** Promoting huge page %" PRIx64 " *****",
+          virtual_page_number >> PAGE_TABLE_INDEX_BITS);
+  sim->page_table->huge_page_promotions++;
+  sim->page_table->huge_pages[PAGE_SIZE_2M]++;
 
-  va_t evicted_virtual_page_number = PAGE_TABLE_DRAM_ADDRESS;
-  while (!page_table[evicted_virtual_page_number].valid) {
-    evicted_virtual_page_number++;
+  leaf->header.huge.dram_page_number = leaf->reservation;
+  leaf->header.huge.valid = true;
+  leaf->header.huge.dirty = false;
+  for (uint64_t i = 0; i < PAGE_TABLE_FANOUT; i++) {
+    leaf->header.huge.dirty |= leaf->entries[i].dirty;
   }
+  leaf->reserved = false;
 
-  if (page_table[evicted_virtual_page_number].dirty) {
+  dram_access(page_table_entry_address(leaf, virtual_page_number), OP_WRITE);
+}
+
+pa_dram_t evict_page_from_dram() {
+  // Page table nodes of the radix walk model are never evicted, so they can
+  // take every frame.
+  if (!page_replacement_resident(&sim->page_table->replacement)) {
+    panic("DRAM is full of page table nodes, with no page left to evict; "
+          "use a larger --dram-bits than %u",
+          sim->config.dram_address_bits);
+  }
+  sim->page_table->page_evictions++;
+
+  va_t evicted_key = page_replacement_victim(&sim->page_table->replacement);
+  asid_t asid = page_key_asid(evicted_key);
+  va_t evicted_virtual_page_number = evicted_key & PAGE_INDEX_MASK;
+  int level;
+  page_table_leaf_t* leaf = (page_table_leaf_t*)page_table_walk(
+      asid, evicted_virtual_page_number, false, &level, NULL);
+  assert(level == PAGE_TABLE_LEVELS - 1 && "1 GiB pages are never evicted");
+  if (leaf->header.huge.valid) {
+    split_huge_page(leaf, asid, evicted_virtual_page_number);
+  } else if (leaf->reserved) {
+    break_reservation(leaf);
+  }
+
+  uint64_t index = evicted_virtual_page_number & (PAGE_TABLE_FANOUT - 1);
+  page_table_entry_t* entry = &leaf->entries[index];
+  pte_metadata_t* metadata = &leaf->metadata[index];
+  pa_dram_t dram_page_number = entry->dram_page_number;
+
+  if (entry->dirty) {
     log_dbg("***** Evicting dirty page %" PRIx64 " to disk *****",
             evicted_virtual_page_number);
 
-    pa_disk_t disk_page_address = allocate_disk_page();
-    pte_metadata[evicted_virtual_page_number].is_swapped = true;
-    pte_metadata[evicted_virtual_page_number].disk_page_number =
-        disk_page_address >> PAGE_SIZE_BITS;
+    pa_disk_t disk_page_address =
+        sim->swap ? swap_allocate() : allocate_disk_page();
+    metadata->is_swapped = true;
+    metadata->disk_page_number = disk_page_address >> PAGE_SIZE_BITS;
+    leaf->swapped++;
 
     disk_access(disk_page_address, OP_WRITE);
   } else {
@@ -109,52 +571,350 @@ pa_dram_t randomly_evict_page_from_dram() {
             evicted_virtual_page_number);
   }
 
-  page_table[evicted_virtual_page_number].valid = false;
-  page_table[evicted_virtual_page_number].dirty = false;
+  entry->valid = false;
+  entry->dirty = false;
+  leaf->resident--;
 
-  allocated_dram_pages[evicted_virtual_page_number] = false;
+  if (sim->config.page_policy == PAGE_POLICY_REFERENCE && !asid &&
+      sim->config.page_walk == PAGE_WALK_FLAT) {
+    // The reference model releases the frame numbered like the evicted page,
+    // and hands that same number out as the new frame. Kept so the expected
+    // outputs stay reproducible; every other policy, the pages of other
+    // address spaces, and the radix walk, whose nodes hold frames that must
+    // not be handed out, reuse the victim's frame.
+    frame_allocator_free(&sim->page_table->dram_frames, evicted_virtual_page_number);
+    dram_page_number = evicted_virtual_page_number;
+  }
 
-  tlb_invalidate(evicted_virtual_page_number);
-  dram_access(PAGE_TABLE_DRAM_ADDRESS, OP_READ);
+  tlb_invalidate(asid, evicted_virtual_page_number);
+  if (sim->caches) {
+    cache_invalidate_page(dram_page_number << PAGE_SIZE_BITS);
+  }
+  dram_access(page_table_entry_address(leaf, evicted_virtual_page_number),
+              OP_READ);
 
-  return evicted_virtual_page_number << PAGE_SIZE_BITS;
+  return dram_page_number << PAGE_SIZE_BITS;
 }
 
-void page_fault_handler(va_t virtual_page_number) {
+void page_fault_handler(page_table_leaf_t* leaf, asid_t asid,
+                        va_t virtual_page_number) {
   log_dbg("***** Page fault! *****");
-  page_faults++;
+  sim->page_table->page_faults++;
+
+  uint64_t index = virtual_page_number & (PAGE_TABLE_FANOUT - 1);
+  if (sim->config.huge_page_policy == HUGE_PAGE_POLICY_PROMOTE &&
+      huge_pages_enabled(PAGE_SIZE_2M) && !leaf->reserved &&
+      !leaf->resident && !leaf->swapped) {
+    reserve_huge_page(leaf);
+  }
 
   pa_dram_t page_dram_address;
-  if (!allocate_dram_page(&page_dram_address)) {
-    page_dram_address = randomly_evict_page_from_dram();
+  if (leaf->reserved) {
+    page_dram_address = (leaf->reservation + index) << PAGE_SIZE_BITS;
+  } else if (!allocate_dram_page(&page_dram_address)) {
+    page_dram_address = evict_page_from_dram();
   }
 
-  page_table_entry_t* entry = &page_table[virtual_page_number];
+  page_table_entry_t* entry = &leaf->entries[index];
+  pte_metadata_t* metadata = &leaf->metadata[index];
   entry->dram_page_number = page_dram_address >> PAGE_SIZE_BITS;
   entry->valid = true;
   entry->dirty = false;
-  dram_access(PAGE_TABLE_DRAM_ADDRESS, OP_WRITE);
+  leaf->resident++;
+  page_replacement_loaded(&sim->page_table->replacement,
+                          page_key(asid, virtual_page_number),
+                          entry->dram_page_number);
+  dram_access(page_table_entry_address(leaf, virtual_page_number), OP_WRITE);
 
-  if (pte_metadata[virtual_page_number].is_swapped) {
+  if (metadata->is_swapped) {
     log_dbg("***** Page %" PRIx64 " is swapped, loading from disk *****",
             virtual_page_number);
-    pa_disk_t disk_address = pte_metadata[virtual_page_number].disk_page_number
-                             << PAGE_SIZE_BITS;
-    disk_access(disk_address, OP_READ);
+    pa_disk_t disk_address = metadata->disk_page_number << PAGE_SIZE_BITS;
+    if (sim->swap) {
+      swap_in(disk_address);
+    } else {
+      disk_access(disk_address, OP_READ);
+    }
     dram_access(page_dram_address, OP_WRITE);
-    pte_metadata[virtual_page_number].is_swapped = false;
+    metadata->is_swapped = false;
+    leaf->swapped--;
+  }
+
+  if (leaf->reserved && leaf->resident == PAGE_TABLE_FANOUT) {
+    promote_huge_page(leaf, virtual_page_number);
   }
 }
 
 void page_table_init() {
-  memset(page_table, 0, sizeof(page_table));
-  memset(pte_metadata, 0, sizeof(pte_metadata));
-  memset(allocated_dram_pages, 0, sizeof(allocated_dram_pages));
-  page_faults = 0;
-  page_evictions = 0;
+  if (!sim->page_table) {
+    sim->page_table = calloc(1, sizeof(struct page_table_state));
+    if (!sim->page_table) {
+      panic("Failed to allocate the page table");
+    }
+  }
+  struct page_table_state* state = sim->page_table;
+
+  // The frame holding the page table (or its root, in the radix walk model)
+  // is never handed out.
+  uint64_t dram_page_capacity = config_dram_page_capacity(&sim->config);
+  frame_allocator_init(&state->dram_frames, dram_page_capacity,
+                       PAGE_TABLE_DRAM_ADDRESS + 1);
+  page_replacement_init(&state->replacement, sim->config.page_policy,
+                        dram_page_capacity, sim->config.wsclock_tau_ns);
+
+  for (asid_t asid = 0; asid < MAX_ADDRESS_SPACES; asid++) {
+    free_page_table_node(state->roots[asid], 0);
+    state->roots[asid] = NULL;
+  }
+  // The page table of ASID 0 takes the reserved frame.
+  state->roots[0] = calloc(1, sizeof(page_table_node_t));
+  if (!state->roots[0]) {
+    panic("Failed to allocate the page table");
+  }
+  state->roots[0]->header.dram_page_number = PAGE_TABLE_DRAM_ADDRESS;
+  page_walk_cache_init(sim->config.page_walk_cache_entries);
+
+  state->random_page_address_it = 0;
+  state->reservations_head = 0;
+  state->reservations_tail = 0;
+  state->page_faults = 0;
+  state->page_evictions = 0;
+  memset(state->huge_pages, 0, sizeof(state->huge_pages));
+  state->huge_page_promotions = 0;
+  state->huge_page_splits = 0;
+}
+
+void page_table_free() {
+  struct page_table_state* state = sim->page_table;
+  if (!state) {
+    return;
+  }
+
+  frame_allocator_free_all(&state->dram_frames);
+  page_replacement_free(&state->replacement);
+  for (asid_t asid = 0; asid < MAX_ADDRESS_SPACES; asid++) {
+    free_page_table_node(state->roots[asid], 0);
+  }
+  page_walk_cache_init(0);
+  free(state->reservations);
+  free(state);
+  sim->page_table = NULL;
+}
+
+// Page table nodes in the order a checkpoint walks them, so the page walk
+// cache and the reservations can refer to them by index.
+typedef struct {
+  void** nodes;
+  uint64_t total;
+  uint64_t capacity;
+
+  // When saving, the nodes sorted by address along with their index.
+  struct page_table_node_ref {
+    uintptr_t node;
+    uint64_t index;
+  }* sorted;
+} page_table_node_list_t;
+
+static void node_list_add(page_table_node_list_t* list, void* node) {
+  if (list->total == list->capacity) {
+    list->capacity = list->capacity ? 2 * list->capacity : 1024;
+    list->nodes = realloc(list->nodes, list->capacity * sizeof(void*));
+    if (!list->nodes) {
+      panic("Failed to allocate the page table checkpoint");
+    }
+  }
+  list->nodes[list->total++] = node;
+}
+
+static int compare_node_refs(const void* a, const void* b) {
+  uintptr_t x = ((const struct page_table_node_ref*)a)->node;
+  uintptr_t y = ((const struct page_table_node_ref*)b)->node;
+  return (x > y) - (x < y);
+}
+
+static void node_list_sort(page_table_node_list_t* list) {
+  list->sorted = malloc(list->total * sizeof(*list->sorted));
+  if (!list->sorted) {
+    panic("Failed to allocate the page table checkpoint");
+  }
+  for (uint64_t i = 0; i < list->total; i++) {
+    list->sorted[i].node = (uintptr_t)list->nodes[i];
+    list->sorted[i].index = i;
+  }
+  qsort(list->sorted, list->total, sizeof(*list->sorted), compare_node_refs);
+}
+
+// Saves the index of a node, or restores the node from its index. NULL nodes
+// are saved as UINT64_MAX.
+static void checkpoint_node_ref(checkpoint_t* checkpoint,
+                                const page_table_node_list_t* list,
+                                void** node) {
+  uint64_t index = UINT64_MAX;
+  if (!checkpoint->restoring && *node) {
+    struct page_table_node_ref key = {(uintptr_t)*node, 0};
+    const struct page_table_node_ref* ref = bsearch(
+        &key, list->sorted, list->total, sizeof(key), compare_node_refs);
+    assert(ref && "Reference to a node outside of the page table");
+    index = ref->index;
+  }
+  checkpoint_value(checkpoint, index);
+
+  if (checkpoint->restoring) {
+    if (index != UINT64_MAX && index >= list->total) {
+      panic("Corrupted checkpoint %s: no page table node %" PRIu64,
+            checkpoint->path, index);
+    }
+    *node = index == UINT64_MAX ? NULL : list->nodes[index];
+  }
+}
+
+// Leaves are stored with a bitmap of the entries that were ever used, followed
+// by those entries only.
+static void checkpoint_page_table_leaf(checkpoint_t* checkpoint,
+                                       page_table_leaf_t* leaf) {
+  checkpoint_value(checkpoint, leaf->header);
+  checkpoint_value(checkpoint, leaf->resident);
+  checkpoint_value(checkpoint, leaf->swapped);
+  checkpoint_value(checkpoint, leaf->reserved);
+  checkpoint_value(checkpoint, leaf->reservation);
+
+  static const page_table_entry_t unused_entry;
+  static const pte_metadata_t unused_metadata;
+  uint64_t used[(PAGE_TABLE_FANOUT + 63) / 64] = {0};
+  for (int i = 0; i < PAGE_TABLE_FANOUT; i++) {
+    if (memcmp(&leaf->entries[i], &unused_entry, sizeof(unused_entry)) ||
+        memcmp(&leaf->metadata[i], &unused_metadata,
+               sizeof(unused_metadata))) {
+      used[i / 64] |= 1llu << (i % 64);
+    }
+  }
+  checkpoint_value(checkpoint, used);
+
+  for (int i = 0; i < PAGE_TABLE_FANOUT; i++) {
+    if ((used[i / 64] >> (i % 64)) & 1) {
+      checkpoint_value(checkpoint, leaf->entries[i]);
+      checkpoint_value(checkpoint, leaf->metadata[i]);
+    }
+  }
+}
+
+// Saves or restores the subtree at `slot`, depth first. Interior nodes are
+// followed by a bitmap of the children they have, so only the populated part
+// of the radix tree is stored. Nodes keep the frames they were given, which
+// are restored along with the frame allocator.
+static void checkpoint_page_table_node(checkpoint_t* checkpoint, void** slot,
+                                       int level,
+                                       page_table_node_list_t* list) {
+  bool is_leaf = level == PAGE_TABLE_LEVELS - 1;
+  if (checkpoint->restoring) {
+    *slot = calloc(1, is_leaf ? sizeof(page_table_leaf_t)
+                              : sizeof(page_table_node_t));
+    if (!*slot) {
+      panic("Failed to allocate a page table node");
+    }
+  }
+  node_list_add(list, *slot);
+
+  if (is_leaf) {
+    checkpoint_page_table_leaf(checkpoint, *slot);
+    return;
+  }
+
+  page_table_node_t* node = *slot;
+  checkpoint_value(checkpoint, node->header);
+
+  uint64_t children[(PAGE_TABLE_FANOUT + 63) / 64] = {0};
+  for (int i = 0; i < PAGE_TABLE_FANOUT; i++) {
+    if (node->children[i]) {
+      children[i / 64] |= 1llu << (i % 64);
+    }
+  }
+  checkpoint_value(checkpoint, children);
+
+  for (int i = 0; i < PAGE_TABLE_FANOUT; i++) {
+    if ((children[i / 64] >> (i % 64)) & 1) {
+      checkpoint_page_table_node(checkpoint, &node->children[i], level + 1,
+                                 list);
+    }
+  }
+}
+
+void page_table_checkpoint(checkpoint_t* checkpoint) {
+  struct page_table_state* state = sim->page_table;
+
+  // The page tables of every address space are stored one after the other,
+  // following a bitmap of the address spaces that have one.
+  uint64_t roots[MAX_ADDRESS_SPACES / 64] = {0};
+  for (asid_t asid = 0; asid < MAX_ADDRESS_SPACES; asid++) {
+    if (checkpoint->restoring) {
+      free_page_table_node(state->roots[asid], 0);
+      state->roots[asid] = NULL;
+    } else if (state->roots[asid]) {
+      roots[asid / 64] |= 1llu << (asid % 64);
+    }
+  }
+  checkpoint_value(checkpoint, roots);
+
+  page_table_node_list_t list = {0};
+  for (asid_t asid = 0; asid < MAX_ADDRESS_SPACES; asid++) {
+    if ((roots[asid / 64] >> (asid % 64)) & 1) {
+      checkpoint_page_table_node(checkpoint, (void**)&state->roots[asid], 0,
+                                 &list);
+    }
+  }
+  if (!checkpoint->restoring) {
+    node_list_sort(&list);
+  }
+
+  for (int level = 0; level < PAGE_TABLE_LEVELS - 1; level++) {
+    page_walk_cache_t* cache = &state->walk_cache[level];
+    checkpoint_value(checkpoint, cache->used);
+    checkpoint_value(checkpoint, cache->next);
+    checkpoint_array(checkpoint, cache->tags, cache->size, sizeof(va_t));
+    for (uint32_t i = 0; i < cache->size; i++) {
+      checkpoint_node_ref(checkpoint, &list, &cache->nodes[i]);
+    }
+  }
+
+  // The queue is restored without the reservations already consumed.
+  uint64_t queued = state->reservations_tail - state->reservations_head;
+  checkpoint_value(checkpoint, queued);
+  if (checkpoint->restoring) {
+    free(state->reservations);
+    state->reservations = NULL;
+    if (queued) {
+      state->reservations = malloc(queued * sizeof(page_table_reservation_t));
+      if (!state->reservations) {
+        panic("Failed to allocate the huge page reservations");
+      }
+    }
+    state->reservations_head = 0;
+    state->reservations_tail = queued;
+    state->reservations_capacity = queued;
+  }
+  for (uint64_t i = 0; i < queued; i++) {
+    page_table_reservation_t* reservation =
+        &state->reservations[state->reservations_head + i];
+    checkpoint_node_ref(checkpoint, &list, (void**)&reservation->leaf);
+    checkpoint_value(checkpoint, reservation->reservation);
+  }
+
+  frame_allocator_checkpoint(checkpoint, &state->dram_frames);
+  page_replacement_checkpoint(checkpoint, &state->replacement);
+
+  checkpoint_value(checkpoint, state->random_page_address_it);
+  checkpoint_value(checkpoint, state->page_faults);
+  checkpoint_value(checkpoint, state->page_evictions);
+  checkpoint_value(checkpoint, state->huge_pages);
+  checkpoint_value(checkpoint, state->huge_page_promotions);
+  checkpoint_value(checkpoint, state->huge_page_splits);
+
+  free(list.nodes);
+  free(list.sorted);
 }
 
-pa_dram_t page_table_translate(va_t virtual_address, op_t op) {
+pa_dram_t page_table_translate(asid_t asid, va_t virtual_address, op_t op,
+                               page_size_t* page_size) {
   virtual_address &= VIRTUAL_ADDRESS_MASK;
 
   va_t virtual_page_number =
@@ -163,28 +923,115 @@ pa_dram_t page_table_translate(va_t virtual_address, op_t op) {
   assert(virtual_page_number < TOTAL_PAGES && "Page index out of bounds");
   assert(virtual_page_offset < PAGE_SIZE_BYTES && "Page offset out of bounds");
 
-  page_table_entry_t* entry = &page_table[virtual_page_number];
-  if (!entry->valid) {
-    page_fault_handler(virtual_page_number);
+  int level;
+  bool huge_fault = false;
+  page_table_header_t* node =
+      page_table_walk(asid, virtual_page_number, true, &level, &huge_fault);
+
+  pa_dram_t dram_page_number;
+  if (node->huge.valid) {
+    // The walk stopped at the huge page entry, in place of the next level.
+    *page_size = (page_size_t)(PAGE_TABLE_LEVELS - level);
+    if (!huge_fault && sim->config.page_walk == PAGE_WALK_FLAT) {
+      dram_access(PAGE_TABLE_DRAM_ADDRESS, OP_READ);
+    }
+    if (op == OP_WRITE) {
+      node->huge.dirty = true;
+    }
+    dram_page_number =
+        node->huge.dram_page_number +
+        (virtual_page_number & (pages_per_page_of(*page_size) - 1));
+    if (*page_size == PAGE_SIZE_2M) {
+      page_replacement_referenced(&sim->page_table->replacement,
+                                  dram_page_number, op);
+    }
   } else {
-    dram_access(PAGE_TABLE_DRAM_ADDRESS, OP_READ);
-  }
+    page_table_leaf_t* leaf = (page_table_leaf_t*)node;
+    page_table_entry_t* entry =
+        &leaf->entries[virtual_page_number & (PAGE_TABLE_FANOUT - 1)];
+    *page_size = PAGE_SIZE_4K;
+    if (sim->config.page_walk == PAGE_WALK_RADIX) {
+      // Even an invalid entry has to be read to find out it is invalid.
+      dram_access(page_table_entry_address(leaf, virtual_page_number),
+                  OP_READ);
+    }
+
+    if (!entry->valid) {
+      page_fault_handler(leaf, asid, virtual_page_number);
+    } else if (sim->config.page_walk == PAGE_WALK_FLAT) {
+      dram_access(PAGE_TABLE_DRAM_ADDRESS, OP_READ);
+    }
 
-  if (op == OP_WRITE) {
-    entry->dirty = true;
+    if (op == OP_WRITE) {
+      entry->dirty = true;
+    }
+    dram_page_number = entry->dram_page_number;
+    page_replacement_referenced(&sim->page_table->replacement,
+                                dram_page_number, op);
   }
 
   pa_dram_t translated_address =
-      (entry->dram_page_number << PAGE_SIZE_BITS) | virtual_page_offset;
+      (dram_page_number << PAGE_SIZE_BITS) | virtual_page_offset;
   log_dbg("PTE found (VA=%" PRIx64 " VPN=%" PRIx64 " PA=%" PRIx64 ")",
           virtual_address, virtual_page_number, translated_address);
 
   return translated_address;
 }
 
+bool page_table_probe(asid_t asid, va_t virtual_page_number,
+                      pa_dram_t* dram_page_number, page_size_t* page_size) {
+  if (!sim->page_table->roots[asid]) {
+    return false;
+  }
+  const page_table_header_t* node = &sim->page_table->roots[asid]->header;
+  int level = 0;
+  for (; level < PAGE_TABLE_LEVELS - 1 && !node->huge.valid; level++) {
+    node = ((const page_table_node_t*)node)
+               ->children[page_table_index(virtual_page_number, level)];
+    if (!node) {
+      return false;
+    }
+  }
+
+  if (node->huge.valid) {
+    *page_size = (page_size_t)(PAGE_TABLE_LEVELS - level);
+    *dram_page_number =
+        node->huge.dram_page_number +
+        (virtual_page_number & (pages_per_page_of(*page_size) - 1));
+    return true;
+  }
+
+  const page_table_entry_t* entry =
+      &((const page_table_leaf_t*)node)
+           ->entries[virtual_page_number & (PAGE_TABLE_FANOUT - 1)];
+  *page_size = PAGE_SIZE_4K;
+  *dram_page_number = entry->dram_page_number;
+  return entry->valid;
+}
+
 void write_back_tlb_entry(pa_dram_t physical_address) {
   dram_access(physical_address, OP_WRITE);
 }
 
-uint64_t get_total_page_faults() { return page_faults; }
-uint64_t get_total_page_evictions() { return page_evictions; }
\ No newline at end of file
+uint64_t get_total_page_faults() { return sim->page_table->page_faults; }
+uint64_t get_total_page_evictions() {
+  return sim->page_table->page_evictions;
+}
+
+uint64_t get_total_address_spaces() {
+  uint64_t total = 0;
+  for (asid_t asid = 0; asid < MAX_ADDRESS_SPACES; asid++) {
+    total += sim->page_table->roots[asid] != NULL;
+  }
+  return total;
+}
+
+uint64_t get_total_huge_pages(page_size_t size) {
+  return sim->page_table->huge_pages[size];
+}
+uint64_t get_total_huge_page_promotions() {
+  return sim->page_table->huge_page_promotions;
+}
+uint64_t get_total_huge_page_splits() {
+  return sim->page_table->huge_page_splits;
+}
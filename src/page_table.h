@@ -1,10 +1,57 @@
 #pragma once
 
+#include <stdbool.h>
+
+#include "constants.h"
 #include "memory.h"
 
+// Pages of every address space are handed to the replacement policy, looked
+// up in the page walk cache and profiled with their ASID above their virtual
+// page number, so pages of ASID 0 keep their number.
+static inline va_t page_key(asid_t asid, va_t virtual_page_number) {
+  return (va_t)asid << (VIRTUAL_ADDRESS_BITS - PAGE_SIZE_BITS) |
+         virtual_page_number;
+}
+
+static inline asid_t page_key_asid(va_t key) {
+  return (asid_t)(key >> (VIRTUAL_ADDRESS_BITS - PAGE_SIZE_BITS));
+}
+
+// Sets up the page table of the current simulation, or resets it.
 void page_table_init();
-pa_dram_t page_table_translate(va_t virtual_address, op_t op);
+void page_table_free();
+
+struct checkpoint;
+// Saves or restores the page table of the current simulation, along with the
+// DRAM frames and the page replacement state.
+void page_table_checkpoint(struct checkpoint* checkpoint);
+// Translates the address in the page table of an address space, setting
+// `page_size` to the size of the page mapping it.
+pa_dram_t page_table_translate(asid_t asid, va_t virtual_address, op_t op,
+                               page_size_t* page_size);
 void write_back_tlb_entry(pa_dram_t physical_address);
 
+// Looks the page up without faulting it in nor timing the walk, for the TLB
+// prefetcher. Returns false unless the page is resident in DRAM, and sets
+// `dram_page_number` to its frame and `page_size` to the size of the page
+// mapping it otherwise.
+bool page_table_probe(asid_t asid, va_t virtual_page_number,
+                      pa_dram_t* dram_page_number, page_size_t* page_size);
+
+// Empties the page walk cache, on context switches without ASIDs.
+void page_table_flush_walk_cache();
+
+// Takes a free DRAM frame. Returns false if DRAM is full.
+bool allocate_dram_page(pa_dram_t* dram_page_address);
+// Evicts the page picked by the replacement policy and returns its frame.
+pa_dram_t evict_page_from_dram();
+
 uint64_t get_total_page_faults();
 uint64_t get_total_page_evictions();
+// Address spaces that have a page table.
+uint64_t get_total_address_spaces();
+
+// Huge pages mapped, on a page fault or by promotion.
+uint64_t get_total_huge_pages(page_size_t size);
+uint64_t get_total_huge_page_promotions();
+uint64_t get_total_huge_page_splits();
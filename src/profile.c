@@ -0,0 +1,587 @@
+#include "profile.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "page_table.h"
+#include "simulator.h"
+#include "stack_distance.h"
+#include "tlb.h"
+
+// How an access was translated, from the cheapest to the most expensive.
+typedef enum {
+  ACCESS_L1_HIT,
+  ACCESS_L2_HIT,
+  ACCESS_WALK,
+  ACCESS_FAULT,
+  ACCESS_DISK,
+  ACCESS_KINDS,
+} access_kind_t;
+
+static const char* access_kind_names[] = {
+    [ACCESS_L1_HIT] = "l1_hit", [ACCESS_L2_HIT] = "l2_hit",
+    [ACCESS_WALK] = "walk",     [ACCESS_FAULT] = "fault",
+    [ACCESS_DISK] = "disk",
+};
+
+// Latencies are bucketed by powers of two: bucket 0 holds the accesses that
+// took no time, and bucket `b` those that took [2^(b-1), 2^b) ns.
+#define LATENCY_BUCKETS 65
+
+#define MIN_PAGE_CAPACITY (1llu << 12)
+
+typedef struct {
+  uint64_t accesses;
+  uint64_t total_ns;
+  uint64_t min_ns;
+  uint64_t max_ns;
+  uint64_t histogram[LATENCY_BUCKETS];
+} latency_t;
+
+// Accesses to a virtual page, and where their time went. Pages are keyed by
+// page_key(), so the pages of different processes stay apart. Entries of the
+// table that were never accessed are free.
+typedef struct {
+  va_t page;
+  uint64_t accesses;
+  uint64_t writes;
+  uint64_t walks;
+  uint64_t faults;
+  uint64_t total_ns;
+} page_heat_t;
+
+// Counters at the end of an interval.
+typedef struct {
+  uint64_t instructions;
+  uint64_t elapsed_ns;
+  uint64_t page_faults;
+  uint64_t page_evictions;
+  uint64_t tlb_l1_hits;
+  uint64_t tlb_l1_misses;
+  uint64_t tlb_l2_hits;
+  uint64_t tlb_l2_misses;
+  uint64_t tlb_shootdowns;
+  uint64_t disk_reads;
+  uint64_t disk_writes;
+} snapshot_t;
+
+struct profile_state {
+  uint64_t interval;
+  uint32_t top_pages;
+  uint64_t instructions;
+
+  // Counters when the access being profiled started.
+  time_ns_t start_time;
+  uint64_t start_l1_hits;
+  uint64_t start_page_walks;
+  uint64_t start_page_faults;
+  uint64_t start_disk_accesses;
+
+  latency_t latency[ACCESS_KINDS];
+
+  // Open addressing hash table of the accessed pages.
+  page_heat_t* pages;
+  uint64_t page_capacity;
+  uint64_t total_pages;
+
+  stack_distance_t reuse;
+
+  // The counters when profiling started, and at the end of every interval.
+  snapshot_t* snapshots;
+  uint64_t total_snapshots;
+  uint64_t snapshot_capacity;
+};
+
+static void take_snapshot(struct profile_state* profile) {
+  if (profile->total_snapshots == profile->snapshot_capacity) {
+    profile->snapshot_capacity =
+        profile->snapshot_capacity ? 2 * profile->snapshot_capacity : 64;
+    profile->snapshots =
+        realloc(profile->snapshots,
+                profile->snapshot_capacity * sizeof(snapshot_t));
+    if (!profile->snapshots) {
+      panic("Failed to allocate the profile snapshots");
+    }
+  }
+
+  sim_stats_t stats;
+  simulator_get_stats(&stats);
+  profile->snapshots[profile->total_snapshots++] = (snapshot_t){
+      .instructions = stats.instructions,
+      .elapsed_ns = stats.elapsed_ns,
+      .page_faults = stats.page_faults,
+      .page_evictions = stats.page_evictions,
+      .tlb_l1_hits = stats.tlb_l1_hits,
+      .tlb_l1_misses = stats.tlb_l1_misses,
+      .tlb_l2_hits = stats.tlb_l2_hits,
+      .tlb_l2_misses = stats.tlb_l2_misses,
+      .tlb_shootdowns = stats.tlb_shootdowns,
+      .disk_reads = stats.disk_reads,
+      .disk_writes = stats.disk_writes,
+  };
+}
+
+// ========================================================================
+// Page heat map.
+// ========================================================================
+
+static inline uint64_t page_bucket(const struct profile_state* profile,
+                                   va_t page) {
+  return (page * 0x9e3779b97f4a7c15llu) >>
+         (64 - __builtin_ctzll(profile->page_capacity));
+}
+
+static page_heat_t* find_page(struct profile_state* profile, va_t page) {
+  uint64_t mask = profile->page_capacity - 1;
+  for (uint64_t i = page_bucket(profile, page);; i = (i + 1) & mask) {
+    page_heat_t* heat = &profile->pages[i];
+    if (heat->page == page || !heat->accesses) {
+      heat->page = page;
+      return heat;
+    }
+  }
+}
+
+static void grow_pages(struct profile_state* profile) {
+  page_heat_t* pages = profile->pages;
+  uint64_t capacity = profile->page_capacity;
+
+  profile->page_capacity = capacity ? 2 * capacity : MIN_PAGE_CAPACITY;
+  profile->pages = calloc(profile->page_capacity, sizeof(page_heat_t));
+  if (!profile->pages) {
+    panic("Failed to allocate the profile of %" PRIu64 " pages",
+          profile->total_pages);
+  }
+
+  for (uint64_t i = 0; i < capacity; i++) {
+    if (pages[i].accesses) {
+      *find_page(profile, pages[i].page) = pages[i];
+    }
+  }
+  free(pages);
+}
+
+static page_heat_t* access_page(struct profile_state* profile, va_t page) {
+  page_heat_t* heat = find_page(profile, page);
+  if (!heat->accesses) {
+    if (2 * (profile->total_pages + 1) > profile->page_capacity) {
+      grow_pages(profile);
+      heat = find_page(profile, page);
+    }
+    profile->total_pages++;
+  }
+  return heat;
+}
+
+// Most accessed first, then by page number.
+static int compare_heat(const void* a, const void* b) {
+  const page_heat_t* x = a;
+  const page_heat_t* y = b;
+  if (x->accesses != y->accesses) {
+    return x->accesses < y->accesses ? 1 : -1;
+  }
+  return (x->page > y->page) - (x->page < y->page);
+}
+
+// ========================================================================
+// Collection.
+// ========================================================================
+
+void profile_init(uint64_t interval, uint32_t top_pages) {
+  profile_free();
+  struct profile_state* profile = calloc(1, sizeof(struct profile_state));
+  if (!profile) {
+    panic("Failed to allocate the profile");
+  }
+  sim->profile = profile;
+
+  profile->interval = interval;
+  profile->top_pages = top_pages;
+  for (int kind = 0; kind < ACCESS_KINDS; kind++) {
+    profile->latency[kind].min_ns = UINT64_MAX;
+  }
+  grow_pages(profile);
+  stack_distance_init(&profile->reuse, 0);
+  take_snapshot(profile);
+}
+
+void profile_free() {
+  struct profile_state* profile = sim->profile;
+  if (!profile) {
+    return;
+  }
+  free(profile->pages);
+  free(profile->snapshots);
+  stack_distance_free(&profile->reuse);
+  free(profile);
+  sim->profile = NULL;
+}
+
+void profile_access_begin(unsigned core) {
+  struct profile_state* profile = sim->profile;
+  tlb_stats_t tlb_stats;
+  tlb_get_stats(core, &tlb_stats);
+
+  profile->start_time = get_core_time(core);
+  profile->start_l1_hits = tlb_stats.l1_hits;
+  profile->start_page_walks = tlb_stats.page_walks;
+  profile->start_page_faults = get_total_page_faults();
+  profile->start_disk_accesses =
+      get_total_disk_reads() + get_total_disk_writes();
+}
+
+void profile_access_end(unsigned core, asid_t asid, op_t op, va_t address) {
+  struct profile_state* profile = sim->profile;
+  tlb_stats_t tlb_stats;
+  tlb_get_stats(core, &tlb_stats);
+  uint64_t ns = get_core_time(core) - profile->start_time;
+
+  access_kind_t kind = ACCESS_WALK;
+  if (tlb_stats.l1_hits != profile->start_l1_hits) {
+    kind = ACCESS_L1_HIT;
+  } else if (tlb_stats.page_walks == profile->start_page_walks) {
+    kind = ACCESS_L2_HIT;
+  } else if (get_total_disk_reads() + get_total_disk_writes() !=
+             profile->start_disk_accesses) {
+    kind = ACCESS_DISK;
+  } else if (get_total_page_faults() != profile->start_page_faults) {
+    kind = ACCESS_FAULT;
+  }
+
+  latency_t* latency = &profile->latency[kind];
+  latency->accesses++;
+  latency->total_ns += ns;
+  if (ns < latency->min_ns) {
+    latency->min_ns = ns;
+  }
+  if (ns > latency->max_ns) {
+    latency->max_ns = ns;
+  }
+  latency->histogram[ns ? 64 - __builtin_clzll(ns) : 0]++;
+
+  va_t page = page_key(asid, (address >> PAGE_SIZE_BITS) & PAGE_INDEX_MASK);
+  page_heat_t* heat = access_page(profile, page);
+  heat->accesses++;
+  heat->writes += op == OP_WRITE;
+  heat->walks += kind >= ACCESS_WALK;
+  heat->faults += kind >= ACCESS_FAULT;
+  heat->total_ns += ns;
+
+  stack_distance_access(&profile->reuse, page);
+
+  profile->instructions++;
+  if (profile->interval && profile->instructions % profile->interval == 0) {
+    take_snapshot(profile);
+  }
+}
+
+// ========================================================================
+// Export. Every table is a list of rows of named fields, written either as
+// an array of objects of the JSON document, or as a CSV file of its own.
+// ========================================================================
+
+typedef enum {
+  FIELD_UINT,
+  FIELD_REAL,
+  FIELD_TEXT,
+} field_type_t;
+
+typedef struct {
+  const char* name;
+  field_type_t type;
+  union {
+    uint64_t uint;
+    double real;
+    const char* text;
+  };
+} field_t;
+
+#define UINT_FIELD(name, value) {name, FIELD_UINT, .uint = (value)}
+#define REAL_FIELD(name, value) {name, FIELD_REAL, .real = (value)}
+#define TEXT_FIELD(name, value) {name, FIELD_TEXT, .text = (value)}
+
+#define write_row(writer, ...)                            \
+  write_fields((writer), (const field_t[]){__VA_ARGS__}, \
+               sizeof((const field_t[]){__VA_ARGS__}) / sizeof(field_t))
+
+typedef struct {
+  profile_format_t format;
+  const char* path;
+  FILE* file;
+  const char* table_path;
+  char* csv_path;
+  uint64_t tables;
+  uint64_t rows;
+} writer_t;
+
+static FILE* open_output(const char* path) {
+  FILE* file = fopen(path, "w");
+  if (!file) {
+    panic("Failed to create profile %s", path);
+  }
+  return file;
+}
+
+static void close_output(FILE* file, const char* path) {
+  if (fclose(file) != 0) {
+    panic("Failed to write profile %s", path);
+  }
+}
+
+static void begin_table(writer_t* writer, const char* name) {
+  writer->rows = 0;
+  if (writer->format == PROFILE_FORMAT_JSON) {
+    fprintf(writer->file, "%s\n  \"%s\": [", writer->tables ? "," : "",
+            name);
+    writer->tables++;
+    return;
+  }
+
+  // <path> with the table name before its extension.
+  const char* slash = strrchr(writer->path, '/');
+  const char* dot = strrchr(slash ? slash : writer->path, '.');
+  int stem = dot ? (int)(dot - writer->path) : (int)strlen(writer->path);
+  const char* extension = dot ? dot : ".csv";
+  free(writer->csv_path);
+  writer->csv_path = malloc(strlen(writer->path) + strlen(name) + 6);
+  if (!writer->csv_path) {
+    panic("Failed to allocate the path of profile table %s", name);
+  }
+  sprintf(writer->csv_path, "%.*s.%s%s", stem, writer->path, name, extension);
+  writer->file = open_output(writer->csv_path);
+}
+
+static void end_table(writer_t* writer) {
+  if (writer->format == PROFILE_FORMAT_JSON) {
+    fprintf(writer->file, "%s]", writer->rows ? "\n  " : "");
+  } else {
+    close_output(writer->file, writer->csv_path);
+    writer->file = NULL;
+  }
+}
+
+static void write_fields(writer_t* writer, const field_t* fields, int count) {
+  FILE* file = writer->file;
+  bool json = writer->format == PROFILE_FORMAT_JSON;
+
+  if (json) {
+    fprintf(file, "%s\n    {", writer->rows ? "," : "");
+  } else if (!writer->rows) {
+    for (int i = 0; i < count; i++) {
+      fprintf(file, "%s%s", i ? "," : "", fields[i].name);
+    }
+    fputc('\n', file);
+  }
+
+  for (int i = 0; i < count; i++) {
+    const field_t* field = &fields[i];
+    if (json) {
+      fprintf(file, "%s\"%s\": ", i ? ", " : "", field->name);
+    } else if (i) {
+      fputc(',', file);
+    }
+    switch (field->type) {
+      case FIELD_UINT:
+        fprintf(file, "%" PRIu64, field->uint);
+        break;
+      case FIELD_REAL:
+        fprintf(file, "%.4f", field->real);
+        break;
+      case FIELD_TEXT:
+        fprintf(file, json ? "\"%s\"" : "%s", field->text);
+        break;
+    }
+  }
+  fputs(json ? "}" : "\n", file);
+  writer->rows++;
+}
+
+static void export_summary(writer_t* writer, const sim_stats_t* stats) {
+  const struct profile_state* profile = sim->profile;
+  begin_table(writer, "summary");
+  write_row(writer, UINT_FIELD("elapsed_ns", stats->elapsed_ns),
+            UINT_FIELD("instructions", stats->instructions),
+            UINT_FIELD("profiled_instructions", profile->instructions),
+            UINT_FIELD("distinct_pages", profile->total_pages),
+            UINT_FIELD("page_faults", stats->page_faults),
+            UINT_FIELD("page_evictions", stats->page_evictions),
+            UINT_FIELD("tlb_l1_hits", stats->tlb_l1_hits),
+            UINT_FIELD("tlb_l1_misses", stats->tlb_l1_misses),
+            REAL_FIELD("tlb_l1_hit_rate",
+                       hit_rate(stats->tlb_l1_hits, stats->tlb_l1_misses)),
+            UINT_FIELD("tlb_l2_hits", stats->tlb_l2_hits),
+            UINT_FIELD("tlb_l2_misses", stats->tlb_l2_misses),
+            REAL_FIELD("tlb_l2_hit_rate",
+                       hit_rate(stats->tlb_l2_hits, stats->tlb_l2_misses)),
+            UINT_FIELD("tlb_l1_invalidations", stats->tlb_l1_invalidations),
+            UINT_FIELD("tlb_l2_invalidations", stats->tlb_l2_invalidations),
+            UINT_FIELD("tlb_shootdowns", stats->tlb_shootdowns),
+            UINT_FIELD("tlb_page_walks", stats->tlb_page_walks),
+            UINT_FIELD("tlb_prefetches", stats->tlb_prefetches),
+            UINT_FIELD("tlb_useful_prefetches", stats->tlb_useful_prefetches),
+            UINT_FIELD("disk_reads", stats->disk_reads),
+            UINT_FIELD("disk_writes", stats->disk_writes),
+            UINT_FIELD("huge_pages_2m", stats->huge_pages_2m),
+            UINT_FIELD("huge_pages_1g", stats->huge_pages_1g));
+  end_table(writer);
+}
+
+// Every interval, with what changed during it, and the run time and
+// instructions at its end.
+static void export_intervals(writer_t* writer) {
+  const struct profile_state* profile = sim->profile;
+  begin_table(writer, "intervals");
+  for (uint64_t i = 1; i < profile->total_snapshots; i++) {
+    const snapshot_t* start = &profile->snapshots[i - 1];
+    const snapshot_t* end = &profile->snapshots[i];
+    write_row(
+        writer, UINT_FIELD("interval", i - 1),
+        UINT_FIELD("instructions", end->instructions),
+        UINT_FIELD("elapsed_ns", end->elapsed_ns),
+        UINT_FIELD("interval_ns", end->elapsed_ns - start->elapsed_ns),
+        REAL_FIELD("tlb_l1_hit_rate",
+                   hit_rate(end->tlb_l1_hits - start->tlb_l1_hits,
+                            end->tlb_l1_misses - start->tlb_l1_misses)),
+        REAL_FIELD("tlb_l2_hit_rate",
+                   hit_rate(end->tlb_l2_hits - start->tlb_l2_hits,
+                            end->tlb_l2_misses - start->tlb_l2_misses)),
+        UINT_FIELD("page_faults", end->page_faults - start->page_faults),
+        UINT_FIELD("page_evictions",
+                   end->page_evictions - start->page_evictions),
+        UINT_FIELD("disk_reads", end->disk_reads - start->disk_reads),
+        UINT_FIELD("disk_writes", end->disk_writes - start->disk_writes),
+        UINT_FIELD("tlb_shootdowns",
+                   end->tlb_shootdowns - start->tlb_shootdowns));
+  }
+  end_table(writer);
+}
+
+static void export_latency(writer_t* writer) {
+  const struct profile_state* profile = sim->profile;
+  begin_table(writer, "latency");
+  for (int kind = 0; kind < ACCESS_KINDS; kind++) {
+    const latency_t* latency = &profile->latency[kind];
+    write_row(writer, TEXT_FIELD("kind", access_kind_names[kind]),
+              UINT_FIELD("accesses", latency->accesses),
+              UINT_FIELD("total_ns", latency->total_ns),
+              REAL_FIELD("mean_ns", latency->accesses
+                                        ? (double)latency->total_ns /
+                                              latency->accesses
+                                        : 0),
+              UINT_FIELD("min_ns", latency->accesses ? latency->min_ns : 0),
+              UINT_FIELD("max_ns", latency->max_ns));
+  }
+  end_table(writer);
+
+  begin_table(writer, "latency_histogram");
+  for (int kind = 0; kind < ACCESS_KINDS; kind++) {
+    const latency_t* latency = &profile->latency[kind];
+    for (int bucket = 0; bucket < LATENCY_BUCKETS; bucket++) {
+      if (!latency->histogram[bucket]) {
+        continue;
+      }
+      uint64_t min_ns = bucket ? 1llu << (bucket - 1) : 0;
+      uint64_t max_ns = bucket ? min_ns * 2 - 1 : 0;
+      write_row(writer, TEXT_FIELD("kind", access_kind_names[kind]),
+                UINT_FIELD("min_ns", min_ns), UINT_FIELD("max_ns", max_ns),
+                UINT_FIELD("accesses", latency->histogram[bucket]));
+    }
+  }
+  end_table(writer);
+}
+
+static void export_pages(writer_t* writer) {
+  const struct profile_state* profile = sim->profile;
+  page_heat_t* pages = malloc((profile->total_pages + 1) * sizeof(page_heat_t));
+  if (!pages) {
+    panic("Failed to allocate the profile of %" PRIu64 " pages",
+          profile->total_pages);
+  }
+  uint64_t total_pages = 0;
+  for (uint64_t i = 0; i < profile->page_capacity; i++) {
+    if (profile->pages[i].accesses) {
+      pages[total_pages++] = profile->pages[i];
+    }
+  }
+  qsort(pages, total_pages, sizeof(page_heat_t), compare_heat);
+
+  begin_table(writer, "pages");
+  for (uint64_t i = 0; i < total_pages && i < profile->top_pages; i++) {
+    const page_heat_t* heat = &pages[i];
+    write_row(writer, UINT_FIELD("rank", i + 1),
+              UINT_FIELD("asid", page_key_asid(heat->page)),
+              UINT_FIELD("virtual_page_number", heat->page & PAGE_INDEX_MASK),
+              UINT_FIELD("accesses", heat->accesses),
+              REAL_FIELD("access_share",
+                         100.0 * heat->accesses / profile->instructions),
+              UINT_FIELD("writes", heat->writes),
+              UINT_FIELD("walks", heat->walks),
+              UINT_FIELD("faults", heat->faults),
+              UINT_FIELD("total_ns", heat->total_ns));
+  }
+  end_table(writer);
+  free(pages);
+}
+
+// Distances of the accesses that were not the first to their page, by
+// powers of two: bucket 0 holds distance 1, and bucket `b` the distances in
+// (2^(b-1), 2^b].
+static void export_reuse(writer_t* writer) {
+  const stack_distance_t* reuse = &sim->profile->reuse;
+  begin_table(writer, "reuse_distance");
+  write_row(writer, UINT_FIELD("min_pages", 0), UINT_FIELD("max_pages", 0),
+            UINT_FIELD("accesses", reuse->cold_misses));
+  for (int bucket = 0; bucket < 65; bucket++) {
+    if (!reuse->log2_histogram[bucket]) {
+      continue;
+    }
+    uint64_t max_pages = 1llu << bucket;
+    write_row(writer, UINT_FIELD("min_pages", bucket ? max_pages / 2 + 1 : 1),
+              UINT_FIELD("max_pages", max_pages),
+              UINT_FIELD("accesses", reuse->log2_histogram[bucket]));
+  }
+  end_table(writer);
+}
+
+void profile_export(const char* path, profile_format_t format) {
+  struct profile_state* profile = sim->profile;
+  writer_t writer = {.format = format, .path = path};
+
+  // The last interval ends with the run.
+  sim_stats_t stats;
+  simulator_get_stats(&stats);
+  if (stats.instructions !=
+      profile->snapshots[profile->total_snapshots - 1].instructions) {
+    take_snapshot(profile);
+  }
+
+  if (format == PROFILE_FORMAT_JSON) {
+    writer.file = open_output(path);
+    fputc('{', writer.file);
+  }
+
+  export_summary(&writer, &stats);
+  export_intervals(&writer);
+  export_latency(&writer);
+  export_pages(&writer);
+  export_reuse(&writer);
+
+  if (format == PROFILE_FORMAT_JSON) {
+    fputs("\n}\n", writer.file);
+    close_output(writer.file, path);
+  }
+  free(writer.csv_path);
+}
+
+bool profile_format_parse(const char* name, profile_format_t* format) {
+  if (strcmp(name, "json") == 0) {
+    *format = PROFILE_FORMAT_JSON;
+    return true;
+  }
+  if (strcmp(name, "csv") == 0) {
+    *format = PROFILE_FORMAT_CSV;
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory.h"
+
+// Profiles hold what the final report cannot show, for plotting:
+//  - snapshots of the counters every `interval` instructions, with the hit
+//    rates, faults, evictions and time of each interval,
+//  - the latency of every access, by how it was translated: L1 hit, L2 hit
+//    (or prefetch buffer hit), page walk, page fault, or page fault that went
+//    to the disk,
+//  - the `top_pages` most accessed virtual pages, with the ASID of their
+//    process, and where their time went,
+//  - the LRU reuse distance of the accesses, in distinct pages.
+//
+// They are exported as a JSON document with one array of rows per table, or
+// as one CSV file per table.
+typedef enum {
+  PROFILE_FORMAT_JSON,
+  PROFILE_FORMAT_CSV,
+} profile_format_t;
+
+// Starts profiling the current simulation. An `interval` of 0 takes no
+// snapshots. The cores must run in a single order, as every access is timed
+// against counters the cores share.
+void profile_init(uint64_t interval, uint32_t top_pages);
+void profile_free();
+
+// Bracket every access run on `core`, in the address space `asid`.
+void profile_access_begin(unsigned core);
+void profile_access_end(unsigned core, asid_t asid, op_t op, va_t address);
+
+// Writes the profile of the current simulation. CSV tables are written next
+// to `path`, with the name of the table inserted before its extension.
+void profile_export(const char* path, profile_format_t format);
+
+// Returns false if the name is neither json nor csv.
+bool profile_format_parse(const char* name, profile_format_t* format);
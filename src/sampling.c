@@ -0,0 +1,285 @@
+#include "sampling.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "log.h"
+#include "page_table.h"
+#include "tlb.h"
+
+// Sums over the measured windows of the two sides of a ratio y / x, for the
+// ratio estimator.
+typedef struct {
+  double x;
+  double y;
+  double xx;
+  double yy;
+  double xy;
+} ratio_t;
+
+// Counters the measured windows are told apart by.
+typedef struct {
+  time_ns_t time[MAX_CORES];
+  uint64_t instructions[MAX_CORES];
+  uint64_t tlb_l1_hits;
+  uint64_t tlb_l1_misses;
+  uint64_t tlb_l2_hits;
+  uint64_t tlb_l2_misses;
+  uint64_t page_faults;
+} sample_counters_t;
+
+struct sampling_state {
+  // Instructions run so far.
+  uint64_t instructions;
+  uint64_t windows;
+  // Position in the current unit of its first detailed instruction, and
+  // whether its window is being measured.
+  uint64_t detailed_at;
+  bool measuring;
+  uint64_t random_state;
+  // Counters at the start of the window being measured.
+  sample_counters_t window_start;
+  // Time per instruction of every core in the last measured window, which
+  // its clock advances by while warming, and the fraction of a nanosecond
+  // not added to it yet.
+  double warming_ns[MAX_CORES];
+  double warming_carry[MAX_CORES];
+
+  // Time per instruction of every core, hit rates and page faults per
+  // instruction.
+  ratio_t core_time[MAX_CORES];
+  ratio_t tlb_l1_hits;
+  ratio_t tlb_l2_hits;
+  ratio_t page_faults;
+};
+
+static inline uint64_t xorshift64star(uint64_t* state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dull;
+}
+
+static void read_counters(sample_counters_t* counters) {
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    counters->time[core] = get_core_time(core);
+    counters->instructions[core] = sim->cores[core].instructions;
+  }
+  counters->tlb_l1_hits = get_total_tlb_l1_hits();
+  counters->tlb_l1_misses = get_total_tlb_l1_misses();
+  counters->tlb_l2_hits = get_total_tlb_l2_hits();
+  counters->tlb_l2_misses = get_total_tlb_l2_misses();
+  counters->page_faults = get_total_page_faults();
+}
+
+static void ratio_add(ratio_t* ratio, uint64_t x, uint64_t y) {
+  ratio->x += x;
+  ratio->y += y;
+  ratio->xx += (double)x * x;
+  ratio->yy += (double)y * y;
+  ratio->xy += (double)x * y;
+}
+
+// Estimates y / x over the whole run, and sets `margin` to the half width of
+// its confidence interval, or to a negative value when the windows cannot
+// tell it.
+static double ratio_estimate(const ratio_t* ratio, double* margin) {
+  const struct sampling_state* sampling = sim->sampling;
+  *margin = -1;
+  if (ratio->x == 0) {
+    return 0;
+  }
+
+  double estimate = ratio->y / ratio->x;
+  double windows = sampling->windows;
+  if (windows < 2) {
+    return estimate;
+  }
+
+  // Variance of the ratio estimator, corrected for the share of all the
+  // windows of the run that were measured.
+  double residuals = ratio->yy - 2 * estimate * ratio->xy +
+                     estimate * estimate * ratio->xx;
+  double variance =
+      fmax(residuals, 0) / (windows - 1) * windows / (ratio->x * ratio->x);
+  double population = sampling->instructions / sim->config.sample_window;
+  if (population > windows) {
+    variance *= 1 - windows / population;
+  } else {
+    variance = 0;
+  }
+
+  *margin = SAMPLE_CONFIDENCE_Z * sqrt(variance);
+  return estimate;
+}
+
+static void open_window() {
+  read_counters(&sim->sampling->window_start);
+  sim->sampling->measuring = true;
+}
+
+static void close_window() {
+  struct sampling_state* sampling = sim->sampling;
+  const sample_counters_t* start = &sampling->window_start;
+  sample_counters_t end;
+  read_counters(&end);
+
+  uint64_t instructions = 0;
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    uint64_t core_instructions =
+        end.instructions[core] - start->instructions[core];
+    ratio_add(&sampling->core_time[core], core_instructions,
+              end.time[core] - start->time[core]);
+    if (core_instructions) {
+      sampling->warming_ns[core] =
+          (double)(end.time[core] - start->time[core]) / core_instructions;
+    }
+    instructions += core_instructions;
+  }
+
+  uint64_t l1_hits = end.tlb_l1_hits - start->tlb_l1_hits;
+  uint64_t l2_hits = end.tlb_l2_hits - start->tlb_l2_hits;
+  ratio_add(&sampling->tlb_l1_hits,
+            l1_hits + end.tlb_l1_misses - start->tlb_l1_misses, l1_hits);
+  ratio_add(&sampling->tlb_l2_hits,
+            l2_hits + end.tlb_l2_misses - start->tlb_l2_misses, l2_hits);
+  ratio_add(&sampling->page_faults, instructions,
+            end.page_faults - start->page_faults);
+  sampling->windows++;
+  sampling->measuring = false;
+}
+
+// Switches the phase of the unit as its instruction at `position` is next.
+// Windows sit at a random position of their unit, so they do not stay in step
+// with the phases of periodic workloads.
+static void enter(uint64_t position) {
+  struct sampling_state* sampling = sim->sampling;
+  const config_t* config = &sim->config;
+  uint64_t measured_at = sampling->detailed_at + config->sample_warmup;
+  uint64_t measured_end = measured_at + config->sample_window;
+
+  if (position == 0) {
+    if (sampling->measuring) {
+      close_window();
+    }
+    uint64_t positions = config->sample_interval - config->sample_warmup -
+                         config->sample_window + 1;
+    sampling->detailed_at = xorshift64star(&sampling->random_state) % positions;
+    measured_at = sampling->detailed_at + config->sample_warmup;
+    sim->warming = sampling->detailed_at > 0;
+  } else if (position == measured_end) {
+    close_window();
+    sim->warming = true;
+  }
+  if (position == sampling->detailed_at) {
+    sim->warming = false;
+  }
+  if (position == measured_at) {
+    open_window();
+  }
+}
+
+void sampling_init() {
+  sampling_free();
+  sim->warming = false;
+  if (!sim->config.sample_interval) {
+    return;
+  }
+
+  sim->sampling = calloc(1, sizeof(struct sampling_state));
+  if (!sim->sampling) {
+    panic("Failed to allocate the sampling state");
+  }
+  // xorshift must never be seeded with zero.
+  uint64_t seed = sim->config.seed;
+  sim->sampling->random_state = seed ? seed : 0xcafebabe;
+  enter(0);
+}
+
+void sampling_free() {
+  free(sim->sampling);
+  sim->sampling = NULL;
+}
+
+void sampling_checkpoint(checkpoint_t* checkpoint) {
+  if (sim->sampling) {
+    checkpoint_value(checkpoint, *sim->sampling);
+    checkpoint_value(checkpoint, sim->warming);
+  }
+}
+
+void sampling_step() {
+  struct sampling_state* sampling = sim->sampling;
+  if (sim->warming) {
+    // Warming is not timed, but policies that age pages by time need the
+    // clock to keep moving.
+    unsigned core = get_core();
+    sampling->warming_carry[core] += sampling->warming_ns[core];
+    time_ns_t elapsed = (time_ns_t)sampling->warming_carry[core];
+    sampling->warming_carry[core] -= elapsed;
+    sim->cores[core].time += elapsed;
+  }
+
+  uint64_t instructions = ++sampling->instructions;
+  enter(instructions % sim->config.sample_interval);
+}
+
+void sampling_estimate_elapsed(sim_stats_t* stats) {
+  if (!sim->sampling->windows) {
+    return;
+  }
+
+  stats->elapsed_ns = 0;
+  for (unsigned core = 0; core < stats->cores; core++) {
+    sim_core_stats_t* core_stats = &stats->core[core];
+    double margin;
+    double time = ratio_estimate(&sim->sampling->core_time[core], &margin);
+    core_stats->elapsed_ns = llround(time * core_stats->instructions);
+    if (core_stats->elapsed_ns > stats->elapsed_ns) {
+      stats->elapsed_ns = core_stats->elapsed_ns;
+    }
+  }
+}
+
+// Prints an estimate, scaled by `scale`, and its confidence interval.
+static void report_estimate(const char* name, const ratio_t* ratio,
+                            double scale, int decimals, const char* unit) {
+  double margin;
+  double estimate = ratio_estimate(ratio, &margin) * scale;
+  if (margin < 0) {
+    log("Estimated %s: %.*f%s (no confidence interval)", name, decimals,
+        estimate, unit);
+  } else {
+    log("Estimated %s: %.*f%s (+/- %.*f%s)", name, decimals, estimate, unit,
+        decimals, margin * scale, unit);
+  }
+}
+
+void sampling_report(const sim_stats_t* stats) {
+  const struct sampling_state* sampling = sim->sampling;
+  const config_t* config = &sim->config;
+  log("Sampled windows: %" PRIu64 " of %" PRIu64 " instructions every %" PRIu64
+      " instructions, %d%% confidence intervals",
+      sampling->windows, config->sample_window, config->sample_interval,
+      SAMPLE_CONFIDENCE_PERCENT);
+  if (!sampling->windows) {
+    log("The run is too short to estimate anything");
+    return;
+  }
+
+  // The elapsed time of the run is the one of its slowest core.
+  unsigned slowest = 0;
+  for (unsigned core = 1; core < stats->cores; core++) {
+    if (stats->core[core].elapsed_ns > stats->core[slowest].elapsed_ns) {
+      slowest = core;
+    }
+  }
+  report_estimate("elapsed", &sampling->core_time[slowest],
+                  stats->core[slowest].instructions, 0, " ns");
+  report_estimate("TLB L1 hit rate", &sampling->tlb_l1_hits, 100, 2, "%");
+  report_estimate("TLB L2 hit rate", &sampling->tlb_l2_hits, 100, 2, "%");
+  report_estimate("page faults", &sampling->page_faults, stats->instructions,
+                  0, "");
+}
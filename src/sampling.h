@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "simulator.h"
+
+// Sampled simulation, in the style of SMARTS: the instructions are split into
+// units of `sample_interval` instructions. Most of every unit runs with
+// functional warming, which keeps the TLBs, page table and caches up to date
+// but skips the timing model, the TLB and cache counters, the profile, the
+// write buffer and the logs. The clocks still advance by the time per
+// instruction of the last measured window, for the policies that age pages by
+// time. Its last `sample_warmup` instructions then run the full timing model
+// to settle it, and its last `sample_window` instructions are measured. The
+// elapsed time of the whole run, and the hit rates, are extrapolated from the
+// measured windows; the TLB and cache totals of the report only count the
+// detailed instructions.
+//
+// Instructions have to run in a single order, so sampling does not support
+// cores driven from different host threads.
+
+// Sets up the sampling state of the current simulation, or resets it.
+void sampling_init();
+void sampling_free();
+
+struct checkpoint;
+// Saves or restores the sampling state of the current simulation.
+void sampling_checkpoint(struct checkpoint* checkpoint);
+
+// Moves on to the next instruction, once one has been run.
+void sampling_step();
+
+// Replaces the elapsed times of `stats`, which only grow in the detailed
+// windows, with the estimates for the whole run.
+void sampling_estimate_elapsed(sim_stats_t* stats);
+
+// Prints the estimates of a sampled run, with their confidence intervals.
+void sampling_report(const sim_stats_t* stats);
@@ -0,0 +1,415 @@
+#include "simulator.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "checkpoint.h"
+#include "config.h"
+#include "log.h"
+#include "page_table.h"
+#include "profile.h"
+#include "sampling.h"
+#include "swap.h"
+#include "tlb.h"
+#include "write_buffer.h"
+
+__thread tlbsim_ctx* sim = NULL;
+
+// Runs `body` on the simulation `ctx`, restoring the caller's current
+// simulation afterwards.
+#define WITH_SIMULATION(ctx, ...) \
+  do {                            \
+    tlbsim_ctx* previous = sim;   \
+    sim = (ctx);                  \
+    __VA_ARGS__;                  \
+    sim = previous;               \
+  } while (0)
+
+static void simulator_init() {
+  reset_time();
+  memory_init();
+  page_table_init();
+  tlb_init();
+  cache_init();
+  write_buffer_init();
+  swap_init();
+  for (unsigned core = 0; core < MAX_CORES; core++) {
+    sim->cores[core].instructions = 0;
+  }
+  sampling_init();
+}
+
+tlbsim_ctx* simulator_create(const config_t* config) {
+  tlbsim_ctx* ctx = calloc(1, sizeof(tlbsim_ctx));
+  if (!ctx) {
+    panic("Failed to allocate a simulation");
+  }
+  ctx->config = *config;
+  WITH_SIMULATION(ctx, simulator_init());
+  return ctx;
+}
+
+void simulator_access(unsigned core, asid_t asid, op_t op, va_t address) {
+  if (core >= sim->config.cores) {
+    panic("Instruction for core %u, but only %u cores are simulated", core,
+          sim->config.cores);
+  }
+  if (asid >= MAX_ADDRESS_SPACES) {
+    panic("Instruction for ASID %u, but ASIDs are below %u", asid,
+          MAX_ADDRESS_SPACES);
+  }
+  set_core(core);
+  if (asid != tlb_current_asid()) {
+    tlb_context_switch(asid);
+  }
+  if (sim->warming) {
+    warm(address, op);
+    sim->cores[core].instructions++;
+    sampling_step();
+    return;
+  }
+  if (sim->profile) {
+    profile_access_begin(core);
+  }
+
+  switch (op) {
+    case OP_READ:
+      read(address);
+      break;
+    case OP_WRITE:
+      write(address);
+      break;
+  }
+
+  sim->cores[core].instructions++;
+  if (sim->profile) {
+    profile_access_end(core, asid, op, address);
+  }
+  if (sim->sampling) {
+    sampling_step();
+  }
+}
+
+void simulator_checkpoint(checkpoint_t* checkpoint) {
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    checkpoint_value(checkpoint, sim->cores[core].time);
+    checkpoint_value(checkpoint, sim->cores[core].instructions);
+  }
+  checkpoint_value(checkpoint, sim->disk_reads);
+  checkpoint_value(checkpoint, sim->disk_writes);
+  checkpoint_value(checkpoint, sim->disk_head);
+  checkpoint_value(checkpoint, sim->disk_seeks);
+
+  page_table_checkpoint(checkpoint);
+  tlb_checkpoint(checkpoint);
+  cache_checkpoint(checkpoint);
+  write_buffer_checkpoint(checkpoint);
+  swap_checkpoint(checkpoint);
+  sampling_checkpoint(checkpoint);
+}
+
+void simulator_finish() {
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    set_core(core);
+    tlb_apply_shootdowns();
+  }
+  set_core(0);
+}
+
+void simulator_get_stats(sim_stats_t* stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->cores = sim->config.cores;
+
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    sim_core_stats_t* core_stats = &stats->core[core];
+    tlb_stats_t tlb_stats;
+    tlb_get_stats(core, &tlb_stats);
+
+    core_stats->elapsed_ns = get_core_time(core);
+    core_stats->instructions = sim->cores[core].instructions;
+    core_stats->tlb_l1_hits = tlb_stats.l1_hits;
+    core_stats->tlb_l1_misses = tlb_stats.l1_misses;
+    core_stats->tlb_l1_invalidations = tlb_stats.l1_invalidations;
+    core_stats->tlb_l2_hits = tlb_stats.l2_hits;
+    core_stats->tlb_l2_misses = tlb_stats.l2_misses;
+    core_stats->tlb_l2_invalidations = tlb_stats.l2_invalidations;
+    core_stats->tlb_shootdowns = tlb_stats.shootdowns;
+    core_stats->context_switches = tlb_stats.context_switches;
+
+    if (core_stats->elapsed_ns > stats->elapsed_ns) {
+      stats->elapsed_ns = core_stats->elapsed_ns;
+    }
+    stats->instructions += core_stats->instructions;
+
+    stats->tlb_page_walks += tlb_stats.page_walks;
+    stats->tlb_prefetches += tlb_stats.prefetches;
+    stats->tlb_useful_prefetches += tlb_stats.useful_prefetches;
+    stats->tlb_useless_prefetches += tlb_stats.useless_prefetches;
+    stats->context_switches += tlb_stats.context_switches;
+    stats->tlb_flushed_entries += tlb_stats.flushed_entries;
+  }
+
+  stats->page_faults = get_total_page_faults();
+  stats->page_evictions = get_total_page_evictions();
+  stats->address_spaces = get_total_address_spaces();
+
+  stats->tlb_l1_hits = get_total_tlb_l1_hits();
+  stats->tlb_l1_misses = get_total_tlb_l1_misses();
+  stats->tlb_l1_invalidations = get_total_tlb_l1_invalidations();
+  stats->tlb_l2_hits = get_total_tlb_l2_hits();
+  stats->tlb_l2_misses = get_total_tlb_l2_misses();
+  stats->tlb_l2_invalidations = get_total_tlb_l2_invalidations();
+  stats->tlb_shootdowns = get_total_tlb_shootdowns();
+
+  stats->disk_reads = get_total_disk_reads();
+  stats->disk_writes = get_total_disk_writes();
+  stats->disk_seeks = get_total_disk_seeks();
+
+  swap_stats_t swap_stats;
+  swap_get_stats(&swap_stats);
+  stats->swap_outs = swap_stats.swap_outs;
+  stats->swap_ins = swap_stats.swap_ins;
+  stats->swap_readahead_pages = swap_stats.readahead_pages;
+  stats->swap_readahead_hits = swap_stats.readahead_hits;
+
+  stats->huge_pages_2m = get_total_huge_pages(PAGE_SIZE_2M);
+  stats->huge_pages_1g = get_total_huge_pages(PAGE_SIZE_1G);
+  stats->huge_page_promotions = get_total_huge_page_promotions();
+  stats->huge_page_splits = get_total_huge_page_splits();
+
+  for (cache_level_t level = 0; level < CACHE_LEVELS; level++) {
+    cache_stats_t cache_stats;
+    cache_get_stats(level, &cache_stats);
+    stats->cache_hits[level] = cache_stats.hits;
+    stats->cache_misses[level] = cache_stats.misses;
+    stats->cache_writebacks[level] = cache_stats.writebacks;
+    stats->cache_mmu_accesses[level] = cache_stats.mmu_accesses;
+    stats->cache_mmu_hits[level] = cache_stats.mmu_hits;
+    stats->cache_mmu_evictions[level] = cache_stats.mmu_evictions;
+  }
+
+  write_buffer_stats_t write_buffer_stats;
+  write_buffer_get_stats(&write_buffer_stats);
+  stats->write_buffer_writes = write_buffer_stats.writes;
+  stats->write_buffer_coalesced = write_buffer_stats.coalesced;
+  stats->write_buffer_forwarded = write_buffer_stats.forwarded;
+  stats->write_buffer_stalls = write_buffer_stats.stalls;
+  stats->write_buffer_stall_ns = write_buffer_stats.stall_ns;
+
+  if (sim->sampling) {
+    sampling_estimate_elapsed(stats);
+  }
+}
+
+void simulator_report(const sim_stats_t* stats) {
+  float l1_hit_rate = hit_rate(stats->tlb_l1_hits, stats->tlb_l1_misses);
+  float l2_hit_rate = hit_rate(stats->tlb_l2_hits, stats->tlb_l2_misses);
+
+  log("Elapsed: %" PRIu64 " ns", stats->elapsed_ns);
+  log("Total instructions executed: %" PRIu64, stats->instructions);
+  log("Total page faults: %" PRIu64, stats->page_faults);
+  log("Total page evictions: %" PRIu64, stats->page_evictions);
+  log("Total TLB L1 hits: %" PRIu64 " (%.2f%%)", stats->tlb_l1_hits,
+      l1_hit_rate);
+  log("Total TLB L2 hits: %" PRIu64 " (%.2f%%)", stats->tlb_l2_hits,
+      l2_hit_rate);
+  log("Total TLB L1 invalidations: %" PRIu64, stats->tlb_l1_invalidations);
+  log("Total TLB L2 invalidations: %" PRIu64, stats->tlb_l2_invalidations);
+
+  // Only reported with the alternative page replacement policies and disk
+  // models, so the default report matches the expected outputs.
+  if (sim->config.page_policy != PAGE_POLICY_REFERENCE) {
+    log("Page replacement policy: %s",
+        page_policy_name(sim->config.page_policy));
+  }
+  if (sim->config.page_policy != PAGE_POLICY_REFERENCE || sim->swap ||
+      sim->config.disk_model != DISK_MODEL_FLAT) {
+    log("Total disk reads: %" PRIu64, stats->disk_reads);
+    log("Total disk writes: %" PRIu64, stats->disk_writes);
+  }
+  if (sim->config.disk_model != DISK_MODEL_FLAT) {
+    log("Disk model: %s", disk_model_name(sim->config.disk_model));
+    log("Total disk seeks: %" PRIu64, stats->disk_seeks);
+  }
+  if (sim->swap) {
+    log("Swap clusters: %u pages, reading ahead up to %u pages",
+        sim->config.swap_cluster_pages, sim->config.swap_readahead_pages);
+    log("Total pages swapped out: %" PRIu64, stats->swap_outs);
+    log("Total pages swapped in: %" PRIu64, stats->swap_ins);
+    log("Total pages read ahead: %" PRIu64, stats->swap_readahead_pages);
+    log("Total swap-ins from the swap cache: %" PRIu64 " (%.2f%%)",
+        stats->swap_readahead_hits,
+        hit_rate(stats->swap_readahead_hits,
+                 stats->swap_ins - stats->swap_readahead_hits));
+  }
+
+  if (stats->context_switches) {
+    log("Context switches: %s",
+        context_switch_name(sim->config.context_switch));
+    log("Total address spaces: %" PRIu64, stats->address_spaces);
+    log("Total context switches: %" PRIu64, stats->context_switches);
+    log("Total TLB entries flushed: %" PRIu64, stats->tlb_flushed_entries);
+  }
+
+  if (sim->config.huge_page_sizes) {
+    log("Huge page policy: %s",
+        huge_page_policy_name(sim->config.huge_page_policy));
+    log("Total 2 MiB pages: %" PRIu64, stats->huge_pages_2m);
+    log("Total 1 GiB pages: %" PRIu64, stats->huge_pages_1g);
+    log("Total huge page promotions: %" PRIu64, stats->huge_page_promotions);
+    log("Total huge page splits: %" PRIu64, stats->huge_page_splits);
+  }
+
+  // Coverage is the share of the translations that would have walked the
+  // page table that a prefetch saved, and accuracy the share of the
+  // prefetches that were used.
+  if (sim->config.tlb_prefetcher != TLB_PREFETCH_NONE) {
+    log("TLB prefetcher: %s", tlb_prefetcher_name(sim->config.tlb_prefetcher));
+    log("Total TLB prefetches: %" PRIu64, stats->tlb_prefetches);
+    log("TLB prefetch coverage: %.2f%%",
+        hit_rate(stats->tlb_useful_prefetches, stats->tlb_page_walks));
+    log("TLB prefetch accuracy: %.2f%%",
+        hit_rate(stats->tlb_useful_prefetches,
+                 stats->tlb_prefetches - stats->tlb_useful_prefetches));
+    log("Total useless TLB prefetches: %" PRIu64,
+        stats->tlb_useless_prefetches);
+  }
+
+  // Page walk pollution shows as the share of the accesses that come from
+  // the MMU, and the data lines their fills evict.
+  for (cache_level_t level = 0; level < sim->config.cache_levels; level++) {
+    const cache_level_config_t* cache = &sim->config.caches[level];
+    const char* name = cache_level_name(level);
+    uint64_t accesses = stats->cache_hits[level] + stats->cache_misses[level];
+    log("Cache %s: %u B, %u ways, %u B lines, write-%s, %s", name,
+        cache->size, cache->ways, sim->config.cache_line_bytes,
+        sim->config.cache_write_through ? "through" : "back",
+        sim->config.cache_write_allocate ? "write-allocate"
+                                         : "no-write-allocate");
+    log("Total cache %s hits: %" PRIu64 " (%.2f%%)", name,
+        stats->cache_hits[level],
+        hit_rate(stats->cache_hits[level], stats->cache_misses[level]));
+    log("Total cache %s write-backs: %" PRIu64, name,
+        stats->cache_writebacks[level]);
+    log("Total cache %s MMU accesses: %" PRIu64 " (%.2f%% of accesses, "
+        "%.2f%% hits)",
+        name, stats->cache_mmu_accesses[level],
+        hit_rate(stats->cache_mmu_accesses[level],
+                 accesses - stats->cache_mmu_accesses[level]),
+        hit_rate(stats->cache_mmu_hits[level],
+                 stats->cache_mmu_accesses[level] -
+                     stats->cache_mmu_hits[level]));
+    log("Total cache %s data lines evicted by the MMU: %" PRIu64, name,
+        stats->cache_mmu_evictions[level]);
+  }
+
+  if (sim->config.write_buffer_entries) {
+    log("Write buffer: %u entries of %d B", sim->config.write_buffer_entries,
+        1 << WRITE_BUFFER_LINE_BITS);
+    log("Total buffered DRAM writes: %" PRIu64, stats->write_buffer_writes);
+    log("Total coalesced DRAM writes: %" PRIu64 " (%.2f%%)",
+        stats->write_buffer_coalesced,
+        hit_rate(stats->write_buffer_coalesced,
+                 stats->write_buffer_writes - stats->write_buffer_coalesced));
+    log("Total DRAM reads forwarded from the write buffer: %" PRIu64,
+        stats->write_buffer_forwarded);
+    log("Total write buffer stalls: %" PRIu64 " (%" PRIu64 " ns)",
+        stats->write_buffer_stalls, stats->write_buffer_stall_ns);
+  }
+
+  if (sim->sampling) {
+    sampling_report(stats);
+  }
+
+  if (stats->cores > 1) {
+    log("Total TLB shootdowns: %" PRIu64, stats->tlb_shootdowns);
+    for (unsigned core = 0; core < stats->cores; core++) {
+      const sim_core_stats_t* core_stats = &stats->core[core];
+      log("Core %u elapsed: %" PRIu64 " ns", core, core_stats->elapsed_ns);
+      log("Core %u instructions executed: %" PRIu64, core,
+          core_stats->instructions);
+      log("Core %u TLB L1 hits: %" PRIu64 " (%.2f%%)", core,
+          core_stats->tlb_l1_hits,
+          hit_rate(core_stats->tlb_l1_hits, core_stats->tlb_l1_misses));
+      log("Core %u TLB L2 hits: %" PRIu64 " (%.2f%%)", core,
+          core_stats->tlb_l2_hits,
+          hit_rate(core_stats->tlb_l2_hits, core_stats->tlb_l2_misses));
+      log("Core %u TLB invalidations: %" PRIu64 " L1, %" PRIu64 " L2", core,
+          core_stats->tlb_l1_invalidations, core_stats->tlb_l2_invalidations);
+      log("Core %u TLB shootdowns: %" PRIu64, core,
+          core_stats->tlb_shootdowns);
+      if (stats->context_switches) {
+        log("Core %u context switches: %" PRIu64, core,
+            core_stats->context_switches);
+      }
+    }
+  }
+}
+
+// ========================================================================
+// Library interface.
+// ========================================================================
+
+tlbsim_ctx* tlbsim_create(const char* options) {
+  config_t config;
+  config_init(&config);
+  if (options) {
+    config_parse(&config, options, "tlbsim_create");
+  }
+  config_finalize(&config);
+  return simulator_create(&config);
+}
+
+void tlbsim_save(tlbsim_ctx* ctx, const char* path) {
+  WITH_SIMULATION(ctx, checkpoint_save(path, NULL));
+}
+
+tlbsim_ctx* tlbsim_restore(const char* path, const char* options) {
+  config_t config;
+  checkpoint_read_config(path, &config);
+  if (options) {
+    config_parse(&config, options, "tlbsim_restore");
+  }
+  config_finalize(&config);
+
+  tlbsim_ctx* ctx = simulator_create(&config);
+  WITH_SIMULATION(ctx, checkpoint_restore(path, NULL));
+  return ctx;
+}
+
+void tlbsim_reset(tlbsim_ctx* ctx) { WITH_SIMULATION(ctx, simulator_init()); }
+
+void tlbsim_destroy(tlbsim_ctx* ctx) {
+  if (!ctx) {
+    return;
+  }
+  WITH_SIMULATION(ctx, {
+    page_table_free();
+    tlb_free();
+    cache_free();
+    write_buffer_free();
+    swap_free();
+    sampling_free();
+    profile_free();
+  });
+  free(ctx);
+}
+
+void tlbsim_access(tlbsim_ctx* ctx, const tlbsim_op_t* ops, size_t count) {
+  WITH_SIMULATION(ctx, {
+    for (size_t i = 0; i < count; i++) {
+      simulator_access(ops[i].core, ops[i].asid,
+                       ops[i].write ? OP_WRITE : OP_READ, ops[i].address);
+    }
+  });
+}
+
+void tlbsim_get_stats(tlbsim_ctx* ctx, tlbsim_stats_t* stats) {
+  // Pending shootdowns only touch the TLBs of the cores they were sent to,
+  // so settling them early does not change the rest of the simulation.
+  WITH_SIMULATION(ctx, {
+    simulator_finish();
+    simulator_get_stats(stats);
+  });
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "clock.h"
+#include "config.h"
+#include "constants.h"
+#include "memory.h"
+#include "tlbsim.h"
+
+_Static_assert(MAX_CORES == TLBSIM_MAX_CORES,
+               "The library must expose every simulated core");
+_Static_assert(CACHE_LEVELS == TLBSIM_CACHE_LEVELS,
+               "The library must expose every cache level");
+_Static_assert(MAX_ADDRESS_SPACES == TLBSIM_MAX_ADDRESS_SPACES,
+               "The library must accept every ASID");
+
+typedef tlbsim_stats_t sim_stats_t;
+typedef tlbsim_core_stats_t sim_core_stats_t;
+
+struct tlb_state;
+struct page_table_state;
+struct sampling_state;
+struct profile_state;
+struct write_buffer_state;
+struct swap_state;
+struct cache_state;
+
+// State of a simulated core that no module owns. Kept on separate cache
+// lines, as cores may be simulated by different host threads.
+typedef struct {
+  time_ns_t time;
+  uint64_t instructions;
+} __attribute__((aligned(64))) sim_core_t;
+
+// The whole state of a simulation.
+struct tlbsim_ctx {
+  config_t config;
+
+  sim_core_t cores[MAX_CORES];
+
+  struct tlb_state* tlb;
+  struct page_table_state* page_table;
+  // Only set when data caches are simulated.
+  struct cache_state* caches;
+  // Only set when the MMUs have write buffers.
+  struct write_buffer_state* write_buffer;
+  // Only set when swap space is split into clusters.
+  struct swap_state* swap;
+  // Only set when sampling.
+  struct sampling_state* sampling;
+  // Set while sampling warms up the state between detailed windows.
+  bool warming;
+  // Only set when profiling.
+  struct profile_state* profile;
+
+  uint64_t disk_reads;
+  uint64_t disk_writes;
+  // Where the disk head stands, after the last page moved by the seek model.
+  pa_disk_t disk_head;
+  uint64_t disk_seeks;
+};
+
+// Simulation the calling host thread works on. Every module reaches its state
+// through it, so it has to be set before calling into the simulator; the
+// library entry points do so.
+extern __thread tlbsim_ctx* sim;
+
+// Creates a simulation of a finalized configuration.
+tlbsim_ctx* simulator_create(const config_t* config);
+
+// Runs a single memory instruction of the current simulation on a core, in
+// the address space of a process, switching the core to it first if needed.
+// Different cores can be simulated concurrently from different host threads.
+void simulator_access(unsigned core, asid_t asid, op_t op, va_t address);
+
+struct checkpoint;
+// Saves or restores the state of the current simulation, which must have been
+// created with the configuration of the checkpoint.
+void simulator_checkpoint(struct checkpoint* checkpoint);
+
+// Settles the TLB shootdowns still pending in the current simulation, once
+// every core is done.
+void simulator_finish();
+
+void simulator_get_stats(sim_stats_t* stats);
+
+// Prints the final report of a run.
+void simulator_report(const sim_stats_t* stats);
+
+static inline double hit_rate(uint64_t hits, uint64_t misses) {
+  return (hits + misses) > 0 ? 100.0 * hits / (hits + misses) : 0.0;
+}
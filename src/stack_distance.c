@@ -0,0 +1,238 @@
+#include "stack_distance.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "log.h"
+#include "page_table.h"
+#include "trace.h"
+
+#define NO_PAGE UINT64_MAX
+
+#define MIN_TABLE_CAPACITY (1llu << 12)
+#define MIN_SLOT_CAPACITY (1llu << 16)
+
+static void* allocate(void* memory, size_t count, size_t size) {
+  memory = realloc(memory, count * size);
+  if (!memory) {
+    panic("Failed to allocate stack distance state");
+  }
+  return memory;
+}
+
+// ========================================================================
+// Page table: virtual page number to slot of its last access.
+// ========================================================================
+
+static inline uint64_t table_bucket(const stack_distance_t* a, va_t page) {
+  return (page * 0x9e3779b97f4a7c15llu) >> (64 - __builtin_ctzll(a->table_capacity));
+}
+
+// Returns the slot entry of the page, or NULL if it was never accessed.
+static uint64_t* table_find(stack_distance_t* a, va_t page) {
+  uint64_t mask = a->table_capacity - 1;
+  for (uint64_t i = table_bucket(a, page);; i = (i + 1) & mask) {
+    if (a->keys[i] == page + 1) {
+      return &a->slots[i];
+    }
+    if (a->keys[i] == 0) {
+      return NULL;
+    }
+  }
+}
+
+static uint64_t* table_insert(stack_distance_t* a, va_t page) {
+  uint64_t mask = a->table_capacity - 1;
+  uint64_t i = table_bucket(a, page);
+  while (a->keys[i] != 0) {
+    i = (i + 1) & mask;
+  }
+  a->keys[i] = page + 1;
+  return &a->slots[i];
+}
+
+static void table_grow(stack_distance_t* a) {
+  uint64_t* keys = a->keys;
+  uint64_t* slots = a->slots;
+  uint64_t capacity = a->table_capacity;
+
+  a->table_capacity = capacity ? 2 * capacity : MIN_TABLE_CAPACITY;
+  a->keys = calloc(a->table_capacity, sizeof(uint64_t));
+  a->slots = allocate(NULL, a->table_capacity, sizeof(uint64_t));
+  if (!a->keys) {
+    panic("Failed to allocate stack distance state");
+  }
+
+  for (uint64_t i = 0; i < capacity; i++) {
+    if (keys[i]) {
+      *table_insert(a, keys[i] - 1) = slots[i];
+    }
+  }
+  free(keys);
+  free(slots);
+}
+
+// ========================================================================
+// Fenwick tree over time slots.
+// ========================================================================
+
+static inline void tree_add(stack_distance_t* a, uint64_t slot, int32_t delta) {
+  for (uint64_t i = slot + 1; i <= a->slot_capacity; i += i & -i) {
+    a->tree[i - 1] += delta;
+  }
+}
+
+// Number of marks at slots up to and including `slot`.
+static inline uint64_t tree_prefix(const stack_distance_t* a, uint64_t slot) {
+  uint64_t sum = 0;
+  for (uint64_t i = slot + 1; i > 0; i -= i & -i) {
+    sum += a->tree[i - 1];
+  }
+  return sum;
+}
+
+// Renumbers the live slots from zero, keeping their order, and makes sure
+// at least as many slots are free as there are pages so the cost of the
+// renumbering is amortized over the accesses that fill them.
+static void compact_slots(stack_distance_t* a) {
+  uint64_t live = 0;
+  for (uint64_t slot = 0; slot < a->next_slot; slot++) {
+    va_t page = a->page_at[slot];
+    if (page != NO_PAGE) {
+      a->page_at[live] = page;
+      *table_find(a, page) = live;
+      live++;
+    }
+  }
+
+  uint64_t capacity = a->slot_capacity ? a->slot_capacity : MIN_SLOT_CAPACITY;
+  while (capacity < 2 * live) {
+    capacity *= 2;
+  }
+  if (capacity != a->slot_capacity) {
+    a->slot_capacity = capacity;
+    a->page_at = allocate(a->page_at, capacity, sizeof(va_t));
+    a->tree = allocate(a->tree, capacity, sizeof(uint32_t));
+  }
+  for (uint64_t slot = live; slot < capacity; slot++) {
+    a->page_at[slot] = NO_PAGE;
+  }
+
+  // Linear time build, every node pushing its count up to its parent.
+  memset(a->tree, 0, capacity * sizeof(uint32_t));
+  for (uint64_t i = 1; i <= capacity; i++) {
+    a->tree[i - 1] += i <= live;
+    uint64_t parent = i + (i & -i);
+    if (parent <= capacity) {
+      a->tree[parent - 1] += a->tree[i - 1];
+    }
+  }
+
+  a->next_slot = live;
+}
+
+// ========================================================================
+// Analysis.
+// ========================================================================
+
+void stack_distance_init(stack_distance_t* a, uint64_t max_distance) {
+  memset(a, 0, sizeof(*a));
+  a->max_distance = max_distance;
+  a->histogram = calloc(max_distance + 1, sizeof(uint64_t));
+  if (!a->histogram) {
+    panic("Failed to allocate stack distance state");
+  }
+  table_grow(a);
+  compact_slots(a);
+}
+
+void stack_distance_free(stack_distance_t* a) {
+  free(a->keys);
+  free(a->slots);
+  free(a->tree);
+  free(a->page_at);
+  free(a->histogram);
+  memset(a, 0, sizeof(*a));
+}
+
+void stack_distance_access(stack_distance_t* a, va_t page) {
+  a->accesses++;
+
+  if (a->next_slot == a->slot_capacity) {
+    compact_slots(a);
+  }
+
+  uint64_t* slot = table_find(a, page);
+  if (slot) {
+    // Every page has one mark, so the pages accessed since the last access
+    // to this one are the marks after its slot.
+    uint64_t distance = a->pages - tree_prefix(a, *slot) + 1;
+    if (distance <= a->max_distance) {
+      a->histogram[distance]++;
+    }
+    a->log2_histogram[distance > 1 ? 64 - __builtin_clzll(distance - 1) : 0]++;
+
+    tree_add(a, *slot, -1);
+    a->page_at[*slot] = NO_PAGE;
+  } else {
+    a->cold_misses++;
+    if (2 * (a->pages + 1) > a->table_capacity) {
+      table_grow(a);
+    }
+    if (a->pages == UINT32_MAX) {
+      panic("Too many distinct pages for the stack distance analysis");
+    }
+    slot = table_insert(a, page);
+    a->pages++;
+  }
+
+  *slot = a->next_slot;
+  a->page_at[a->next_slot] = page;
+  tree_add(a, a->next_slot, 1);
+  a->next_slot++;
+}
+
+static inline double hit_ratio(uint64_t hits, uint64_t accesses) {
+  return accesses > 0 ? 100.0 * hits / accesses : 0.0;
+}
+
+void stack_distance_run(const char* trace_path, uint64_t max_tlb_entries,
+                        uint64_t dram_frames) {
+  stack_distance_t analysis;
+  stack_distance_init(&analysis, max_tlb_entries);
+
+  trace_t trace;
+  trace_open(&trace, trace_path);
+
+  instruction_t instruction;
+  while (trace_next(&trace, &instruction)) {
+    // Pages of different processes are different pages, as they are to a
+    // TLB with ASIDs.
+    va_t virtual_page_number =
+        (instruction.address >> PAGE_SIZE_BITS) & PAGE_INDEX_MASK;
+    stack_distance_access(&analysis,
+                          page_key(instruction.asid, virtual_page_number));
+  }
+
+  trace_close(&trace);
+
+  log("Total instructions executed: %" PRIu64, analysis.accesses);
+  log("Total distinct pages: %" PRIu64, analysis.pages);
+
+  uint64_t hits = 0;
+  for (uint64_t entries = 1; entries <= max_tlb_entries; entries++) {
+    hits += analysis.histogram[entries];
+    log("LRU TLB with %" PRIu64 " entries: %" PRIu64 " hits (%.2f%%)", entries,
+        hits, hit_ratio(hits, analysis.accesses));
+  }
+
+  hits = 0;
+  for (int bits = 0; bits < 64 && (1llu << bits) <= dram_frames; bits++) {
+    hits += analysis.log2_histogram[bits];
+    log("LRU DRAM with %" PRIu64 " frames: %" PRIu64 " hits (%.2f%%)",
+        (uint64_t)1 << bits, hits, hit_ratio(hits, analysis.accesses));
+  }
+
+  stack_distance_free(&analysis);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "memory.h"
+
+// Mattson's LRU stack distance of every access to a virtual page: the number
+// of distinct pages referenced since the previous access to the same page,
+// counting the page itself. An access hits in a fully associative LRU cache
+// of `c` pages exactly when its stack distance is at most `c`, so a single
+// pass gives the hit ratio of every capacity at once.
+//
+// Each access costs O(log n): the last access of every page is marked in a
+// Fenwick tree indexed by time, and the distance is the number of marks more
+// recent than the previous access to the page. Times are renumbered when the
+// tree is full, so its size follows the number of distinct pages rather than
+// the length of the trace.
+typedef struct {
+  // Open addressing hash table from virtual page number (plus one, so zero
+  // marks an empty bucket) to the time slot of its last access.
+  uint64_t* keys;
+  uint64_t* slots;
+  uint64_t table_capacity;
+  uint64_t pages;
+
+  // Fenwick tree over the time slots, with a one at the last access of each
+  // page, and the page last accessed at each slot.
+  uint32_t* tree;
+  va_t* page_at;
+  uint64_t slot_capacity;
+  uint64_t next_slot;
+
+  uint64_t accesses;
+  uint64_t cold_misses;
+
+  // Exact histogram of the distances up to `max_distance`, and histogram of
+  // all distances by ceil(log2(distance)).
+  uint64_t max_distance;
+  uint64_t* histogram;
+  uint64_t log2_histogram[65];
+} stack_distance_t;
+
+void stack_distance_init(stack_distance_t* analysis, uint64_t max_distance);
+void stack_distance_free(stack_distance_t* analysis);
+
+void stack_distance_access(stack_distance_t* analysis, va_t virtual_page_number);
+
+// Reads the whole trace and reports the hit ratio of a fully associative LRU
+// TLB for every size from 1 to `max_tlb_entries`, and of an LRU managed DRAM
+// for every power of two number of frames up to `dram_frames`.
+void stack_distance_run(const char* trace_path, uint64_t max_tlb_entries,
+                        uint64_t dram_frames);
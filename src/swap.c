@@ -0,0 +1,205 @@
+#include "swap.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "log.h"
+#include "simulator.h"
+
+// Marks the free entries of the swap cache.
+#define NO_SLOT UINT64_MAX
+
+struct swap_state {
+  uint32_t cluster_pages;
+
+  // Whether every slot holds a swapped out page, and the number of such
+  // slots in every cluster.
+  uint8_t* slot_used;
+  uint32_t* cluster_used;
+  uint64_t total_clusters;
+  uint64_t cluster_capacity;
+
+  // Clusters left empty, reused before new ones are added.
+  uint64_t* free_clusters;
+  uint64_t total_free_clusters;
+  uint64_t free_cluster_capacity;
+
+  // Cluster being filled, and its next slot.
+  uint64_t cluster;
+  uint32_t next_slot;
+
+  // Slots read ahead, and the one replaced next.
+  uint64_t cache[SWAP_CACHE_PAGES];
+  uint32_t cache_next;
+
+  swap_stats_t stats;
+};
+
+static void push_free_cluster(struct swap_state* swap, uint64_t cluster) {
+  if (swap->total_free_clusters == swap->free_cluster_capacity) {
+    swap->free_cluster_capacity =
+        swap->free_cluster_capacity ? 2 * swap->free_cluster_capacity : 16;
+    swap->free_clusters =
+        realloc(swap->free_clusters,
+                swap->free_cluster_capacity * sizeof(uint64_t));
+    if (!swap->free_clusters) {
+      panic("Failed to allocate the free swap clusters");
+    }
+  }
+  swap->free_clusters[swap->total_free_clusters++] = cluster;
+}
+
+static uint64_t add_cluster(struct swap_state* swap) {
+  if ((swap->total_clusters + 1) * swap->cluster_pages > DISK_PAGE_CAPACITY) {
+    panic("Swap space is full");
+  }
+  if (swap->total_clusters == swap->cluster_capacity) {
+    swap->cluster_capacity =
+        swap->cluster_capacity ? 2 * swap->cluster_capacity : 16;
+    swap->cluster_used = realloc(swap->cluster_used,
+                                 swap->cluster_capacity * sizeof(uint32_t));
+    swap->slot_used =
+        realloc(swap->slot_used, swap->cluster_capacity * swap->cluster_pages);
+    if (!swap->cluster_used || !swap->slot_used) {
+      panic("Failed to allocate %" PRIu64 " swap clusters",
+            swap->cluster_capacity);
+    }
+  }
+  uint64_t cluster = swap->total_clusters++;
+  swap->cluster_used[cluster] = 0;
+  memset(&swap->slot_used[cluster * swap->cluster_pages], 0,
+         swap->cluster_pages);
+  return cluster;
+}
+
+void swap_init() {
+  swap_free();
+  if (!sim->config.swap_cluster_pages) {
+    return;
+  }
+
+  struct swap_state* swap = calloc(1, sizeof(struct swap_state));
+  if (!swap) {
+    panic("Failed to allocate the swap space");
+  }
+  swap->cluster_pages = sim->config.swap_cluster_pages;
+  swap->next_slot = swap->cluster_pages;
+  for (int i = 0; i < SWAP_CACHE_PAGES; i++) {
+    swap->cache[i] = NO_SLOT;
+  }
+  sim->swap = swap;
+}
+
+void swap_free() {
+  struct swap_state* swap = sim->swap;
+  if (!swap) {
+    return;
+  }
+  free(swap->slot_used);
+  free(swap->cluster_used);
+  free(swap->free_clusters);
+  free(swap);
+  sim->swap = NULL;
+}
+
+void swap_checkpoint(checkpoint_t* checkpoint) {
+  struct swap_state* swap = sim->swap;
+  if (!swap) {
+    return;
+  }
+
+  checkpoint_value(checkpoint, swap->total_clusters);
+  checkpoint_vector(checkpoint, (void**)&swap->slot_used,
+                    swap->total_clusters * swap->cluster_pages,
+                    sizeof(uint8_t));
+  checkpoint_vector(checkpoint, (void**)&swap->cluster_used,
+                    swap->total_clusters, sizeof(uint32_t));
+  checkpoint_value(checkpoint, swap->total_free_clusters);
+  checkpoint_vector(checkpoint, (void**)&swap->free_clusters,
+                    swap->total_free_clusters, sizeof(uint64_t));
+  if (checkpoint->restoring) {
+    swap->cluster_capacity = swap->total_clusters;
+    swap->free_cluster_capacity = swap->total_free_clusters;
+  }
+
+  checkpoint_value(checkpoint, swap->cluster);
+  checkpoint_value(checkpoint, swap->next_slot);
+  checkpoint_value(checkpoint, swap->cache);
+  checkpoint_value(checkpoint, swap->cache_next);
+  checkpoint_value(checkpoint, swap->stats);
+}
+
+pa_disk_t swap_allocate() {
+  struct swap_state* swap = sim->swap;
+  if (swap->next_slot == swap->cluster_pages) {
+    swap->cluster = swap->total_free_clusters
+                        ? swap->free_clusters[--swap->total_free_clusters]
+                        : add_cluster(swap);
+    swap->next_slot = 0;
+    log_dbg("***** Filling swap cluster %" PRIu64 " *****", swap->cluster);
+  }
+
+  uint64_t slot = swap->cluster * swap->cluster_pages + swap->next_slot++;
+  swap->slot_used[slot] = true;
+  swap->cluster_used[swap->cluster]++;
+  swap->stats.swap_outs++;
+  return slot << PAGE_SIZE_BITS;
+}
+
+// Returns the entry of the swap cache holding the slot, or -1.
+static int find_in_cache(const struct swap_state* swap, uint64_t slot) {
+  for (int i = 0; i < SWAP_CACHE_PAGES; i++) {
+    if (swap->cache[i] == slot) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void swap_in(pa_disk_t address) {
+  struct swap_state* swap = sim->swap;
+  uint64_t slot = address >> PAGE_SIZE_BITS;
+  uint64_t cluster = slot / swap->cluster_pages;
+  swap->stats.swap_ins++;
+
+  int cached = find_in_cache(swap, slot);
+  if (cached >= 0) {
+    swap->cache[cached] = NO_SLOT;
+    log_dbg("***** Page found in the swap cache *****");
+    swap->stats.readahead_hits++;
+  } else {
+    // The following used slots of the cluster come along, up to the first
+    // one that is free or already read.
+    uint64_t end = (cluster + 1) * swap->cluster_pages;
+    uint64_t pages = 1;
+    while (pages < sim->config.swap_readahead_pages && slot + pages < end &&
+           swap->slot_used[slot + pages] &&
+           find_in_cache(swap, slot + pages) < 0) {
+      pages++;
+    }
+    disk_access_pages(address, pages, OP_READ);
+
+    for (uint64_t i = 1; i < pages; i++) {
+      swap->cache[swap->cache_next] = slot + i;
+      swap->cache_next = (swap->cache_next + 1) % SWAP_CACHE_PAGES;
+    }
+    swap->stats.readahead_pages += pages - 1;
+  }
+
+  // The cluster being filled is kept until it is full.
+  swap->slot_used[slot] = false;
+  bool filling =
+      cluster == swap->cluster && swap->next_slot < swap->cluster_pages;
+  if (!--swap->cluster_used[cluster] && !filling) {
+    push_free_cluster(swap, cluster);
+  }
+}
+
+void swap_get_stats(swap_stats_t* stats) {
+  if (sim->swap) {
+    *stats = sim->swap->stats;
+  } else {
+    *stats = (swap_stats_t){0};
+  }
+}
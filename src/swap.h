@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "memory.h"
+
+// Swap space manager, used when swap clusters are configured. Swap space is
+// split into clusters of `swap_cluster_pages` slots, and pages evicted to
+// disk fill the slots of one cluster after the other, so pages evicted
+// together end up next to each other on disk. Slots are released once their
+// page is back in DRAM, and clusters left empty are reused before new ones.
+//
+// Reading a swapped out page also reads the following used slots of its
+// cluster, up to `swap_readahead_pages` in a single disk operation. The pages
+// read ahead wait in a small swap cache, so faulting them in later needs no
+// disk access.
+typedef struct {
+  uint64_t swap_outs;
+  uint64_t swap_ins;
+  uint64_t readahead_pages;
+  uint64_t readahead_hits;
+} swap_stats_t;
+
+// Sets up the swap space of the current simulation, or resets it.
+void swap_init();
+void swap_free();
+
+struct checkpoint;
+// Saves or restores the swap space of the current simulation.
+void swap_checkpoint(struct checkpoint* checkpoint);
+
+// Returns the disk address of a free slot for a page being swapped out.
+pa_disk_t swap_allocate();
+
+// Reads the page swapped out at `address` back, and releases its slot.
+void swap_in(pa_disk_t address);
+
+void swap_get_stats(swap_stats_t* stats);
@@ -0,0 +1,302 @@
+#include "sweep.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "config.h"
+#include "constants.h"
+#include "log.h"
+#include "simulator.h"
+#include "thread_pool.h"
+#include "trace.h"
+
+// Decoded instruction, in 16 bytes rather than the 24 of an instruction_t.
+typedef struct {
+  va_t address;
+  uint16_t asid;
+  uint8_t core;
+  uint8_t op;
+} sweep_instruction_t;
+
+_Static_assert(MAX_ADDRESS_SPACES <= 1 << 16 && MAX_CORES <= 1 << 8,
+               "Sweep instructions cannot hold every ASID and core");
+
+typedef struct {
+  char* label;
+  config_t config;
+} sweep_config_t;
+
+typedef struct {
+  sweep_instruction_t* instructions;
+  uint64_t total_instructions;
+
+  sweep_config_t* configs;
+  size_t total_configs;
+
+  sim_stats_t* results;
+} sweep_t;
+
+static char* trim(char* text) {
+  while (isspace((unsigned char)*text)) {
+    text++;
+  }
+  char* end = text + strlen(text);
+  while (end > text && isspace((unsigned char)end[-1])) {
+    *--end = '\0';
+  }
+  return text;
+}
+
+static void load_configs(sweep_t* sweep, const config_t* base,
+                         const char* path) {
+  FILE* file = fopen(path, "r");
+  if (!file) {
+    panic("Failed to open sweep file %s", path);
+  }
+
+  size_t capacity = 0;
+  char line[1024];
+  for (int line_number = 1; fgets(line, sizeof(line), file); line_number++) {
+    char* text = trim(line);
+    if (*text == '\0' || *text == '#') {
+      continue;
+    }
+
+    if (sweep->total_configs == capacity) {
+      capacity = capacity ? 2 * capacity : 16;
+      sweep->configs = realloc(sweep->configs, capacity * sizeof(*sweep->configs));
+      if (!sweep->configs) {
+        panic("Failed to allocate sweep configurations");
+      }
+    }
+
+    sweep_config_t* entry = &sweep->configs[sweep->total_configs++];
+    entry->label = strdup(text);
+    entry->config = *base;
+
+    char source[1100];
+    snprintf(source, sizeof(source), "%s:%d", path, line_number);
+    config_parse(&entry->config, text, source);
+    config_finalize(&entry->config);
+  }
+
+  fclose(file);
+
+  if (!sweep->total_configs) {
+    panic("No configuration found in sweep file %s", path);
+  }
+}
+
+static void load_instructions(sweep_t* sweep, const char* path) {
+  trace_t trace;
+  trace_open(&trace, path);
+
+  uint64_t capacity = 1 << 16;
+  sweep->instructions = malloc(capacity * sizeof(sweep_instruction_t));
+
+  instruction_t instruction;
+  while (trace_next(&trace, &instruction)) {
+    if (instruction.core >= MAX_CORES) {
+      panic("Instruction for core %u, but at most %d cores can be simulated",
+            instruction.core, MAX_CORES);
+    }
+    if (instruction.asid >= MAX_ADDRESS_SPACES) {
+      panic("Instruction for ASID %u, but ASIDs are below %u",
+            instruction.asid, MAX_ADDRESS_SPACES);
+    }
+    if (sweep->total_instructions == capacity) {
+      capacity *= 2;
+      sweep->instructions = realloc(sweep->instructions,
+                                    capacity * sizeof(sweep_instruction_t));
+    }
+    if (!sweep->instructions) {
+      panic("Failed to allocate %" PRIu64 " decoded instructions", capacity);
+    }
+    sweep->instructions[sweep->total_instructions++] = (sweep_instruction_t){
+        .address = instruction.address & VIRTUAL_ADDRESS_MASK,
+        .asid = instruction.asid,
+        .core = instruction.core,
+        .op = instruction.op,
+    };
+  }
+
+  trace_close(&trace);
+}
+
+static void simulate_config(size_t index, void* arg) {
+  sweep_t* sweep = arg;
+
+  sim = simulator_create(&sweep->configs[index].config);
+
+  for (uint64_t i = 0; i < sweep->total_instructions; i++) {
+    const sweep_instruction_t* instruction = &sweep->instructions[i];
+    simulator_access(instruction->core, instruction->asid, instruction->op,
+                     instruction->address);
+  }
+  simulator_finish();
+
+  simulator_get_stats(&sweep->results[index]);
+  tlbsim_destroy(sim);
+  sim = NULL;
+}
+
+static void print_csv_label(const char* label) {
+  putchar('"');
+  for (const char* c = label; *c; c++) {
+    if (*c == '"') {
+      putchar('"');
+    }
+    putchar(*c);
+  }
+  putchar('"');
+}
+
+// Columns of the features that are off by default, printed when any
+// configuration of the sweep turns them on, like the lines the report adds.
+// Rows of the configurations without them hold zeros.
+typedef struct {
+  bool disk_seeks;
+  bool swap;
+  bool huge_pages;
+  bool tlb_prefetch;
+  bool write_buffer;
+  bool context_switches;
+  unsigned cache_levels;
+} sweep_columns_t;
+
+static void sweep_columns_init(const sweep_t* sweep,
+                               sweep_columns_t* columns) {
+  memset(columns, 0, sizeof(*columns));
+  for (size_t i = 0; i < sweep->total_configs; i++) {
+    const config_t* config = &sweep->configs[i].config;
+    columns->disk_seeks |= config->disk_model != DISK_MODEL_FLAT;
+    columns->swap |= config->swap_cluster_pages != 0;
+    columns->huge_pages |= config->huge_page_sizes != 0;
+    columns->tlb_prefetch |= config->tlb_prefetcher != TLB_PREFETCH_NONE;
+    columns->write_buffer |= config->write_buffer_entries != 0;
+    columns->context_switches |= sweep->results[i].context_switches != 0;
+    if (config->cache_levels > columns->cache_levels) {
+      columns->cache_levels = config->cache_levels;
+    }
+  }
+}
+
+static void print_csv_header(const sweep_columns_t* columns) {
+  printf("config,elapsed_ns,instructions,page_faults,page_evictions,"
+         "tlb_l1_hits,tlb_l1_hit_rate,tlb_l2_hits,tlb_l2_hit_rate,"
+         "tlb_l1_invalidations,tlb_l2_invalidations,disk_reads,disk_writes,"
+         "tlb_shootdowns");
+  if (columns->disk_seeks) {
+    printf(",disk_seeks");
+  }
+  if (columns->swap) {
+    printf(",swap_outs,swap_ins,swap_readahead_pages,swap_readahead_hits");
+  }
+  if (columns->huge_pages) {
+    printf(",huge_pages_2m,huge_pages_1g,huge_page_promotions,"
+           "huge_page_splits");
+  }
+  if (columns->tlb_prefetch) {
+    printf(",tlb_page_walks,tlb_prefetches,tlb_useful_prefetches,"
+           "tlb_useless_prefetches");
+  }
+  for (cache_level_t level = 0; level < columns->cache_levels; level++) {
+    const char* name = cache_level_name(level);
+    printf(",cache_%s_hits,cache_%s_misses,cache_%s_writebacks,"
+           "cache_%s_mmu_accesses,cache_%s_mmu_hits,cache_%s_mmu_evictions",
+           name, name, name, name, name, name);
+  }
+  if (columns->write_buffer) {
+    printf(",write_buffer_writes,write_buffer_coalesced,"
+           "write_buffer_forwarded,write_buffer_stalls,write_buffer_stall_ns");
+  }
+  if (columns->context_switches) {
+    printf(",address_spaces,context_switches,tlb_flushed_entries");
+  }
+  putchar('\n');
+}
+
+static void print_csv_row(const sweep_columns_t* columns,
+                          const sim_stats_t* stats) {
+  printf(",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+         ",%.2f,%" PRIu64 ",%.2f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+         ",%" PRIu64,
+         stats->elapsed_ns, stats->instructions, stats->page_faults,
+         stats->page_evictions, stats->tlb_l1_hits,
+         hit_rate(stats->tlb_l1_hits, stats->tlb_l1_misses),
+         stats->tlb_l2_hits,
+         hit_rate(stats->tlb_l2_hits, stats->tlb_l2_misses),
+         stats->tlb_l1_invalidations, stats->tlb_l2_invalidations,
+         stats->disk_reads, stats->disk_writes, stats->tlb_shootdowns);
+  if (columns->disk_seeks) {
+    printf(",%" PRIu64, stats->disk_seeks);
+  }
+  if (columns->swap) {
+    printf(",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64, stats->swap_outs,
+           stats->swap_ins, stats->swap_readahead_pages,
+           stats->swap_readahead_hits);
+  }
+  if (columns->huge_pages) {
+    printf(",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+           stats->huge_pages_2m, stats->huge_pages_1g,
+           stats->huge_page_promotions, stats->huge_page_splits);
+  }
+  if (columns->tlb_prefetch) {
+    printf(",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+           stats->tlb_page_walks, stats->tlb_prefetches,
+           stats->tlb_useful_prefetches, stats->tlb_useless_prefetches);
+  }
+  for (cache_level_t level = 0; level < columns->cache_levels; level++) {
+    printf(",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64
+           ",%" PRIu64,
+           stats->cache_hits[level], stats->cache_misses[level],
+           stats->cache_writebacks[level], stats->cache_mmu_accesses[level],
+           stats->cache_mmu_hits[level], stats->cache_mmu_evictions[level]);
+  }
+  if (columns->write_buffer) {
+    printf(",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64,
+           stats->write_buffer_writes, stats->write_buffer_coalesced,
+           stats->write_buffer_forwarded, stats->write_buffer_stalls,
+           stats->write_buffer_stall_ns);
+  }
+  if (columns->context_switches) {
+    printf(",%" PRIu64 ",%" PRIu64 ",%" PRIu64, stats->address_spaces,
+           stats->context_switches, stats->tlb_flushed_entries);
+  }
+  putchar('\n');
+}
+
+void sweep_run(const config_t* base, const char* sweep_path,
+               const char* trace_path, unsigned jobs) {
+  sweep_t sweep = {0};
+  load_configs(&sweep, base, sweep_path);
+  load_instructions(&sweep, trace_path);
+
+  sweep.results = calloc(sweep.total_configs, sizeof(sim_stats_t));
+  if (!sweep.results) {
+    panic("Failed to allocate sweep results");
+  }
+
+  // Only the CSV is printed: per event output of concurrent runs would be
+  // interleaved anyway.
+  log_level = LOG_LEVEL_SUMMARY;
+  thread_pool_run(jobs, sweep.total_configs, simulate_config, &sweep);
+
+  sweep_columns_t columns;
+  sweep_columns_init(&sweep, &columns);
+  print_csv_header(&columns);
+  for (size_t i = 0; i < sweep.total_configs; i++) {
+    print_csv_label(sweep.configs[i].label);
+    print_csv_row(&columns, &sweep.results[i]);
+  }
+
+  free(sweep.results);
+  for (size_t i = 0; i < sweep.total_configs; i++) {
+    free(sweep.configs[i].label);
+  }
+  free(sweep.configs);
+  free(sweep.instructions);
+}
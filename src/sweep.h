@@ -0,0 +1,17 @@
+#pragma once
+
+#include "config.h"
+
+// Simulates every configuration listed in `sweep_path` over the trace at
+// `trace_path`, and prints one CSV row of statistics per configuration.
+//
+// The sweep file holds one configuration per line, as whitespace separated
+// `option=value` pairs using the long command line option names (for example
+// `tlb-l1-size=16 tlb-l2-ways=4 dram-latency=80`). Options that are not given
+// keep their value in `base`. Empty lines and lines starting with '#' are
+// ignored.
+//
+// The trace is decoded once, and the configurations are simulated in parallel
+// on up to `jobs` workers.
+void sweep_run(const config_t* base, const char* sweep_path,
+               const char* trace_path, unsigned jobs);
@@ -0,0 +1,56 @@
+#include "thread_pool.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "log.h"
+
+typedef struct {
+  size_t tasks;
+  size_t next_task;
+  void (*task)(size_t index, void* arg);
+  void* arg;
+} thread_pool_t;
+
+unsigned thread_pool_default_jobs() {
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  return online > 0 ? (unsigned)online : 1;
+}
+
+static void* run_worker(void* arg) {
+  thread_pool_t* pool = arg;
+  for (;;) {
+    size_t index = __atomic_fetch_add(&pool->next_task, 1, __ATOMIC_RELAXED);
+    if (index >= pool->tasks) {
+      return NULL;
+    }
+    pool->task(index, pool->arg);
+  }
+}
+
+void thread_pool_run(unsigned jobs, size_t tasks,
+                     void (*task)(size_t index, void* arg), void* arg) {
+  thread_pool_t pool = {tasks, 0, task, arg};
+
+  if (jobs == 0) {
+    jobs = 1;
+  }
+  if (jobs > tasks) {
+    jobs = tasks;
+  }
+
+  pthread_t* workers = calloc(jobs, sizeof(pthread_t));
+  if (!workers) {
+    panic("Failed to allocate %u workers", jobs);
+  }
+  for (unsigned worker = 0; worker < jobs; worker++) {
+    if (pthread_create(&workers[worker], NULL, run_worker, &pool) != 0) {
+      panic("Failed to start worker %u", worker);
+    }
+  }
+  for (unsigned worker = 0; worker < jobs; worker++) {
+    pthread_join(workers[worker], NULL);
+  }
+  free(workers);
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stddef.h>
+
+// Number of online processors, the default number of workers.
+unsigned thread_pool_default_jobs();
+
+// Runs `task(index, arg)` for every index in [0, tasks), spreading them over
+// up to `jobs` host threads, each taking the next pending index once done
+// with the previous one. Returns once every task is done.
+void thread_pool_run(unsigned jobs, size_t tasks,
+                     void (*task)(size_t index, void* arg), void* arg);
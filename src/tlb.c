@@ -1,254 +1,855 @@
 #include "tlb.h"
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "clock.h"
+#include "config.h"
 #include "constants.h"
 #include "log.h"
 #include "memory.h"
 #include "page_table.h"
+#include "simulator.h"
+#include "tlb_prefetch.h"
+#include "tlb_replacement.h"
+#include "tlb_tags.h"
 
+// Translation held by a TLB entry. Its tag and valid bit are kept apart, so
+// lookups only go through the packed tags
 typedef struct
 {
-  bool valid;
   bool dirty;
-  uint64_t last_access;
-  va_t virtual_page_number;
+  // Filled by the prefetcher, and not used since
+  bool prefetched;
+  // Size of the page. The physical page number is the first frame of the page
+  uint8_t page_size;
   pa_dram_t physical_page_number;
 } tlb_entry_t;
 
-tlb_entry_t tlb_l1[TLB_L1_SIZE];
-tlb_entry_t tlb_l2[TLB_L2_SIZE];
+// A TLB level is an array of `sets * ways` entries, where the entries of set
+// `s` live at indices [s * ways, (s + 1) * ways). A page can only be cached in
+// the set selected by the low bits of its virtual page number.
+typedef struct
+{
+  tlb_entry_t *entries;
+  // Tag of every entry, as made by tlb_tag(). The virtual page number counts
+  // pages of the size of the entry, in the address space of the entry
+  va_t *tags;
+  tlb_tags_match_t match;
+  uint32_t size;
+  uint32_t ways;
+  uint64_t set_mask;
+
+  // One bit per entry, set when the entry is valid, packed in
+  // `words_per_set` words per set. Padding bits are always set.
+  uint64_t *valid_bits;
+  uint32_t words_per_set;
+
+  tlb_replacement_t replacement;
+
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t invalidations;
+
+  // Translations prefetched into this array, and how many of them were used,
+  // or evicted or invalidated before being used
+  uint64_t prefetches;
+  uint64_t useful_prefetches;
+  uint64_t useless_prefetches;
+} tlb_level_t;
+
+// The TLBs of a core. Cores only ever touch their own TLBs: invalidations
+// requested by other cores are queued as shootdowns, and applied by the core
+// itself before its next translation.
+typedef struct
+{
+  tlb_level_t l1;
+  tlb_level_t l2;
+
+  // Huge page arrays, only used when given entries. Hits, misses and
+  // invalidations are counted by l1 and l2
+  tlb_level_t l1_huge;
+  tlb_level_t l2_huge;
+
+  // Prefetched translations, only used when given entries. Otherwise they
+  // are prefetched into L2
+  tlb_level_t prefetch_buffer;
+  tlb_prefetch_t prefetcher;
+
+  // Translations that went all the way to the page table
+  uint64_t page_walks;
+
+  // Address space of the process the core runs, and how many times it
+  // switched to another one. Flushing the TLBs on a switch drops the valid
+  // entries counted by `flushed_entries`
+  asid_t asid;
+  uint64_t context_switches;
+  uint64_t flushed_entries;
+
+  // Pages invalidated by other cores, guarded by shared_memory_lock, as made
+  // by tlb_tag()
+  va_t *pending_shootdowns;
+  uint32_t total_pending_shootdowns;
+  uint32_t pending_shootdowns_capacity;
+
+  uint64_t shootdowns;
+} __attribute__((aligned(64))) tlb_core_t;
+
+// TLB state of a simulation
+struct tlb_state
+{
+  tlb_core_t cores[MAX_CORES];
+  uint32_t total_cores;
+
+  // Guards the state shared by all cores (page table, DRAM frames and pending
+  // shootdowns) when more than one core is simulated, as cores may run on
+  // different host threads
+  pthread_mutex_t shared_memory_lock;
+};
+
+static inline void lock_shared_memory()
+{
+  if (sim->tlb->total_cores > 1)
+    pthread_mutex_lock(&sim->tlb->shared_memory_lock);
+}
+
+static inline void unlock_shared_memory()
+{
+  if (sim->tlb->total_cores > 1)
+    pthread_mutex_unlock(&sim->tlb->shared_memory_lock);
+}
+
+void tlb_get_stats(unsigned core, tlb_stats_t *stats)
+{
+  const tlb_core_t *tlb = &sim->tlb->cores[core];
+  stats->l1_hits = tlb->l1.hits;
+  stats->l1_misses = tlb->l1.misses;
+  stats->l1_invalidations = tlb->l1.invalidations;
+  stats->l2_hits = tlb->l2.hits;
+  stats->l2_misses = tlb->l2.misses;
+  stats->l2_invalidations = tlb->l2.invalidations;
+  stats->shootdowns = tlb->shootdowns;
+  stats->page_walks = tlb->page_walks;
+  stats->context_switches = tlb->context_switches;
+  stats->flushed_entries = tlb->flushed_entries;
+
+  const tlb_level_t *prefetch_arrays[] = {&tlb->l2, &tlb->l2_huge, &tlb->prefetch_buffer};
+  stats->prefetches = stats->useful_prefetches = stats->useless_prefetches = 0;
+  for (int a = 0; a < 3; a++)
+  {
+    stats->prefetches += prefetch_arrays[a]->prefetches;
+    stats->useful_prefetches += prefetch_arrays[a]->useful_prefetches;
+    stats->useless_prefetches += prefetch_arrays[a]->useless_prefetches;
+  }
+}
+
+#define SUM_OVER_CORES(field)                          \
+  uint64_t total = 0;                                  \
+  for (uint32_t c = 0; c < sim->tlb->total_cores; c++) \
+    total += sim->tlb->cores[c].field;                 \
+  return total;
+
+uint64_t get_total_tlb_l1_hits() { SUM_OVER_CORES(l1.hits) }
+uint64_t get_total_tlb_l1_misses() { SUM_OVER_CORES(l1.misses) }
+uint64_t get_total_tlb_l1_invalidations() { SUM_OVER_CORES(l1.invalidations) }
+
+uint64_t get_total_tlb_l2_hits() { SUM_OVER_CORES(l2.hits) }
+uint64_t get_total_tlb_l2_misses() { SUM_OVER_CORES(l2.misses) }
+uint64_t get_total_tlb_l2_invalidations() { SUM_OVER_CORES(l2.invalidations) }
 
-uint64_t tlb_l1_hits = 0;
-uint64_t tlb_l1_misses = 0;
-uint64_t tlb_l1_invalidations = 0;
+uint64_t get_total_tlb_shootdowns() { SUM_OVER_CORES(shootdowns) }
 
-uint64_t tlb_l2_hits = 0;
-uint64_t tlb_l2_misses = 0;
-uint64_t tlb_l2_invalidations = 0;
+static void tlb_level_free(tlb_level_t *level)
+{
+  free(level->entries);
+  free(level->tags);
+  free(level->valid_bits);
+  tlb_replacement_free(&level->replacement);
+}
+
+void tlb_level_init(tlb_level_t *level, const tlb_level_config_t *level_config, uint64_t seed)
+{
+  uint32_t sets = level_config->size / level_config->ways;
 
-uint64_t get_total_tlb_l1_hits() { return tlb_l1_hits; }
-uint64_t get_total_tlb_l1_misses() { return tlb_l1_misses; }
-uint64_t get_total_tlb_l1_invalidations() { return tlb_l1_invalidations; }
+  tlb_level_free(level);
+  memset(level, 0, sizeof(*level));
 
-uint64_t get_total_tlb_l2_hits() { return tlb_l2_hits; }
-uint64_t get_total_tlb_l2_misses() { return tlb_l2_misses; }
-uint64_t get_total_tlb_l2_invalidations() { return tlb_l2_invalidations; }
+  level->size = level_config->size;
+  level->ways = level_config->ways;
+  level->set_mask = sets - 1;
+  level->words_per_set = (level->ways + 63) / 64;
+
+  level->match = tlb_tags_matcher(level->ways);
+
+  level->entries = calloc(level->size, sizeof(tlb_entry_t));
+  level->tags = calloc(level->size, sizeof(va_t));
+  level->valid_bits = calloc((size_t)sets * level->words_per_set, sizeof(uint64_t));
+  if (!level->entries || !level->tags || !level->valid_bits)
+    panic("Failed to allocate %u TLB entries", level->size);
+
+  // Mark the bits past the last way as valid so they are never picked as free
+  if (level->ways % 64)
+  {
+    for (uint32_t set = 0; set < sets; set++)
+      level->valid_bits[(set + 1) * level->words_per_set - 1] = ~0llu << (level->ways % 64);
+  }
+
+  tlb_replacement_init(&level->replacement, level_config->policy, sets, level->ways, seed);
+}
+
+// Sets up an array only used by some configurations, like the huge page
+// arrays of a level, or drops it when it is not used or has no entries
+static void tlb_optional_level_init(tlb_level_t *level, const tlb_level_config_t *level_config, bool used,
+                                    uint64_t seed)
+{
+  if (used && level_config->size)
+    tlb_level_init(level, level_config, seed);
+  else
+  {
+    tlb_level_free(level);
+    memset(level, 0, sizeof(*level));
+  }
+}
 
 void tlb_init()
 {
-  memset(tlb_l1, 0, sizeof(tlb_l1));
-  memset(tlb_l2, 0, sizeof(tlb_l2));
-  tlb_l1_hits = 0;
-  tlb_l1_misses = 0;
-  tlb_l1_invalidations = 0;
-  tlb_l2_hits = 0;
-  tlb_l2_misses = 0;
-  tlb_l2_invalidations = 0;
+  if (!sim->tlb)
+  {
+    sim->tlb = calloc(1, sizeof(struct tlb_state));
+    if (!sim->tlb)
+      panic("Failed to allocate the TLBs");
+    pthread_mutex_init(&sim->tlb->shared_memory_lock, NULL);
+  }
+  sim->tlb->total_cores = sim->config.cores;
+
+  // Every core gets its own random sequence
+  for (uint32_t c = 0; c < sim->tlb->total_cores; c++)
+  {
+    tlb_core_t *tlb = &sim->tlb->cores[c];
+    tlb_level_init(&tlb->l1, &sim->config.tlb_l1, sim->config.seed + 2 * c);
+    tlb_level_init(&tlb->l2, &sim->config.tlb_l2, sim->config.seed + 2 * c + 1);
+    tlb_optional_level_init(&tlb->l1_huge, &sim->config.tlb_l1_huge, sim->config.huge_page_sizes,
+                            sim->config.seed + 2 * (MAX_CORES + c));
+    tlb_optional_level_init(&tlb->l2_huge, &sim->config.tlb_l2_huge, sim->config.huge_page_sizes,
+                            sim->config.seed + 2 * (MAX_CORES + c) + 1);
+    tlb_optional_level_init(&tlb->prefetch_buffer, &sim->config.tlb_prefetch_buffer,
+                            sim->config.tlb_prefetcher != TLB_PREFETCH_NONE, sim->config.seed + 4 * MAX_CORES + c);
+    tlb_prefetch_init(&tlb->prefetcher, sim->config.tlb_prefetcher, sim->config.tlb_prefetch_degree);
+    tlb->total_pending_shootdowns = 0;
+    tlb->shootdowns = 0;
+    tlb->page_walks = 0;
+    tlb->asid = 0;
+    tlb->context_switches = 0;
+    tlb->flushed_entries = 0;
+  }
 }
 
-// Finds empty entry, if not sends signal that L1 is full
-int find_new_tlb_entry(tlb_entry_t *tlb_cache, int tlb_size) {
-  uint64_t min_access = tlb_cache[0].last_access;
-  int lru_index = 0;
+void tlb_free()
+{
+  if (!sim->tlb)
+    return;
 
-  for (int i = 0; i < tlb_size; i++) {
-    // If entry is empty, return index early
-    if (tlb_cache[i].valid == 0) {
-      return i;
-    }
-    // Save least recently used index
-    else if (tlb_cache[i].last_access < min_access)
-    {
-      min_access = tlb_cache[i].last_access;
-      lru_index = i;
-    }
+  for (uint32_t c = 0; c < MAX_CORES; c++)
+  {
+    tlb_level_free(&sim->tlb->cores[c].l1);
+    tlb_level_free(&sim->tlb->cores[c].l2);
+    tlb_level_free(&sim->tlb->cores[c].l1_huge);
+    tlb_level_free(&sim->tlb->cores[c].l2_huge);
+    tlb_level_free(&sim->tlb->cores[c].prefetch_buffer);
+    tlb_prefetch_free(&sim->tlb->cores[c].prefetcher);
+    free(sim->tlb->cores[c].pending_shootdowns);
   }
-  // If cache is full, return least recently used index
-  return lru_index;
+  pthread_mutex_destroy(&sim->tlb->shared_memory_lock);
+  free(sim->tlb);
+  sim->tlb = NULL;
 }
 
-// Write Back Policy for TLB L1 Cache
-void write_back_l1(int l1_index) {
-  int evicted_index = 0;
-  int found = 0;
+static void tlb_level_checkpoint(checkpoint_t *checkpoint, tlb_level_t *level)
+{
+  if (!level->size)
+    return;
 
-  for (int i = 0; i < TLB_L2_SIZE; i++)
+  uint32_t sets = level->size / level->ways;
+  checkpoint_array(checkpoint, level->entries, level->size, sizeof(tlb_entry_t));
+  checkpoint_array(checkpoint, level->tags, level->size, sizeof(va_t));
+  checkpoint_array(checkpoint, level->valid_bits, (size_t)sets * level->words_per_set, sizeof(uint64_t));
+  tlb_replacement_checkpoint(checkpoint, &level->replacement);
+
+  checkpoint_value(checkpoint, level->hits);
+  checkpoint_value(checkpoint, level->misses);
+  checkpoint_value(checkpoint, level->invalidations);
+  checkpoint_value(checkpoint, level->prefetches);
+  checkpoint_value(checkpoint, level->useful_prefetches);
+  checkpoint_value(checkpoint, level->useless_prefetches);
+}
+
+void tlb_checkpoint(checkpoint_t *checkpoint)
+{
+  for (uint32_t c = 0; c < sim->tlb->total_cores; c++)
   {
-    // If page is found:
-    if (tlb_l2[i].valid && (tlb_l2[i].virtual_page_number == tlb_l1[l1_index].virtual_page_number))
-    {
-      evicted_index = i;
-      found = 1;
-      break;
+    tlb_core_t *tlb = &sim->tlb->cores[c];
+    tlb_level_checkpoint(checkpoint, &tlb->l1);
+    tlb_level_checkpoint(checkpoint, &tlb->l2);
+    tlb_level_checkpoint(checkpoint, &tlb->l1_huge);
+    tlb_level_checkpoint(checkpoint, &tlb->l2_huge);
+    tlb_level_checkpoint(checkpoint, &tlb->prefetch_buffer);
+    tlb_prefetch_checkpoint(checkpoint, &tlb->prefetcher);
+
+    // Checkpoints are taken between instructions, when other cores may
+    // still have shootdowns pending for this one
+    checkpoint_value(checkpoint, tlb->total_pending_shootdowns);
+    uint64_t pending = tlb->total_pending_shootdowns;
+    checkpoint_vector(checkpoint, (void **)&tlb->pending_shootdowns, pending, sizeof(va_t));
+    if (checkpoint->restoring)
+      tlb->pending_shootdowns_capacity = tlb->total_pending_shootdowns;
+
+    checkpoint_value(checkpoint, tlb->shootdowns);
+    checkpoint_value(checkpoint, tlb->page_walks);
+    checkpoint_value(checkpoint, tlb->asid);
+    checkpoint_value(checkpoint, tlb->context_switches);
+    checkpoint_value(checkpoint, tlb->flushed_entries);
+  }
+}
+
+static inline uint64_t *tlb_valid_word(const tlb_level_t *level, int index)
+{
+  uint32_t set = index / level->ways;
+  uint32_t way = index % level->ways;
+  return &level->valid_bits[set * level->words_per_set + way / 64];
+}
+
+static inline void tlb_set_valid(tlb_level_t *level, int index, bool valid)
+{
+  uint64_t bit = 1llu << ((index % level->ways) % 64);
+  if (valid)
+    *tlb_valid_word(level, index) |= bit;
+  else
+    *tlb_valid_word(level, index) &= ~bit;
+}
+
+static inline bool tlb_is_valid(const tlb_level_t *level, int index)
+{
+  return *tlb_valid_word(level, index) >> ((index % level->ways) % 64) & 1;
+}
+
+// Virtual page number cached by an entry, in pages of the size of the entry
+static inline va_t tlb_page_number(const tlb_level_t *level, int index)
+{
+  return tlb_tag_page_number(level->tags[index]);
+}
+
+// Stores the translation of the page tagged `tag` in an entry and tells the
+// replacement policy
+static inline void tlb_fill(tlb_level_t *level, int index, va_t tag, pa_dram_t physical_page_number)
+{
+  tlb_entry_t *entry = &level->entries[index];
+  if (tlb_is_valid(level, index) && entry->prefetched)
+    level->useless_prefetches++;
+  entry->prefetched = false;
+  entry->page_size = tlb_tag_page_size(tag);
+  entry->physical_page_number = physical_page_number;
+  level->tags[index] = tag;
+  tlb_set_valid(level, index, true);
+  tlb_replacement_fill(&level->replacement, index);
+}
+
+// Returns the index of the valid entry caching the page tagged `tag`, or -1.
+// The tags of the set are compared 64 at a time, against the valid entries
+// only
+static inline int tlb_lookup(const tlb_level_t *level, va_t tag)
+{
+  uint32_t set = tlb_tag_page_number(tag) & level->set_mask;
+  const va_t *tags = &level->tags[set * level->ways];
+  const uint64_t *valid_bits = &level->valid_bits[set * level->words_per_set];
+
+  for (uint32_t word = 0; word < level->words_per_set; word++)
+  {
+    uint32_t first = word * 64;
+    uint32_t count = level->ways - first < 64 ? level->ways - first : 64;
+    uint64_t matches = level->match(&tags[first], count, tag, valid_bits[word]);
+    if (matches)
+      return (int)(set * level->ways + first + __builtin_ctzll(matches));
+  }
+  return -1;
+}
+
+// Array of a level caching the pages of a size
+static inline tlb_level_t *tlb_array(tlb_level_t *level, tlb_level_t *huge_level, page_size_t page_size)
+{
+  return page_size != PAGE_SIZE_4K && huge_level->size ? huge_level : level;
+}
+
+// Looks for a 4 KiB page of an address space, then for every huge page size in
+// use, in the arrays of a level. Returns the index of the entry, and sets
+// `array` to the array holding it, or returns -1
+static inline int tlb_lookup_any_size(tlb_level_t *level, tlb_level_t *huge_level, asid_t asid,
+                                      va_t virtual_page_number, tlb_level_t **array)
+{
+  *array = level;
+  int i = tlb_lookup(level, tlb_tag(asid, virtual_page_number, PAGE_SIZE_4K));
+  if (i >= 0 || !sim->config.huge_page_sizes)
+    return i;
+
+  for (int size = PAGE_SIZE_2M; size < PAGE_SIZES; size++)
+  {
+    if (!(sim->config.huge_page_sizes & (1u << size)))
+      continue;
+    *array = tlb_array(level, huge_level, size);
+    i = tlb_lookup(*array, tlb_tag(asid, virtual_page_number >> (size * PAGE_TABLE_INDEX_BITS), size));
+    if (i >= 0)
+      return i;
+  }
+  return -1;
+}
+
+// Physical address of a virtual address, through the entry caching its page
+static inline pa_dram_t tlb_entry_translate(const tlb_entry_t *entry, va_t virtual_address)
+{
+  va_t page_offset_mask = (1llu << PAGE_SIZE_BITS_OF(entry->page_size)) - 1;
+  return (entry->physical_page_number << PAGE_SIZE_BITS) + (virtual_address & page_offset_mask);
+}
+
+// Finds the first empty entry in the set the page maps to, if not asks the
+// replacement policy for a victim in that set
+int find_new_tlb_entry(tlb_level_t *level, va_t virtual_page_number) {
+  uint32_t set = virtual_page_number & level->set_mask;
+  const uint64_t *valid_bits = &level->valid_bits[set * level->words_per_set];
+
+  for (uint32_t word = 0; word < level->words_per_set; word++) {
+    // If there is an empty entry, return its index early
+    if (~valid_bits[word]) {
+      uint32_t way = word * 64 + __builtin_ctzll(~valid_bits[word]);
+      return (int)(set * level->ways + way);
     }
   }
+  // If set is full, return the victim chosen by the policy
+  return (int)tlb_replacement_victim(&level->replacement, set);
+}
+
+// Write Back Policy for TLB L1 Cache
+void write_back_l1(tlb_core_t *tlb, tlb_level_t *l1, int l1_index) {
+  tlb_entry_t *evicted = &l1->entries[l1_index];
+  va_t evicted_tag = l1->tags[l1_index];
+  tlb_level_t *l2 = tlb_array(&tlb->l2, &tlb->l2_huge, evicted->page_size);
+
+  // Reuse the L2 entry if the page is already there
+  int evicted_index = tlb_lookup(l2, evicted_tag);
 
   // If page is not found
-  if (!found) evicted_index = find_new_tlb_entry(tlb_l2, TLB_L2_SIZE);
-  
-  tlb_l2[evicted_index].virtual_page_number = tlb_l1[l1_index].virtual_page_number;
-  tlb_l2[evicted_index].physical_page_number = tlb_l1[l1_index].physical_page_number;
-  tlb_l2[evicted_index].last_access = get_time();
-  tlb_l2[evicted_index].valid = true;
-  tlb_l2[evicted_index].dirty = true;
+  if (evicted_index < 0) evicted_index = find_new_tlb_entry(l2, tlb_tag_page_number(evicted_tag));
+
+  tlb_fill(l2, evicted_index, evicted_tag, evicted->physical_page_number);
+  l2->entries[evicted_index].dirty = true;
+}
+
+// Drops the entry caching the page tagged `tag`, if any. Returns whether there
+// was one
+static bool tlb_invalidate_array(tlb_level_t *array, va_t tag)
+{
+  int i = tlb_lookup(array, tag);
+  if (i < 0)
+    return false;
+
+  if (array->entries[i].prefetched)
+    array->useless_prefetches++;
+  tlb_set_valid(array, i, false);
+  array->entries[i].dirty = false;
+  array->entries[i].prefetched = false;
+  return true;
 }
 
-void tlb_invalidate(va_t virtual_page_number)
+static bool tlb_invalidate_level(tlb_level_t *level, tlb_level_t *huge_level, va_t tag)
 {
+  if (!tlb_invalidate_array(tlb_array(level, huge_level, tlb_tag_page_size(tag)), tag))
+    return false;
+
+  level->invalidations++;
+  return true;
+}
+
+static void tlb_invalidate_page(asid_t asid, va_t virtual_page_number, page_size_t page_size)
+{
+  uint32_t core = get_core();
+  tlb_core_t *tlb = &sim->tlb->cores[core];
+  va_t tag = tlb_tag(asid, virtual_page_number, page_size);
+
   // Checks for invalid entry in TLB L1 cache
-  for (int i = 0; i < TLB_L1_SIZE; i++)
+  tlb_invalidate_level(&tlb->l1, &tlb->l1_huge, tag);
+  increment_time(sim->config.tlb_l1_latency_ns);
+
+  // Checks for invalid entry in TLB L2 cache
+  tlb_invalidate_level(&tlb->l2, &tlb->l2_huge, tag);
+  increment_time(sim->config.tlb_l2_latency_ns);
+
+  // Looked up along with L2
+  if (tlb->prefetch_buffer.size)
+    tlb_invalidate_array(&tlb->prefetch_buffer, tag);
+
+  // Sends a shootdown to every other core. This runs with the shared memory
+  // locked, as pages are only evicted on a page fault
+  for (uint32_t c = 0; c < sim->tlb->total_cores; c++)
   {
-    if (tlb_l1[i].valid && tlb_l1[i].virtual_page_number == virtual_page_number)
+    if (c == core)
+      continue;
+
+    tlb_core_t *remote = &sim->tlb->cores[c];
+    if (remote->total_pending_shootdowns == remote->pending_shootdowns_capacity)
     {
-      tlb_l1[i].valid = false;
-      tlb_l1[i].dirty = false;
-      tlb_l1_invalidations++;
-      break;
+      remote->pending_shootdowns_capacity = remote->pending_shootdowns_capacity ? 2 * remote->pending_shootdowns_capacity : 64;
+      remote->pending_shootdowns = realloc(remote->pending_shootdowns, remote->pending_shootdowns_capacity * sizeof(va_t));
+      if (!remote->pending_shootdowns)
+        panic("Failed to allocate TLB shootdowns");
     }
+    remote->pending_shootdowns[remote->total_pending_shootdowns] = tag;
+    __atomic_store_n(&remote->total_pending_shootdowns, remote->total_pending_shootdowns + 1, __ATOMIC_RELEASE);
   }
-  increment_time(TLB_L1_LATENCY_NS);
+}
 
-  // Checks for invalid entry in TLB L2 cache
-  for (int i = 0; i < TLB_L2_SIZE; i++)
+void tlb_invalidate(asid_t asid, va_t virtual_page_number)
+{
+  tlb_invalidate_page(asid, virtual_page_number, PAGE_SIZE_4K);
+}
+
+void tlb_invalidate_huge_page(asid_t asid, va_t virtual_page_number, page_size_t page_size)
+{
+  tlb_invalidate_page(asid, virtual_page_number, page_size);
+}
+
+void tlb_apply_shootdowns()
+{
+  tlb_core_t *tlb = &sim->tlb->cores[get_core()];
+  if (!__atomic_load_n(&tlb->total_pending_shootdowns, __ATOMIC_ACQUIRE))
+    return;
+
+  lock_shared_memory();
+  for (uint32_t i = 0; i < tlb->total_pending_shootdowns; i++)
   {
-    if (tlb_l2[i].valid && tlb_l2[i].virtual_page_number == virtual_page_number)
+    va_t tag = tlb->pending_shootdowns[i];
+
+    // Only the cores caching the page pay for the shootdown
+    bool in_l1 = tlb_invalidate_level(&tlb->l1, &tlb->l1_huge, tag);
+    bool in_l2 = tlb_invalidate_level(&tlb->l2, &tlb->l2_huge, tag);
+    if (tlb->prefetch_buffer.size)
+      tlb_invalidate_array(&tlb->prefetch_buffer, tag);
+    if (in_l1 || in_l2)
     {
-      tlb_l2[i].valid = false;
-      tlb_l2[i].dirty = false;
-      tlb_l2_invalidations++;
-      break;
+      log_dbg("***** TLB shootdown of VPN=%" PRIx64 " *****", tlb_tag_page_number(tag));
+      tlb->shootdowns++;
+      increment_time(sim->config.shootdown_latency_ns);
     }
   }
-  increment_time(TLB_L2_LATENCY_NS);
+  tlb->total_pending_shootdowns = 0;
+  unlock_shared_memory();
 }
 
-pa_dram_t tlb_translate(va_t virtual_address, op_t op)
+// Drops every entry of an array, as a TLB without ASIDs does on a context
+// switch. Dirty entries are written back first
+static void tlb_flush_array(tlb_core_t *tlb, tlb_level_t *array)
+{
+  for (int i = 0; i < (int)array->size; i++)
+  {
+    if (!tlb_is_valid(array, i))
+      continue;
+    if (array->entries[i].dirty)
+      write_back_tlb_entry(array->entries[i].physical_page_number << PAGE_SIZE_BITS);
+    if (array->entries[i].prefetched)
+      array->useless_prefetches++;
+    tlb_set_valid(array, i, false);
+    array->entries[i].dirty = false;
+    array->entries[i].prefetched = false;
+    tlb->flushed_entries++;
+  }
+}
+
+void tlb_context_switch(asid_t asid)
+{
+  tlb_core_t *tlb = &sim->tlb->cores[get_core()];
+  log_dbg("***** Context switch to ASID %u *****", asid);
+  tlb->asid = asid;
+  tlb->context_switches++;
+  if (sim->config.context_switch != CONTEXT_SWITCH_FLUSH)
+    return;
+
+  tlb_flush_array(tlb, &tlb->l1);
+  tlb_flush_array(tlb, &tlb->l2);
+  tlb_flush_array(tlb, &tlb->l1_huge);
+  tlb_flush_array(tlb, &tlb->l2_huge);
+  tlb_flush_array(tlb, &tlb->prefetch_buffer);
+
+  // The page walk cache has no ASIDs either
+  lock_shared_memory();
+  page_table_flush_walk_cache();
+  unlock_shared_memory();
+}
+
+asid_t tlb_current_asid()
+{
+  return sim->tlb->cores[get_core()].asid;
+}
+
+// Picks the entry of an L1 array that will hold the page, writing back its
+// current content to L2 if needed
+static int make_room_in_l1(tlb_core_t *tlb, tlb_level_t *l1, va_t virtual_page_number)
+{
+  int new_l1_index = find_new_tlb_entry(l1, virtual_page_number);
+  tlb_entry_t *victim = &l1->entries[new_l1_index];
+  bool valid = tlb_is_valid(l1, new_l1_index);
+
+  log_dbg("Evicting TLB L1 entry i=%d VPN=%" PRIx64 " PPN=%" PRIx64 " valid=%d dirty=%d...",
+    new_l1_index, tlb_page_number(l1, new_l1_index),
+    victim->physical_page_number,
+    valid, victim->dirty
+  );
+
+  // Write Back Policy from L1 to L2
+  if (valid && victim->dirty) {
+    log_dbg("***** TLB L1 write back to L2 *****");
+    write_back_l1(tlb, l1, new_l1_index);
+  }
+
+  return new_l1_index;
+}
+
+// Huge pages are cached by their number, and their first frame
+static inline void tlb_page_of(va_t virtual_page_number, pa_dram_t frame, page_size_t page_size,
+                               va_t *page_number, pa_dram_t *first_frame)
+{
+  int page_size_shift = page_size * PAGE_TABLE_INDEX_BITS;
+  *page_number = virtual_page_number >> page_size_shift;
+  *first_frame = (frame - (virtual_page_number & ((1llu << page_size_shift) - 1))) & PAGE_INDEX_MASK;
+}
+
+// Stores a translation in the entry of an L2 array picked by
+// find_new_tlb_entry(), writing back its current content if needed
+static int tlb_fill_l2(tlb_level_t *l2, va_t tag, pa_dram_t physical_page_number)
+{
+  int new_l2_index = find_new_tlb_entry(l2, tlb_tag_page_number(tag));
+  tlb_entry_t *entry = &l2->entries[new_l2_index];
+  bool valid = tlb_is_valid(l2, new_l2_index);
+
+  log_dbg("Evicting TLB L2 entry i=%d VPN=%" PRIx64 " PPN=%" PRIx64 " valid=%d dirty=%d...",
+      new_l2_index, tlb_page_number(l2, new_l2_index),
+      entry->physical_page_number,
+      valid, entry->dirty
+  );
+
+  // Write Back Policy
+  if (valid && entry->dirty) {
+    log_dbg("***** TLB L2 write back *****");
+    pa_dram_t evicted_address = (entry->physical_page_number << PAGE_SIZE_BITS);
+    write_back_tlb_entry(evicted_address);
+  }
+
+  tlb_fill(l2, new_l2_index, tag, physical_page_number);
+  return new_l2_index;
+}
+
+// Prefetches the translation of a page, unless it is already cached or the
+// page is not resident. The page table is looked up off the critical path, so
+// only the write back of a dirty L2 victim is timed
+static void tlb_prefetch_page(tlb_core_t *tlb, va_t virtual_page_number)
+{
+  tlb_level_t *array;
+  if (tlb_lookup_any_size(&tlb->l1, &tlb->l1_huge, tlb->asid, virtual_page_number, &array) >= 0 ||
+      tlb_lookup_any_size(&tlb->l2, &tlb->l2_huge, tlb->asid, virtual_page_number, &array) >= 0 ||
+      (tlb->prefetch_buffer.size &&
+       tlb_lookup_any_size(&tlb->prefetch_buffer, &tlb->prefetch_buffer, tlb->asid, virtual_page_number,
+                           &array) >= 0))
+    return;
+
+  pa_dram_t frame;
+  page_size_t page_size;
+  if (!page_table_probe(tlb->asid, virtual_page_number, &frame, &page_size))
+    return;
+
+  va_t page_number;
+  pa_dram_t physical_page_number;
+  tlb_page_of(virtual_page_number, frame, page_size, &page_number, &physical_page_number);
+  va_t tag = tlb_tag(tlb->asid, page_number, page_size);
+  log_dbg("TLB prefetch VPN=%" PRIx64 " PPN=%" PRIx64, virtual_page_number, frame);
+
+  int i;
+  if (tlb->prefetch_buffer.size)
+  {
+    array = &tlb->prefetch_buffer;
+    i = find_new_tlb_entry(array, page_number);
+    tlb_fill(array, i, tag, physical_page_number);
+  }
+  else
+  {
+    array = tlb_array(&tlb->l2, &tlb->l2_huge, page_size);
+    i = tlb_fill_l2(array, tag, physical_page_number);
+  }
+  array->entries[i].dirty = false;
+  array->entries[i].prefetched = true;
+  array->prefetches++;
+}
+
+// Trains the prefetcher on a page and prefetches the pages it predicts. Done
+// on L2 misses, and on the first use of a prefetched translation so streams
+// the prefetcher keeps ahead of still train it
+static void tlb_prefetch(tlb_core_t *tlb, va_t virtual_page_number)
+{
+  va_t predictions[TLB_PREFETCH_MAX_DEGREE];
+  uint32_t count = tlb_prefetch_predict(&tlb->prefetcher, virtual_page_number, predictions);
+  if (!count)
+    return;
+
+  lock_shared_memory();
+  for (uint32_t p = 0; p < count; p++)
+    tlb_prefetch_page(tlb, predictions[p]);
+  unlock_shared_memory();
+}
+
+// Translation shared by the timed path and the functional warming of
+// sampling, which only keeps the content of the TLBs current: `detailed`
+// is a constant in both callers, so each one gets its own copy without the
+// counters and latencies it does not need
+static inline __attribute__((always_inline)) pa_dram_t translate(va_t virtual_address, op_t op, bool detailed)
 {
-  va_t virtual_page_offset = virtual_address & PAGE_OFFSET_MASK;
   va_t virtual_page_number = (virtual_address >> PAGE_SIZE_BITS) & PAGE_INDEX_MASK;
   pa_dram_t translated_address;
-  int new_l1_index = 0;
-  int new_l2_index = 0;
+  tlb_entry_t *entry;
+  tlb_level_t *array;
+
+  tlb_apply_shootdowns();
+  tlb_core_t *tlb = &sim->tlb->cores[get_core()];
 
   // Searches for entry in TLB L1 cache
-  for (int i = 0; i < TLB_L1_SIZE; i++)
+  int i = tlb_lookup_any_size(&tlb->l1, &tlb->l1_huge, tlb->asid, virtual_page_number, &array);
+  if (i >= 0)
   {
-    // If page is found:
-    if (tlb_l1[i].valid && (tlb_l1[i].virtual_page_number == virtual_page_number))
-    {
-      tlb_l1_hits++;
-      tlb_l1[i].last_access = get_time();
-      if (op == OP_WRITE)
-        tlb_l1[i].dirty = true;
+    entry = &array->entries[i];
+    if (detailed)
+      tlb->l1.hits++;
+    tlb_replacement_touch(&array->replacement, i);
+    if (op == OP_WRITE)
+      entry->dirty = true;
 
-      // Translate virtual address 
-      translated_address = (tlb_l1[i].physical_page_number << PAGE_SIZE_BITS) | virtual_page_offset;
-      increment_time(TLB_L1_LATENCY_NS);
+    // Translate virtual address
+    translated_address = tlb_entry_translate(entry, virtual_address);
+    if (detailed)
+      increment_time(sim->config.tlb_l1_latency_ns);
 
-      return translated_address;
-    }
+    return translated_address;
+  }
+  if (detailed)
+  {
+    tlb->l1.misses++;
+    increment_time(sim->config.tlb_l1_latency_ns);
   }
-  tlb_l1_misses++;
-  increment_time(TLB_L1_LATENCY_NS);
 
   // Searches for entry in TLB L2 cache
-  for (int i = 0; i < TLB_L2_SIZE; i++)
+  i = tlb_lookup_any_size(&tlb->l2, &tlb->l2_huge, tlb->asid, virtual_page_number, &array);
+  if (i >= 0)
   {
-    // If page is found:
-    if (tlb_l2[i].valid && (tlb_l2[i].virtual_page_number == virtual_page_number))
+    tlb_entry_t *l2_entry = &array->entries[i];
+    if (detailed)
+      tlb->l2.hits++;
+    tlb_replacement_touch(&array->replacement, i);
+    if (op == OP_WRITE)
+      l2_entry->dirty = true;
+
+    bool prefetched = l2_entry->prefetched;
+    if (prefetched)
     {
-      tlb_l2_hits++;
-      tlb_l2[i].last_access = get_time();
-      if (op == OP_WRITE)
-        tlb_l2[i].dirty = true;
-      
-      // Update TLB L1 if the entry was found in TLB L2
-      
-      // Finds new index in TLB L1
-      new_l1_index = find_new_tlb_entry(tlb_l1, TLB_L1_SIZE);
-
-      log_dbg("Evicting TLB L1 entry i=%d VPN=%" PRIx64 " PPN=%" PRIx64 " valid=%d dirty=%d...",
-        new_l1_index, tlb_l1[new_l1_index].virtual_page_number, 
-        tlb_l1[new_l1_index].physical_page_number, 
-        tlb_l1[new_l1_index].valid, tlb_l1[new_l1_index].dirty
-      );
-
-      // Write Back Policy from L1 to L2
-      if (tlb_l1[new_l1_index].valid && tlb_l1[new_l1_index].dirty) {
-        log_dbg("***** TLB L1 write back to L2 *****");
-        write_back_l1(new_l1_index);
-      }
-
-      tlb_l1[new_l1_index].virtual_page_number = tlb_l2[i].virtual_page_number;
-      tlb_l1[new_l1_index].physical_page_number = tlb_l2[i].physical_page_number;
-      tlb_l1[new_l1_index].last_access = get_time();
-      tlb_l1[new_l1_index].valid = true;
-      if (op == OP_WRITE) 
-        tlb_l1[new_l1_index].dirty = true;
-      
-      // Translate virtual address 
-      translated_address = (tlb_l2[i].physical_page_number << PAGE_SIZE_BITS) | virtual_page_offset;
-      increment_time(TLB_L2_LATENCY_NS);
-
-      return translated_address;
+      if (detailed)
+        array->useful_prefetches++;
+      l2_entry->prefetched = false;
     }
-  }
-  tlb_l2_misses++;
-  increment_time(TLB_L2_LATENCY_NS);
-  
-  // Translates virtual address to physical address
-  translated_address = page_table_translate(virtual_address, op);
-  va_t physical_page_number = (translated_address >> PAGE_SIZE_BITS) & PAGE_INDEX_MASK;
 
-  // Update TLB L2 with the new entry
+    // The L1 write back may reuse this very L2 entry when both pages map to
+    // the same set, so keep the translation around
+    tlb_entry_t translation = *l2_entry;
+    va_t tag = array->tags[i];
 
-  // Finds new index in TLB L2
-  new_l2_index = find_new_tlb_entry(tlb_l2, TLB_L2_SIZE);
-   
-  log_dbg("Evicting TLB L2 entry i=%d VPN=%" PRIx64 " PPN=%" PRIx64 " valid=%d dirty=%d...",
-      new_l2_index, tlb_l2[new_l2_index].virtual_page_number, 
-      tlb_l2[new_l2_index].physical_page_number, 
-      tlb_l2[new_l2_index].valid, tlb_l2[new_l2_index].dirty
-  );
-  
-  // Write Back Policy
-  if (tlb_l2[new_l2_index].valid && tlb_l2[new_l2_index].dirty) {
-    log_dbg("***** TLB L2 write back *****");
-    pa_dram_t evicted_address = (tlb_l2[new_l2_index].physical_page_number << PAGE_SIZE_BITS);
-    write_back_tlb_entry(evicted_address);
+    // Update TLB L1 if the entry was found in TLB L2
+    tlb_level_t *l1 = tlb_array(&tlb->l1, &tlb->l1_huge, translation.page_size);
+    int new_l1_index = make_room_in_l1(tlb, l1, tlb_tag_page_number(tag));
+    tlb_fill(l1, new_l1_index, tag, translation.physical_page_number);
+    entry = &l1->entries[new_l1_index];
+    if (op == OP_WRITE)
+      entry->dirty = true;
+
+    // Translate virtual address
+    translated_address = tlb_entry_translate(&translation, virtual_address);
+    if (detailed)
+      increment_time(sim->config.tlb_l2_latency_ns);
+
+    if (prefetched)
+      tlb_prefetch(tlb, virtual_page_number);
+
+    return translated_address;
+  }
+  if (detailed)
+  {
+    tlb->l2.misses++;
+    increment_time(sim->config.tlb_l2_latency_ns);
   }
-  
-  tlb_l2[new_l2_index].virtual_page_number = virtual_page_number;
-  tlb_l2[new_l2_index].physical_page_number = physical_page_number;
-  tlb_l2[new_l2_index].last_access = get_time();
-  tlb_l2[new_l2_index].valid = true;
-  tlb_l2[new_l2_index].dirty = (op == OP_WRITE);
-  
 
-  // Update TLB L1 with the new entry
-  // Finds new index in TLB L1
-  new_l1_index = find_new_tlb_entry(tlb_l1, TLB_L1_SIZE);
-  log_dbg("Evicting TLB L1 entry i=%d VPN=%" PRIx64 " PPN=%" PRIx64 " valid=%d dirty=%d...",
-        new_l1_index, tlb_l1[new_l1_index].virtual_page_number, 
-        tlb_l1[new_l1_index].physical_page_number, 
-        tlb_l1[new_l1_index].valid, tlb_l1[new_l1_index].dirty
-    );
+  page_size_t page_size;
+  va_t page_number;
+  pa_dram_t physical_page_number;
 
-  // Write Back Policy from L1 to L2
-  if (tlb_l1[new_l1_index].valid && tlb_l1[new_l1_index].dirty) {
-    log_dbg("***** TLB L1 write back to L2 *****");
-    write_back_l1(new_l1_index);
+  // The prefetch buffer is searched along with L2, and its translations move
+  // to L2 and L1 on their first use
+  i = tlb->prefetch_buffer.size
+          ? tlb_lookup_any_size(&tlb->prefetch_buffer, &tlb->prefetch_buffer, tlb->asid, virtual_page_number,
+                                &array)
+          : -1;
+  if (i >= 0)
+  {
+    entry = &array->entries[i];
+    page_size = entry->page_size;
+    page_number = tlb_page_number(array, i);
+    physical_page_number = entry->physical_page_number;
+    translated_address = tlb_entry_translate(entry, virtual_address);
+
+    if (detailed)
+      array->useful_prefetches++;
+    entry->prefetched = false;
+    tlb_set_valid(array, i, false);
   }
+  else
+  {
+    // Translates virtual address to physical address
+    if (detailed)
+      tlb->page_walks++;
+    lock_shared_memory();
+    translated_address = page_table_translate(tlb->asid, virtual_address, op, &page_size);
+    unlock_shared_memory();
+
+    tlb_page_of(virtual_page_number, translated_address >> PAGE_SIZE_BITS, page_size, &page_number,
+                &physical_page_number);
+  }
+
+  // Update TLB L2 with the new entry
+  va_t tag = tlb_tag(tlb->asid, page_number, page_size);
+  tlb_level_t *l2 = tlb_array(&tlb->l2, &tlb->l2_huge, page_size);
+  int new_l2_index = tlb_fill_l2(l2, tag, physical_page_number);
+  l2->entries[new_l2_index].dirty = (op == OP_WRITE);
+
+  // Update TLB L1 with the new entry
+  tlb_level_t *l1 = tlb_array(&tlb->l1, &tlb->l1_huge, page_size);
+  int new_l1_index = make_room_in_l1(tlb, l1, page_number);
+  tlb_fill(l1, new_l1_index, tag, physical_page_number);
+  l1->entries[new_l1_index].dirty = (op == OP_WRITE);
 
-  tlb_l1[new_l1_index].virtual_page_number = virtual_page_number;
-  tlb_l1[new_l1_index].physical_page_number = physical_page_number;
-  tlb_l1[new_l1_index].last_access = get_time();
-  tlb_l1[new_l1_index].valid = true;
-  tlb_l1[new_l1_index].dirty = (op == OP_WRITE);
+  if (sim->config.tlb_prefetcher != TLB_PREFETCH_NONE)
+    tlb_prefetch(tlb, virtual_page_number);
 
   return translated_address;
 }
+
+pa_dram_t tlb_translate(va_t virtual_address, op_t op)
+{
+  return translate(virtual_address, op, true);
+}
+
+pa_dram_t tlb_warm(va_t virtual_address, op_t op)
+{
+  return translate(virtual_address, op, false);
+}
@@ -4,15 +4,65 @@
 
 #include "memory.h"
 
+// Sets up the TLBs of the current simulation, or resets them.
 void tlb_init();
+void tlb_free();
+
+struct checkpoint;
+// Saves or restores the TLBs of the current simulation.
+void tlb_checkpoint(struct checkpoint* checkpoint);
 
 // TLB translation function.
 // Can also update the content of the TLB.
 pa_dram_t tlb_translate(va_t virtual_address, op_t op);
 
+// Same translation, for the functional warming of sampling: the content of
+// the TLBs is updated, but nothing is counted nor timed.
+pa_dram_t tlb_warm(va_t virtual_address, op_t op);
+
 // Invalidate entries on the TLB.
 // This can happen if a page is swapped out of memory and into the disk.
-void tlb_invalidate(va_t virtual_page_number);
+// The TLBs of the other cores are sent a shootdown for the page.
+void tlb_invalidate(asid_t asid, va_t virtual_page_number);
+
+// Same for a huge page, numbered in pages of its size.
+void tlb_invalidate_huge_page(asid_t asid, va_t virtual_page_number, page_size_t page_size);
+
+// Switches the current core to the address space of another process. Entries
+// of other address spaces are kept, unless the TLBs are flushed on context
+// switches.
+void tlb_context_switch(asid_t asid);
+
+// Address space the current core runs.
+asid_t tlb_current_asid();
+
+// Applies the shootdowns sent to the current core by other cores. Done before
+// every translation, so only needed to settle them at the end of a run.
+void tlb_apply_shootdowns();
+
+// Statistics of the TLBs of a single core.
+typedef struct {
+  uint64_t l1_hits;
+  uint64_t l1_misses;
+  uint64_t l1_invalidations;
+  uint64_t l2_hits;
+  uint64_t l2_misses;
+  uint64_t l2_invalidations;
+  // Shootdowns received for a page this core was caching.
+  uint64_t shootdowns;
+  // Translations that missed every TLB level and walked the page table.
+  uint64_t page_walks;
+  // Translations prefetched, and how many of them were used before being
+  // evicted or invalidated, or not.
+  uint64_t prefetches;
+  uint64_t useful_prefetches;
+  uint64_t useless_prefetches;
+  // Switches to another address space, and valid entries flushed by them.
+  uint64_t context_switches;
+  uint64_t flushed_entries;
+} tlb_stats_t;
+
+void tlb_get_stats(unsigned core, tlb_stats_t* stats);
 
 uint64_t get_total_tlb_l1_hits();
 uint64_t get_total_tlb_l1_misses();
@@ -21,3 +71,5 @@ uint64_t get_total_tlb_l1_invalidations();
 uint64_t get_total_tlb_l2_hits();
 uint64_t get_total_tlb_l2_misses();
 uint64_t get_total_tlb_l2_invalidations();
+
+uint64_t get_total_tlb_shootdowns();
@@ -0,0 +1,146 @@
+#include "tlb_prefetch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "constants.h"
+#include "log.h"
+
+static const char* prefetcher_names[] = {
+    [TLB_PREFETCH_NONE] = "none",
+    [TLB_PREFETCH_NEXT] = "next",
+    [TLB_PREFETCH_STRIDE] = "stride",
+    [TLB_PREFETCH_DISTANCE] = "distance",
+};
+
+const char* tlb_prefetcher_name(tlb_prefetcher_t prefetcher) {
+  return prefetcher_names[prefetcher];
+}
+
+bool tlb_prefetcher_parse(const char* name, tlb_prefetcher_t* prefetcher) {
+  for (size_t i = 0; i < sizeof(prefetcher_names) / sizeof(prefetcher_names[0]);
+       i++) {
+    if (strcmp(name, prefetcher_names[i]) == 0) {
+      *prefetcher = (tlb_prefetcher_t)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+void tlb_prefetch_init(tlb_prefetch_t* prefetch, tlb_prefetcher_t prefetcher,
+                       uint32_t degree) {
+  tlb_prefetch_free(prefetch);
+  memset(prefetch, 0, sizeof(*prefetch));
+  prefetch->prefetcher = prefetcher;
+  prefetch->degree = degree;
+
+  if (prefetcher == TLB_PREFETCH_DISTANCE) {
+    prefetch->distances = calloc(TLB_PREFETCH_DISTANCE_TABLE_SIZE,
+                                 sizeof(tlb_prefetch_distance_t));
+    if (!prefetch->distances) {
+      panic("Failed to allocate the TLB prefetcher distance table");
+    }
+  }
+}
+
+void tlb_prefetch_free(tlb_prefetch_t* prefetch) {
+  free(prefetch->distances);
+  prefetch->distances = NULL;
+}
+
+static inline tlb_prefetch_distance_t* distance_entry(tlb_prefetch_t* prefetch,
+                                                      int64_t distance) {
+  return &prefetch->distances[(uint64_t)distance &
+                              (TLB_PREFETCH_DISTANCE_TABLE_SIZE - 1)];
+}
+
+// Records that `next` followed `distance`, as its most recent successor.
+static void distance_record(tlb_prefetch_t* prefetch, int64_t distance,
+                            int64_t next) {
+  tlb_prefetch_distance_t* entry = distance_entry(prefetch, distance);
+  if (entry->distance != distance) {
+    memset(entry, 0, sizeof(*entry));
+    entry->distance = distance;
+  }
+
+  int slot = 0;
+  while (slot < TLB_PREFETCH_DISTANCE_SLOTS - 1 && entry->next[slot] &&
+         entry->next[slot] != next) {
+    slot++;
+  }
+  memmove(&entry->next[1], &entry->next[0], slot * sizeof(entry->next[0]));
+  entry->next[0] = next;
+}
+
+// Adds the page at `distance` from the missed one, if it is a valid page.
+static inline void predict(va_t virtual_page_number, int64_t distance,
+                           va_t* predictions, uint32_t* count) {
+  va_t page = virtual_page_number + (va_t)distance;
+  if (distance && page < TOTAL_PAGES) {
+    predictions[(*count)++] = page;
+  }
+}
+
+uint32_t tlb_prefetch_predict(tlb_prefetch_t* prefetch,
+                              va_t virtual_page_number, va_t* predictions) {
+  int64_t distance =
+      (int64_t)(virtual_page_number - prefetch->last_page_number);
+  bool trained = prefetch->trained && distance;
+  uint32_t count = 0;
+
+  switch (prefetch->prefetcher) {
+    case TLB_PREFETCH_NONE:
+      break;
+
+    case TLB_PREFETCH_NEXT:
+      for (uint32_t i = 1; i <= prefetch->degree; i++) {
+        predict(virtual_page_number, i, predictions, &count);
+      }
+      break;
+
+    case TLB_PREFETCH_STRIDE:
+      if (trained && distance == prefetch->last_distance) {
+        for (uint32_t i = 1; i <= prefetch->degree; i++) {
+          predict(virtual_page_number, distance * i, predictions, &count);
+        }
+      }
+      break;
+
+    case TLB_PREFETCH_DISTANCE: {
+      if (!trained) {
+        break;
+      }
+      if (prefetch->last_distance) {
+        distance_record(prefetch, prefetch->last_distance, distance);
+      }
+      const tlb_prefetch_distance_t* entry = distance_entry(prefetch, distance);
+      if (entry->distance == distance) {
+        for (int slot = 0; slot < TLB_PREFETCH_DISTANCE_SLOTS &&
+                           count < prefetch->degree && entry->next[slot];
+             slot++) {
+          predict(virtual_page_number, entry->next[slot], predictions, &count);
+        }
+      }
+      break;
+    }
+  }
+
+  if (trained) {
+    prefetch->last_distance = distance;
+  }
+  prefetch->trained = true;
+  prefetch->last_page_number = virtual_page_number;
+  return count;
+}
+
+void tlb_prefetch_checkpoint(struct checkpoint* checkpoint,
+                             tlb_prefetch_t* prefetch) {
+  checkpoint_value(checkpoint, prefetch->trained);
+  checkpoint_value(checkpoint, prefetch->last_page_number);
+  checkpoint_value(checkpoint, prefetch->last_distance);
+  checkpoint_array(checkpoint, prefetch->distances,
+                   TLB_PREFETCH_DISTANCE_TABLE_SIZE,
+                   sizeof(tlb_prefetch_distance_t));
+}
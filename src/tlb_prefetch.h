@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "constants.h"
+#include "memory.h"
+
+// Translation prefetchers, trained on the TLB misses of a core. Traces carry
+// no program counter, so each core has a single miss stream.
+typedef enum {
+  TLB_PREFETCH_NONE,
+  // The pages following the missed one.
+  TLB_PREFETCH_NEXT,
+  // Multiples of the distance between the last misses, once the same
+  // distance has been seen twice in a row.
+  TLB_PREFETCH_STRIDE,
+  // Distance prefetching: a table maps the distance between two misses onto
+  // the distances that followed it before, and the missed page plus those
+  // distances is prefetched.
+  TLB_PREFETCH_DISTANCE,
+} tlb_prefetcher_t;
+
+// Entry of the distance table, tagged with the distance it is indexed by.
+// `next` holds the distances that followed it, most recent first, where 0
+// marks an unused slot.
+typedef struct {
+  int64_t distance;
+  int64_t next[TLB_PREFETCH_DISTANCE_SLOTS];
+} tlb_prefetch_distance_t;
+
+typedef struct {
+  tlb_prefetcher_t prefetcher;
+  uint32_t degree;
+
+  bool trained;
+  va_t last_page_number;
+  int64_t last_distance;
+
+  // DISTANCE: direct-mapped on the low bits of the distance.
+  tlb_prefetch_distance_t* distances;
+} tlb_prefetch_t;
+
+// `degree` is the largest number of pages predicted after a miss.
+void tlb_prefetch_init(tlb_prefetch_t* prefetch, tlb_prefetcher_t prefetcher,
+                       uint32_t degree);
+void tlb_prefetch_free(tlb_prefetch_t* prefetch);
+
+struct checkpoint;
+// Saves or restores the state of an initialized prefetcher.
+void tlb_prefetch_checkpoint(struct checkpoint* checkpoint,
+                             tlb_prefetch_t* prefetch);
+
+// Trains on a miss on the page, and stores the pages worth prefetching after
+// it in `predictions`, which holds at least `degree` pages. Returns how many
+// there are.
+uint32_t tlb_prefetch_predict(tlb_prefetch_t* prefetch,
+                              va_t virtual_page_number, va_t* predictions);
+
+const char* tlb_prefetcher_name(tlb_prefetcher_t prefetcher);
+
+// Returns false if the name does not match any prefetcher.
+bool tlb_prefetcher_parse(const char* name, tlb_prefetcher_t* prefetcher);
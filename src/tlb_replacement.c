@@ -0,0 +1,259 @@
+#include "tlb_replacement.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "checkpoint.h"
+#include "log.h"
+
+static const char* policy_names[] = {
+    [TLB_POLICY_LRU] = "lru",     [TLB_POLICY_PLRU] = "plru",
+    [TLB_POLICY_CLOCK] = "clock", [TLB_POLICY_FIFO] = "fifo",
+    [TLB_POLICY_RANDOM] = "random",
+};
+
+const char* tlb_policy_name(tlb_policy_t policy) {
+  return policy_names[policy];
+}
+
+bool tlb_policy_parse(const char* name, tlb_policy_t* policy) {
+  for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++) {
+    if (strcmp(name, policy_names[i]) == 0) {
+      *policy = (tlb_policy_t)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void* zalloc(size_t count, size_t size) {
+  void* memory = calloc(count, size);
+  if (!memory) {
+    panic("Failed to allocate TLB replacement state");
+  }
+  return memory;
+}
+
+// ========================================================================
+// Recency lists (LRU and FIFO).
+// ========================================================================
+
+static void list_unlink(tlb_replacement_t* r, uint32_t set, uint32_t index) {
+  uint32_t prev = r->prev[index];
+  uint32_t next = r->next[index];
+
+  if (prev == UINT32_MAX) {
+    r->head[set] = next;
+  } else {
+    r->next[prev] = next;
+  }
+  if (next == UINT32_MAX) {
+    r->tail[set] = prev;
+  } else {
+    r->prev[next] = prev;
+  }
+}
+
+static void list_push_head(tlb_replacement_t* r, uint32_t set,
+                           uint32_t index) {
+  r->prev[index] = UINT32_MAX;
+  r->next[index] = r->head[set];
+  if (r->head[set] == UINT32_MAX) {
+    r->tail[set] = index;
+  } else {
+    r->prev[r->head[set]] = index;
+  }
+  r->head[set] = index;
+}
+
+static void list_move_to_head(tlb_replacement_t* r, uint32_t index) {
+  uint32_t set = index / r->ways;
+  if (r->head[set] == index) {
+    return;
+  }
+  list_unlink(r, set, index);
+  list_push_head(r, set, index);
+}
+
+// ========================================================================
+// Tree pseudo-LRU.
+// ========================================================================
+
+static inline uint8_t* plru_tree(tlb_replacement_t* r, uint32_t set) {
+  // Node 0 of every set is unused so children of node n are 2n and 2n + 1.
+  return &r->bits[(size_t)set * r->ways];
+}
+
+static void plru_touch(tlb_replacement_t* r, uint32_t index) {
+  uint8_t* tree = plru_tree(r, index / r->ways);
+  uint32_t way = index % r->ways;
+
+  // Point every node on the path away from the touched way.
+  uint32_t node = 1;
+  for (uint32_t half = r->ways >> 1; half; half >>= 1) {
+    uint32_t right = (way & half) != 0;
+    tree[node] = !right;
+    node = 2 * node + right;
+  }
+}
+
+static uint32_t plru_victim(tlb_replacement_t* r, uint32_t set) {
+  uint8_t* tree = plru_tree(r, set);
+
+  uint32_t node = 1;
+  uint32_t way = 0;
+  for (uint32_t half = r->ways >> 1; half; half >>= 1) {
+    uint32_t right = tree[node];
+    way |= right ? half : 0;
+    node = 2 * node + right;
+  }
+  return set * r->ways + way;
+}
+
+// ========================================================================
+// CLOCK.
+// ========================================================================
+
+static uint32_t clock_victim(tlb_replacement_t* r, uint32_t set) {
+  uint32_t base = set * r->ways;
+
+  // Terminates within two turns of the hand, as every visited entry loses its
+  // referenced bit.
+  for (;;) {
+    uint32_t index = base + r->hand[set];
+    r->hand[set] = (r->hand[set] + 1) % r->ways;
+    if (!r->bits[index]) {
+      return index;
+    }
+    r->bits[index] = 0;
+  }
+}
+
+// ========================================================================
+// RANDOM.
+// ========================================================================
+
+static inline uint64_t xorshift64star(uint64_t* state) {
+  *state ^= *state >> 12;
+  *state ^= *state << 25;
+  *state ^= *state >> 27;
+  return *state * 0x2545f4914f6cdd1dllu;
+}
+
+// ========================================================================
+// Policy interface.
+// ========================================================================
+
+void tlb_replacement_init(tlb_replacement_t* r, tlb_policy_t policy,
+                          uint32_t sets, uint32_t ways, uint64_t seed) {
+  tlb_replacement_free(r);
+
+  r->policy = policy;
+  r->sets = sets;
+  r->ways = ways;
+  size_t entries = (size_t)sets * ways;
+
+  switch (policy) {
+    case TLB_POLICY_LRU:
+    case TLB_POLICY_FIFO:
+      r->prev = zalloc(entries, sizeof(uint32_t));
+      r->next = zalloc(entries, sizeof(uint32_t));
+      r->head = zalloc(sets, sizeof(uint32_t));
+      r->tail = zalloc(sets, sizeof(uint32_t));
+      // Start with the ways in index order, so a fresh set behaves like one
+      // filled from way 0 upwards.
+      for (uint32_t set = 0; set < sets; set++) {
+        r->head[set] = UINT32_MAX;
+        r->tail[set] = UINT32_MAX;
+        for (uint32_t way = 0; way < ways; way++) {
+          list_push_head(r, set, set * ways + way);
+        }
+      }
+      break;
+    case TLB_POLICY_PLRU:
+      if (ways & (ways - 1)) {
+        panic("Tree PLRU needs a power of two number of ways, got %u", ways);
+      }
+      r->bits = zalloc(entries, sizeof(uint8_t));
+      break;
+    case TLB_POLICY_CLOCK:
+      r->bits = zalloc(entries, sizeof(uint8_t));
+      r->hand = zalloc(sets, sizeof(uint32_t));
+      break;
+    case TLB_POLICY_RANDOM:
+      // xorshift must never be seeded with zero.
+      r->random_state = seed ? seed : 0xcafebabe;
+      break;
+  }
+}
+
+void tlb_replacement_free(tlb_replacement_t* r) {
+  free(r->prev);
+  free(r->next);
+  free(r->head);
+  free(r->tail);
+  free(r->bits);
+  free(r->hand);
+  memset(r, 0, sizeof(*r));
+}
+
+void tlb_replacement_fill(tlb_replacement_t* r, uint32_t index) {
+  switch (r->policy) {
+    case TLB_POLICY_LRU:
+    case TLB_POLICY_FIFO:
+      list_move_to_head(r, index);
+      break;
+    case TLB_POLICY_PLRU:
+      plru_touch(r, index);
+      break;
+    case TLB_POLICY_CLOCK:
+      r->bits[index] = 1;
+      break;
+    case TLB_POLICY_RANDOM:
+      break;
+  }
+}
+
+void tlb_replacement_touch(tlb_replacement_t* r, uint32_t index) {
+  switch (r->policy) {
+    case TLB_POLICY_LRU:
+      list_move_to_head(r, index);
+      break;
+    case TLB_POLICY_PLRU:
+      plru_touch(r, index);
+      break;
+    case TLB_POLICY_CLOCK:
+      r->bits[index] = 1;
+      break;
+    case TLB_POLICY_FIFO:
+    case TLB_POLICY_RANDOM:
+      break;
+  }
+}
+
+uint32_t tlb_replacement_victim(tlb_replacement_t* r, uint32_t set) {
+  switch (r->policy) {
+    case TLB_POLICY_LRU:
+    case TLB_POLICY_FIFO:
+      return r->tail[set];
+    case TLB_POLICY_PLRU:
+      return plru_victim(r, set);
+    case TLB_POLICY_CLOCK:
+      return clock_victim(r, set);
+    case TLB_POLICY_RANDOM:
+      return set * r->ways + xorshift64star(&r->random_state) % r->ways;
+  }
+  return set * r->ways;
+}
+
+void tlb_replacement_checkpoint(struct checkpoint* checkpoint,
+                                tlb_replacement_t* r) {
+  size_t entries = (size_t)r->sets * r->ways;
+  checkpoint_array(checkpoint, r->prev, entries, sizeof(uint32_t));
+  checkpoint_array(checkpoint, r->next, entries, sizeof(uint32_t));
+  checkpoint_array(checkpoint, r->head, r->sets, sizeof(uint32_t));
+  checkpoint_array(checkpoint, r->tail, r->sets, sizeof(uint32_t));
+  checkpoint_array(checkpoint, r->bits, entries, sizeof(uint8_t));
+  checkpoint_array(checkpoint, r->hand, r->sets, sizeof(uint32_t));
+  checkpoint_value(checkpoint, r->random_state);
+}
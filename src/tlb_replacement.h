@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Replacement policies available for each TLB level.
+typedef enum {
+  // True least recently used, kept as an intrusive recency list per set.
+  TLB_POLICY_LRU,
+  // Tree pseudo-LRU, one bit per internal node of a binary tree per set.
+  TLB_POLICY_PLRU,
+  // CLOCK (second chance), one referenced bit per entry and a hand per set.
+  TLB_POLICY_CLOCK,
+  // First in, first out, kept as an intrusive insertion list per set.
+  TLB_POLICY_FIFO,
+  // Uniformly random way, from a seeded generator.
+  TLB_POLICY_RANDOM,
+} tlb_policy_t;
+
+// Replacement state of a whole TLB level. Entries are addressed by their
+// index in the level, `set * ways + way`, like the TLB entries themselves.
+typedef struct {
+  tlb_policy_t policy;
+  uint32_t sets;
+  uint32_t ways;
+
+  // LRU/FIFO: doubly linked list per set, most recent entry at the head.
+  uint32_t* prev;
+  uint32_t* next;
+  uint32_t* head;
+  uint32_t* tail;
+
+  // PLRU: `ways - 1` tree nodes per set, stored heap-style from index 1.
+  // CLOCK: referenced bit per entry.
+  uint8_t* bits;
+
+  // CLOCK: hand per set.
+  uint32_t* hand;
+
+  // RANDOM: xorshift64* state.
+  uint64_t random_state;
+} tlb_replacement_t;
+
+void tlb_replacement_init(tlb_replacement_t* replacement, tlb_policy_t policy,
+                          uint32_t sets, uint32_t ways, uint64_t seed);
+void tlb_replacement_free(tlb_replacement_t* replacement);
+
+struct checkpoint;
+// Saves or restores the state of an initialized policy.
+void tlb_replacement_checkpoint(struct checkpoint* checkpoint,
+                                tlb_replacement_t* replacement);
+
+// An entry has been filled with a new translation.
+void tlb_replacement_fill(tlb_replacement_t* replacement, uint32_t index);
+
+// A valid entry has been used by a translation.
+void tlb_replacement_touch(tlb_replacement_t* replacement, uint32_t index);
+
+// Picks the entry of a full set to replace.
+uint32_t tlb_replacement_victim(tlb_replacement_t* replacement, uint32_t set);
+
+const char* tlb_policy_name(tlb_policy_t policy);
+
+// Returns false if the name does not match any policy.
+bool tlb_policy_parse(const char* name, tlb_policy_t* policy);
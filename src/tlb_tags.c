@@ -0,0 +1,93 @@
+#include "tlb_tags.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TLB_TAGS_X86
+#endif
+
+// Sets narrower than this are not worth the call into a vector kernel.
+#define MIN_VECTOR_WAYS 8
+
+static uint64_t match_scalar(const va_t* tags, uint32_t count, va_t tag,
+                             uint64_t valid) {
+  for (uint32_t i = 0; i < count; i++) {
+    if (tags[i] == tag && (valid >> i & 1)) {
+      return 1llu << i;
+    }
+  }
+  return 0;
+}
+
+#ifdef TLB_TAGS_X86
+
+__attribute__((target("sse4.1"))) static uint64_t match_sse41(
+    const va_t* tags, uint32_t count, va_t tag, uint64_t valid) {
+  __m128i needle = _mm_set1_epi64x((long long)tag);
+  uint32_t i = 0;
+  for (; i + 2 <= count; i += 2) {
+    __m128i chunk = _mm_loadu_si128((const __m128i*)&tags[i]);
+    __m128i equal = _mm_cmpeq_epi64(chunk, needle);
+    uint64_t mask = _mm_movemask_pd(_mm_castsi128_pd(equal)) & valid >> i;
+    if (mask) {
+      return mask << i;
+    }
+  }
+  return i < count ? match_scalar(&tags[i], count - i, tag, valid >> i) << i
+                   : 0;
+}
+
+__attribute__((target("avx2"))) static uint64_t match_avx2(
+    const va_t* tags, uint32_t count, va_t tag, uint64_t valid) {
+  __m256i needle = _mm256_set1_epi64x((long long)tag);
+  uint32_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i chunk = _mm256_loadu_si256((const __m256i*)&tags[i]);
+    __m256i equal = _mm256_cmpeq_epi64(chunk, needle);
+    uint64_t mask =
+        _mm256_movemask_pd(_mm256_castsi256_pd(equal)) & valid >> i;
+    if (mask) {
+      return mask << i;
+    }
+  }
+  return i < count ? match_scalar(&tags[i], count - i, tag, valid >> i) << i
+                   : 0;
+}
+
+// The last chunk is loaded with a mask rather than finished one by one.
+__attribute__((target("avx512f"))) static uint64_t match_avx512(
+    const va_t* tags, uint32_t count, va_t tag, uint64_t valid) {
+  __m512i needle = _mm512_set1_epi64((long long)tag);
+  for (uint32_t i = 0; i < count; i += 8) {
+    __mmask8 lanes = (__mmask8)(valid >> i);
+    if (count - i < 8) {
+      lanes &= (__mmask8)((1u << (count - i)) - 1);
+    }
+    __m512i chunk = _mm512_maskz_loadu_epi64(lanes, &tags[i]);
+    uint64_t mask = _mm512_mask_cmpeq_epi64_mask(lanes, chunk, needle);
+    if (mask) {
+      return mask << i;
+    }
+  }
+  return 0;
+}
+
+#endif
+
+tlb_tags_match_t tlb_tags_matcher(uint32_t ways) {
+  if (ways < MIN_VECTOR_WAYS) {
+    return match_scalar;
+  }
+#ifdef TLB_TAGS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return match_avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    return match_avx2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return match_sse41;
+  }
+#endif
+  return match_scalar;
+}
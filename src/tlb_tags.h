@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "constants.h"
+#include "memory.h"
+
+// Tag matching for the TLB arrays, which keep the tags of their entries
+// packed apart from the translations, so a lookup compares a whole set with
+// a few vector compares. Kernels are picked at run time for the instructions
+// the host supports, with a portable fallback.
+//
+// A tag holds the address space of the page above its page number, shifted
+// left by two, and the page size, so translations of other processes never
+// match.
+#define TLB_TAG_ASID_SHIFT (2 + VIRTUAL_ADDRESS_BITS - PAGE_SIZE_BITS)
+
+static inline va_t tlb_tag(asid_t asid, va_t page_number,
+                           page_size_t page_size) {
+  return (va_t)asid << TLB_TAG_ASID_SHIFT | page_number << 2 | page_size;
+}
+
+static inline asid_t tlb_tag_asid(va_t tag) {
+  return (asid_t)(tag >> TLB_TAG_ASID_SHIFT);
+}
+
+static inline va_t tlb_tag_page_number(va_t tag) {
+  return (tag >> 2) & PAGE_INDEX_MASK;
+}
+
+static inline page_size_t tlb_tag_page_size(va_t tag) { return tag & 3; }
+
+// Looks for `tag` among the first `count` tags, at most 64, where only the
+// tags with their bit set in `valid` count. Returns a mask with the bit of
+// the first match set, or 0.
+typedef uint64_t (*tlb_tags_match_t)(const va_t* tags, uint32_t count,
+                                     va_t tag, uint64_t valid);
+
+// Best kernel for sets of `ways` entries on this host. Narrow sets are
+// compared one tag at a time.
+tlb_tags_match_t tlb_tags_matcher(uint32_t ways);
@@ -0,0 +1,139 @@
+#pragma once
+
+// libtlbsim: the simulator as a library.
+//
+// Every simulation lives in its own context, so a process can hold any number
+// of them. Different contexts can be used concurrently from different
+// threads. A single context must only be used by one thread at a time, except
+// that the cores of a multicore context can be driven from one thread each.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TLBSIM_MAX_CORES 64
+#define TLBSIM_CACHE_LEVELS 3
+#define TLBSIM_MAX_ADDRESS_SPACES 4096
+
+typedef struct tlbsim_ctx tlbsim_ctx;
+
+// A memory instruction.
+typedef struct {
+  uint64_t address;
+  // Core running the instruction, below the `cores` option.
+  uint32_t core;
+  // 0 for a read, 1 for a write.
+  uint32_t write;
+  // Address space of the process running the instruction, below
+  // TLBSIM_MAX_ADDRESS_SPACES. Cores switch context whenever it changes.
+  uint32_t asid;
+} tlbsim_op_t;
+
+// Statistics of a single core.
+typedef struct {
+  uint64_t elapsed_ns;
+  uint64_t instructions;
+
+  uint64_t tlb_l1_hits;
+  uint64_t tlb_l1_misses;
+  uint64_t tlb_l1_invalidations;
+  uint64_t tlb_l2_hits;
+  uint64_t tlb_l2_misses;
+  uint64_t tlb_l2_invalidations;
+  uint64_t tlb_shootdowns;
+  uint64_t context_switches;
+} tlbsim_core_stats_t;
+
+// Statistics of a simulation. With more than one core, the elapsed time is
+// the one of the slowest core and the other totals are summed over the cores.
+// Sampled simulations report the elapsed times they estimate.
+typedef struct {
+  uint64_t elapsed_ns;
+  uint64_t instructions;
+  uint64_t page_faults;
+  uint64_t page_evictions;
+
+  uint64_t tlb_l1_hits;
+  uint64_t tlb_l1_misses;
+  uint64_t tlb_l1_invalidations;
+  uint64_t tlb_l2_hits;
+  uint64_t tlb_l2_misses;
+  uint64_t tlb_l2_invalidations;
+  uint64_t tlb_shootdowns;
+
+  uint64_t disk_reads;
+  uint64_t disk_writes;
+  uint64_t disk_seeks;
+
+  // Pages written to and read from swap clusters, pages read ahead along
+  // with them, and swap-ins served by pages read ahead.
+  uint64_t swap_outs;
+  uint64_t swap_ins;
+  uint64_t swap_readahead_pages;
+  uint64_t swap_readahead_hits;
+
+  // Page table walks on TLB misses, and translations prefetched: used before
+  // being dropped, or evicted or invalidated unused.
+  uint64_t tlb_page_walks;
+  uint64_t tlb_prefetches;
+  uint64_t tlb_useful_prefetches;
+  uint64_t tlb_useless_prefetches;
+
+  // Address spaces with a page table, switches between them, and TLB entries
+  // dropped by the switches when TLBs are flushed on them.
+  uint64_t address_spaces;
+  uint64_t context_switches;
+  uint64_t tlb_flushed_entries;
+
+  // Huge pages mapped, on a page fault or by promotion, and split back into
+  // 4 KiB pages to be evicted.
+  uint64_t huge_pages_2m;
+  uint64_t huge_pages_1g;
+  uint64_t huge_page_promotions;
+  uint64_t huge_page_splits;
+
+  // Per data cache level (L1D, L2 and LLC): hits, misses, dirty lines
+  // written back, accesses of the MMU and hits among them, and data lines
+  // evicted by the lines of the MMU.
+  uint64_t cache_hits[TLBSIM_CACHE_LEVELS];
+  uint64_t cache_misses[TLBSIM_CACHE_LEVELS];
+  uint64_t cache_writebacks[TLBSIM_CACHE_LEVELS];
+  uint64_t cache_mmu_accesses[TLBSIM_CACHE_LEVELS];
+  uint64_t cache_mmu_hits[TLBSIM_CACHE_LEVELS];
+  uint64_t cache_mmu_evictions[TLBSIM_CACHE_LEVELS];
+
+  // DRAM writes queued in the write buffers, merged into a queued line, reads
+  // served from a queued line, and waits for a full buffer.
+  uint64_t write_buffer_writes;
+  uint64_t write_buffer_coalesced;
+  uint64_t write_buffer_forwarded;
+  uint64_t write_buffer_stalls;
+  uint64_t write_buffer_stall_ns;
+
+  uint32_t cores;
+  tlbsim_core_stats_t core[TLBSIM_MAX_CORES];
+} tlbsim_stats_t;
+
+// Creates a simulation. `options` holds whitespace separated `option=value`
+// pairs named like the long options of the tlbsim command (for example
+// "tlb-l1-size=16 page-policy=clock"), or is NULL for the defaults.
+// Invalid options are fatal, as they are for the command.
+tlbsim_ctx* tlbsim_create(const char* options);
+
+// Saves the whole state of a simulation to a file.
+void tlbsim_save(tlbsim_ctx* ctx, const char* path);
+
+// Creates a simulation from the state saved by tlbsim_save(), or by the
+// --checkpoint option of the tlbsim command. `options` may only change
+// latencies, or is NULL to keep the options the state was saved with.
+// Checkpoints can only be restored by the same build of the library.
+tlbsim_ctx* tlbsim_restore(const char* path, const char* options);
+
+// Brings the simulation back to its initial state, keeping its options.
+void tlbsim_reset(tlbsim_ctx* ctx);
+
+void tlbsim_destroy(tlbsim_ctx* ctx);
+
+// Runs `count` instructions in order.
+void tlbsim_access(tlbsim_ctx* ctx, const tlbsim_op_t* ops, size_t count);
+
+void tlbsim_get_stats(tlbsim_ctx* ctx, tlbsim_stats_t* stats);
@@ -0,0 +1,457 @@
+#include "trace.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "constants.h"
+#include "log.h"
+#include "trace_reader.h"
+
+// Binary trace layout (all integers little endian):
+//
+//   magic            4 bytes  "TLBT"
+//   version          1 byte   TRACE_BINARY_VERSION
+//   page_size_bits   1 byte   page size used to split addresses
+//   reserved         2 bytes
+//   instructions     8 bytes  number of records that follow
+//
+// Each record is two to four LEB128 varints. The first one holds the
+// zigzag-encoded difference between this and the previous virtual page number,
+// shifted left by three, with an ASID change flag in bit 2, a core change flag
+// in bit 1 and the operation (0 = read, 1 = write) in bit 0. When the core
+// flag is set, the core of this and the following instructions comes next,
+// and then, when the ASID flag is set, their ASID. The last one holds the
+// zigzag-encoded difference between this and the previous page offset.
+// Sequential and strided traces therefore take 2 bytes per instruction.
+//
+// Version 2 traces have no ASID flag: the page number difference is only
+// shifted left by two, and every instruction runs in ASID 0. Version 1 traces
+// have no core flag either: it is only shifted left by one, and every
+// instruction runs on core 0.
+#define TRACE_BINARY_MAGIC "TLBT"
+#define TRACE_BINARY_VERSION 3
+#define TRACE_BINARY_CORE_CHANGE 2
+#define TRACE_BINARY_ASID_CHANGE 4
+#define TRACE_BINARY_HEADER_SIZE 16
+
+static inline uint64_t zigzag_encode(int64_t value) {
+  return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value) {
+  return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+// Errors stop decoding, and are reported once the instructions before them
+// have run: a reader thread may decode them well ahead of the simulation.
+#define decode_error(trace, fmt, ...)                                      \
+  do {                                                                     \
+    snprintf((trace)->error, sizeof((trace)->error), fmt, ##__VA_ARGS__); \
+    return false;                                                          \
+  } while (0)
+
+static inline bool read_byte(trace_t* trace, uint8_t* byte) {
+  if (trace->data) {
+    if (trace->cursor >= trace->size) {
+      return false;
+    }
+    *byte = trace->data[trace->cursor++];
+    return true;
+  }
+
+  int next = getc_unlocked(trace->file);
+  if (next == EOF) {
+    return false;
+  }
+  *byte = (uint8_t)next;
+  trace->cursor++;
+  return true;
+}
+
+static inline bool read_varint(trace_t* trace, uint64_t* value) {
+  *value = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    uint8_t byte;
+    if (!read_byte(trace, &byte)) {
+      decode_error(trace, "Truncated binary trace at byte %zu", trace->cursor);
+    }
+    *value |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  decode_error(trace, "Malformed varint in binary trace at byte %zu",
+               trace->cursor);
+}
+
+static inline bool binary_trace_end(trace_t* trace) {
+  if (trace->data) {
+    return trace->cursor >= trace->size;
+  }
+  int next = getc_unlocked(trace->file);
+  if (next == EOF) {
+    return true;
+  }
+  ungetc(next, trace->file);
+  return false;
+}
+
+static void write_varint(FILE* file, uint64_t value) {
+  uint8_t buffer[10];
+  int length = 0;
+  do {
+    buffer[length] = value & 0x7f;
+    value >>= 7;
+    if (value) {
+      buffer[length] |= 0x80;
+    }
+    length++;
+  } while (value);
+  fwrite(buffer, 1, length, file);
+}
+
+static void trace_init_binary(trace_t* trace, const uint8_t* header) {
+  trace->format = TRACE_FORMAT_BINARY;
+  trace->cursor = TRACE_BINARY_HEADER_SIZE;
+
+  trace->version = header[4];
+  if (trace->version < 1 || trace->version > TRACE_BINARY_VERSION) {
+    panic("Unsupported binary trace version %d", trace->version);
+  }
+  trace->page_size_bits = header[5];
+  trace->last_core = 0;
+  trace->last_asid = 0;
+  trace->last_page_number = 0;
+  trace->last_page_offset = 0;
+}
+
+static void trace_open_binary(trace_t* trace, int fd, size_t size) {
+  void* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    panic("Failed to map binary trace");
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+
+  trace->data = data;
+  trace->size = size;
+  trace_init_binary(trace, trace->data);
+}
+
+static bool decode_binary(trace_t* trace, instruction_t* instruction) {
+  if (binary_trace_end(trace)) {
+    return false;
+  }
+
+  uint64_t head;
+  uint64_t offset;
+  if (!read_varint(trace, &head)) {
+    return false;
+  }
+  // Every version adds a flag below the page number difference.
+  trace->last_page_number += zigzag_decode(head >> trace->version);
+  uint64_t value;
+  if (trace->version > 1 && (head & TRACE_BINARY_CORE_CHANGE)) {
+    if (!read_varint(trace, &value)) {
+      return false;
+    }
+    trace->last_core = (uint32_t)value;
+  }
+  if (trace->version > 2 && (head & TRACE_BINARY_ASID_CHANGE)) {
+    if (!read_varint(trace, &value)) {
+      return false;
+    }
+    trace->last_asid = (asid_t)value;
+  }
+  if (!read_varint(trace, &offset)) {
+    return false;
+  }
+  trace->last_page_offset += zigzag_decode(offset);
+
+  instruction->op = (head & 1) ? OP_WRITE : OP_READ;
+  instruction->core = trace->last_core;
+  instruction->asid = trace->last_asid;
+  instruction->address = (trace->last_page_number << trace->page_size_bits) |
+                         trace->last_page_offset;
+  return true;
+}
+
+// Applies a `S <asid> [<core>]` line, which switches the process the core
+// runs.
+static bool decode_context_switch(trace_t* trace) {
+  asid_t asid;
+  uint32_t core = 0;
+  if (sscanf(trace->line, "S %" PRIu32 " %" PRIu32, &asid, &core) < 1) {
+    decode_error(trace, "Invalid context switch format: %s", trace->line);
+  }
+  if (core >= MAX_CORES) {
+    decode_error(trace, "Context switch of core %" PRIu32
+                 ", but at most %d cores can be simulated",
+                 core, MAX_CORES);
+  }
+  trace->asids[core] = asid;
+  return true;
+}
+
+static bool decode_text(trace_t* trace, instruction_t* instruction) {
+  do {
+    if (!fgets(trace->line, sizeof(trace->line), trace->file)) {
+      return false;
+    }
+  } while (trace->line[0] == 'S' && decode_context_switch(trace));
+  if (trace->error[0]) {
+    return false;
+  }
+
+  char op;
+  instruction->core = 0;
+  int fields = sscanf(trace->line, "%c %" PRIx64 " %" PRIu32 " %" PRIu32, &op,
+                      &instruction->address, &instruction->core,
+                      &instruction->asid);
+  if (fields < 2) {
+    decode_error(trace, "Invalid instruction format: %s", trace->line);
+  }
+  // Cores out of range are reported by the simulator.
+  if (fields < 4) {
+    instruction->asid =
+        instruction->core < MAX_CORES ? trace->asids[instruction->core] : 0;
+  } else if (instruction->core < MAX_CORES) {
+    trace->asids[instruction->core] = instruction->asid;
+  }
+
+  switch (op) {
+    case 'R':
+      instruction->op = OP_READ;
+      break;
+    case 'W':
+      instruction->op = OP_WRITE;
+      break;
+    default:
+      decode_error(trace, "Unknown instruction: %c", op);
+  }
+  return true;
+}
+
+// Decodes a trace that is not a stream.
+static inline bool decode(trace_t* trace, instruction_t* instruction) {
+  switch (trace->format) {
+    case TRACE_FORMAT_WORKLOAD:
+      return workload_next(&trace->workload, &instruction->address,
+                           &instruction->op, &instruction->core,
+                           &instruction->asid);
+    case TRACE_FORMAT_BINARY:
+      return decode_binary(trace, instruction);
+    default:
+      return decode_text(trace, instruction);
+  }
+}
+
+static bool decode_source(void* source, instruction_t* instruction) {
+  return decode(source, instruction);
+}
+
+static void close_source(void* source) {
+  trace_close(source);
+  free(source);
+}
+
+// Pipes can neither be mapped nor rewound, so binary traces are told apart by
+// their first byte alone: no text instruction starts with it.
+static void trace_open_stream(trace_t* trace, FILE* file) {
+  trace_t* source = calloc(1, sizeof(trace_t));
+  if (!source) {
+    panic("Failed to allocate the trace stream");
+  }
+  source->file = file;
+
+  int first = getc(file);
+  if (first == TRACE_BINARY_MAGIC[0]) {
+    uint8_t header[TRACE_BINARY_HEADER_SIZE];
+    header[0] = (uint8_t)first;
+    if (fread(header + 1, 1, sizeof(header) - 1, file) != sizeof(header) - 1 ||
+        memcmp(header, TRACE_BINARY_MAGIC, 4) != 0) {
+      panic("Invalid binary trace header");
+    }
+    trace_init_binary(source, header);
+  } else {
+    if (first != EOF) {
+      ungetc(first, file);
+    }
+    source->format = TRACE_FORMAT_TEXT;
+  }
+
+  trace->format = TRACE_FORMAT_STREAM;
+  trace->source = source;
+  trace->reader = trace_reader_start(decode_source, close_source, source);
+}
+
+void trace_open(trace_t* trace, const char* path) {
+  memset(trace, 0, sizeof(*trace));
+
+  if (workload_is_spec(path)) {
+    trace->format = TRACE_FORMAT_WORKLOAD;
+    workload_init(&trace->workload, path);
+    return;
+  }
+
+  // <unistd.h> clashes with the simulator's read()/write(), so the trace is
+  // probed through stdio.
+  FILE* file;
+  if (strcmp(path, "-") == 0) {
+    static bool stdin_opened = false;
+    if (__atomic_exchange_n(&stdin_opened, true, __ATOMIC_RELAXED)) {
+      panic("Only one trace can be read from the standard input");
+    }
+    file = stdin;
+  } else {
+    file = fopen(path, "r");
+  }
+  if (!file) {
+    panic("Failed to open instructions file %s", path);
+  }
+
+  struct stat st;
+  if (fstat(fileno(file), &st) != 0) {
+    panic("Failed to open instructions file %s", path);
+  }
+  if (!S_ISREG(st.st_mode)) {
+    trace_open_stream(trace, file);
+    return;
+  }
+
+  char magic[4];
+  if (st.st_size >= TRACE_BINARY_HEADER_SIZE &&
+      fread(magic, 1, sizeof(magic), file) == sizeof(magic) &&
+      memcmp(magic, TRACE_BINARY_MAGIC, sizeof(magic)) == 0) {
+    trace_open_binary(trace, fileno(file), st.st_size);
+    fclose(file);
+    return;
+  }
+
+  rewind(file);
+  trace->format = TRACE_FORMAT_TEXT;
+  trace->file = file;
+}
+
+bool trace_next(trace_t* trace, instruction_t* instruction) {
+  if (trace->format == TRACE_FORMAT_STREAM) {
+    if (trace_reader_next(trace->reader, instruction)) {
+      return true;
+    }
+    if (trace->source->error[0]) {
+      panic("%s", trace->source->error);
+    }
+    return false;
+  }
+
+  if (decode(trace, instruction)) {
+    return true;
+  }
+  if (trace->error[0]) {
+    panic("%s", trace->error);
+  }
+  return false;
+}
+
+uint64_t trace_skip(trace_t* trace, uint64_t count) {
+  uint64_t skipped = 0;
+  if (trace->format == TRACE_FORMAT_TEXT) {
+    // Lines are only parsed when they are run, but context switches still
+    // have to be followed.
+    while (skipped < count &&
+           fgets(trace->line, sizeof(trace->line), trace->file)) {
+      if (trace->line[0] != 'S') {
+        skipped++;
+      } else if (!decode_context_switch(trace)) {
+        panic("%s", trace->error);
+      }
+    }
+    return skipped;
+  }
+
+  // Binary records are delta encoded, and generators have to be stepped.
+  instruction_t instruction;
+  while (skipped < count && trace_next(trace, &instruction)) {
+    skipped++;
+  }
+  return skipped;
+}
+
+void trace_close(trace_t* trace) {
+  if (trace->format == TRACE_FORMAT_STREAM) {
+    trace_reader_stop(trace->reader);
+  } else if (trace->format == TRACE_FORMAT_BINARY && trace->data) {
+    munmap((void*)trace->data, trace->size);
+  } else if (trace->format == TRACE_FORMAT_WORKLOAD) {
+    workload_free(&trace->workload);
+  } else if (trace->file) {
+    fclose(trace->file);
+  }
+  memset(trace, 0, sizeof(*trace));
+}
+
+uint64_t trace_convert(const char* text_path, const char* binary_path) {
+  trace_t trace;
+  trace_open(&trace, text_path);
+  if (trace.format == TRACE_FORMAT_BINARY) {
+    panic("%s is already a binary trace", text_path);
+  }
+
+  FILE* output = fopen(binary_path, "wb");
+  if (!output) {
+    panic("Failed to create binary trace %s", binary_path);
+  }
+
+  uint8_t header[TRACE_BINARY_HEADER_SIZE] = {0};
+  memcpy(header, TRACE_BINARY_MAGIC, 4);
+  header[4] = TRACE_BINARY_VERSION;
+  header[5] = PAGE_SIZE_BITS;
+  fwrite(header, 1, sizeof(header), output);
+
+  uint64_t total_instructions = 0;
+  va_t last_page_number = 0;
+  va_t last_page_offset = 0;
+  uint32_t last_core = 0;
+  asid_t last_asid = 0;
+
+  instruction_t instruction;
+  while (trace_next(&trace, &instruction)) {
+    va_t page_number = instruction.address >> PAGE_SIZE_BITS;
+    va_t page_offset = instruction.address & PAGE_OFFSET_MASK;
+
+    uint64_t head = zigzag_encode((int64_t)(page_number - last_page_number));
+    bool core_change = instruction.core != last_core;
+    bool asid_change = instruction.asid != last_asid;
+    write_varint(output, (head << 3) |
+                             (asid_change ? TRACE_BINARY_ASID_CHANGE : 0) |
+                             (core_change ? TRACE_BINARY_CORE_CHANGE : 0) |
+                             (instruction.op == OP_WRITE));
+    if (core_change) {
+      write_varint(output, instruction.core);
+      last_core = instruction.core;
+    }
+    if (asid_change) {
+      write_varint(output, instruction.asid);
+      last_asid = instruction.asid;
+    }
+    write_varint(output,
+                 zigzag_encode((int64_t)(page_offset - last_page_offset)));
+
+    last_page_number = page_number;
+    last_page_offset = page_offset;
+    total_instructions++;
+  }
+
+  for (int i = 0; i < 8; i++) {
+    header[8 + i] = (total_instructions >> (8 * i)) & 0xff;
+  }
+  fseek(output, 0, SEEK_SET);
+  fwrite(header, 1, sizeof(header), output);
+
+  fclose(output);
+  trace_close(&trace);
+
+  return total_instructions;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "constants.h"
+#include "memory.h"
+#include "workload.h"
+
+// A single memory instruction of a trace.
+typedef struct {
+  op_t op;
+  va_t address;
+  // Core running the instruction, 0 unless the trace has a core column.
+  uint32_t core;
+  // Address space of the process running it, 0 unless the trace switches
+  // processes.
+  asid_t asid;
+} instruction_t;
+
+// Traces come either in the original text format, one
+// `R/W <hex> [<core> [<asid>]]` instruction per line, in the packed binary
+// format described in trace.c, or from a synthetic workload generator. Text
+// traces may also switch the process a core runs with `S <asid> [<core>]`
+// lines, which its following instructions without an ASID column run in.
+// Text and binary traces read from pipes are streams, decoded ahead of the
+// simulation by a reader thread.
+typedef enum {
+  TRACE_FORMAT_TEXT,
+  TRACE_FORMAT_BINARY,
+  TRACE_FORMAT_WORKLOAD,
+  TRACE_FORMAT_STREAM,
+} trace_format_t;
+
+struct trace_reader;
+
+typedef struct trace {
+  trace_format_t format;
+
+  // Text traces are read line by line.
+  FILE* file;
+  char line[256];
+
+  // Binary traces are mapped into memory and decoded in place, or read in
+  // order from `file` when they cannot be mapped.
+  const uint8_t* data;
+  size_t size;
+  size_t cursor;
+  uint8_t version;
+  uint8_t page_size_bits;
+  uint32_t last_core;
+  asid_t last_asid;
+  va_t last_page_number;
+  va_t last_page_offset;
+
+  // Process each core runs in text traces.
+  asid_t asids[MAX_CORES];
+
+  // Generated traces.
+  workload_t workload;
+
+  // Streams: the text or binary trace the reader thread decodes.
+  struct trace_reader* reader;
+  struct trace* source;
+
+  // Why decoding stopped before the end of the trace, if it did.
+  char error[320];
+} trace_t;
+
+// Opens a trace, detecting its format from its contents. Workload specs, like
+// `zipf:pages=65536,count=1000000000`, open a generator instead of a file,
+// and `-` reads the standard input, so traces can be piped in from a
+// decompressor or a live tracer. Only one trace can come from it.
+void trace_open(trace_t* trace, const char* path);
+
+// Decodes the next instruction of the trace.
+// Returns false once the trace has been fully consumed.
+bool trace_next(trace_t* trace, instruction_t* instruction);
+
+// Skips up to `count` instructions without decoding more of them than needed.
+// Returns how many were skipped, less than `count` at the end of the trace.
+uint64_t trace_skip(trace_t* trace, uint64_t count);
+
+void trace_close(trace_t* trace);
+
+// Converts a text or generated trace into the binary format.
+// Returns the number of converted instructions.
+uint64_t trace_convert(const char* text_path, const char* binary_path);
+
+static inline char instruction_op_char(op_t op) {
+  return op == OP_WRITE ? 'W' : 'R';
+}
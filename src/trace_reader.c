@@ -0,0 +1,157 @@
+#include "trace_reader.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+// Instructions per batch, and batches in the ring. The simulation waits on
+// the reader at most once per batch.
+#define TRACE_READER_BATCH_SIZE 4096
+#define TRACE_READER_BATCHES 8
+
+typedef struct {
+  instruction_t instructions[TRACE_READER_BATCH_SIZE];
+  uint32_t count;
+} trace_batch_t;
+
+struct trace_reader {
+  trace_reader_decode_t decode;
+  void (*close)(void* source);
+  void* source;
+
+  pthread_mutex_t lock;
+  pthread_cond_t filled;
+  pthread_cond_t emptied;
+  // Batches filled by the reader and emptied by the simulation so far. Batch
+  // `i` sits at `i % TRACE_READER_BATCHES` in the ring.
+  uint64_t total_filled;
+  uint64_t total_emptied;
+  // Set once the source has been fully decoded, and once the simulation has
+  // stopped the reader.
+  bool done;
+  bool stopped;
+  // Held by the reader thread and by the simulation. The last one to let go
+  // closes the source.
+  int references;
+
+  // Batch being emptied by the simulation, and its next instruction.
+  const trace_batch_t* batch;
+  uint32_t cursor;
+
+  trace_batch_t batches[TRACE_READER_BATCHES];
+};
+
+static void release(struct trace_reader* reader) {
+  if (__atomic_sub_fetch(&reader->references, 1, __ATOMIC_ACQ_REL) > 0) {
+    return;
+  }
+  reader->close(reader->source);
+  pthread_cond_destroy(&reader->filled);
+  pthread_cond_destroy(&reader->emptied);
+  pthread_mutex_destroy(&reader->lock);
+  free(reader);
+}
+
+static void* run_reader(void* arg) {
+  struct trace_reader* reader = arg;
+
+  for (bool end = false; !end;) {
+    pthread_mutex_lock(&reader->lock);
+    while (reader->total_filled - reader->total_emptied ==
+               TRACE_READER_BATCHES &&
+           !reader->stopped) {
+      pthread_cond_wait(&reader->emptied, &reader->lock);
+    }
+    bool stopped = reader->stopped;
+    pthread_mutex_unlock(&reader->lock);
+    if (stopped) {
+      break;
+    }
+
+    // The simulation does not look at the batch until it is counted as
+    // filled.
+    trace_batch_t* batch =
+        &reader->batches[reader->total_filled % TRACE_READER_BATCHES];
+    batch->count = 0;
+    while (batch->count < TRACE_READER_BATCH_SIZE &&
+           reader->decode(reader->source,
+                          &batch->instructions[batch->count])) {
+      batch->count++;
+    }
+    end = batch->count < TRACE_READER_BATCH_SIZE;
+
+    pthread_mutex_lock(&reader->lock);
+    reader->total_filled++;
+    reader->done = end;
+    pthread_cond_signal(&reader->filled);
+    pthread_mutex_unlock(&reader->lock);
+  }
+
+  release(reader);
+  return NULL;
+}
+
+struct trace_reader* trace_reader_start(trace_reader_decode_t decode,
+                                        void (*close)(void* source),
+                                        void* source) {
+  struct trace_reader* reader = calloc(1, sizeof(struct trace_reader));
+  if (!reader) {
+    panic("Failed to allocate the trace reader");
+  }
+  reader->decode = decode;
+  reader->close = close;
+  reader->source = source;
+  reader->references = 2;
+  pthread_mutex_init(&reader->lock, NULL);
+  pthread_cond_init(&reader->filled, NULL);
+  pthread_cond_init(&reader->emptied, NULL);
+
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, run_reader, reader) != 0) {
+    panic("Failed to start the trace reader");
+  }
+  pthread_detach(thread);
+  return reader;
+}
+
+// Hands the current batch back to the reader, and waits for the next one.
+// Returns false at the end of the trace.
+static bool next_batch(struct trace_reader* reader) {
+  pthread_mutex_lock(&reader->lock);
+  if (reader->batch) {
+    reader->batch = NULL;
+    reader->total_emptied++;
+    pthread_cond_signal(&reader->emptied);
+  }
+  while (reader->total_emptied == reader->total_filled && !reader->done) {
+    pthread_cond_wait(&reader->filled, &reader->lock);
+  }
+  if (reader->total_emptied < reader->total_filled) {
+    reader->batch =
+        &reader->batches[reader->total_emptied % TRACE_READER_BATCHES];
+    reader->cursor = 0;
+  }
+  pthread_mutex_unlock(&reader->lock);
+  return reader->batch != NULL;
+}
+
+bool trace_reader_next(struct trace_reader* reader,
+                       instruction_t* instruction) {
+  while (!reader->batch || reader->cursor == reader->batch->count) {
+    if (!next_batch(reader)) {
+      return false;
+    }
+  }
+  *instruction = reader->batch->instructions[reader->cursor++];
+  return true;
+}
+
+void trace_reader_stop(struct trace_reader* reader) {
+  pthread_mutex_lock(&reader->lock);
+  reader->stopped = true;
+  pthread_cond_signal(&reader->emptied);
+  pthread_mutex_unlock(&reader->lock);
+  release(reader);
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "trace.h"
+
+// Decodes a trace on a host thread of its own, ahead of the simulation, into
+// a ring of fixed-size batches of instructions. The simulation then only
+// copies instructions out of the batches, so decoding and simulating overlap.
+struct trace_reader;
+
+// Decodes the next instruction of `source`. Returns false at its end.
+typedef bool (*trace_reader_decode_t)(void* source, instruction_t* instruction);
+
+// Starts decoding `source`, which belongs to the reader from then on and is
+// handed to `close` once the reader is done with it.
+struct trace_reader* trace_reader_start(trace_reader_decode_t decode,
+                                        void (*close)(void* source),
+                                        void* source);
+
+// Takes the next decoded instruction, waiting for the reader if needed.
+// Returns false once `source` has been fully decoded, which is then safe to
+// look at until the reader is stopped.
+bool trace_reader_next(struct trace_reader* reader, instruction_t* instruction);
+
+// Stops the reader. It may still be blocked reading its source, in which case
+// it gives up as soon as it gets back, without the caller waiting for it.
+void trace_reader_stop(struct trace_reader* reader);
@@ -0,0 +1,375 @@
+#include "workload.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "constants.h"
+#include "log.h"
+
+#define DEFAULT_COUNT 1000000
+#define DEFAULT_PAGES 1024
+#define DEFAULT_SEED 1
+#define DEFAULT_ALPHA 0.99
+#define DEFAULT_PHASE 100000
+#define DEFAULT_PHASES 16
+#define DEFAULT_QUANTUM 10000
+
+// Prime used to spread Zipf ranks over the pages, so that hot pages are not
+// all neighbours.
+#define ZIPF_SCATTER_MULTIPLIER 2654435761u
+
+static const char* kind_names[] = {
+    [WORKLOAD_SEQUENTIAL] = "sequential", [WORKLOAD_STRIDED] = "strided",
+    [WORKLOAD_UNIFORM] = "uniform",       [WORKLOAD_ZIPF] = "zipf",
+    [WORKLOAD_PHASED] = "phased",         [WORKLOAD_CHASE] = "chase",
+};
+
+static bool parse_kind(const char* name, size_t length, workload_kind_t* kind) {
+  for (size_t i = 0; i < sizeof(kind_names) / sizeof(kind_names[0]); i++) {
+    if (strlen(kind_names[i]) == length &&
+        strncmp(name, kind_names[i], length) == 0) {
+      *kind = (workload_kind_t)i;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool workload_is_spec(const char* spec) {
+  workload_kind_t kind;
+  return parse_kind(spec, strcspn(spec, ":"), &kind);
+}
+
+// ========================================================================
+// Random numbers.
+// ========================================================================
+
+static inline uint64_t next_random(workload_t* w) {
+  // xorshift64*
+  w->random_state ^= w->random_state >> 12;
+  w->random_state ^= w->random_state << 25;
+  w->random_state ^= w->random_state >> 27;
+  return w->random_state * 0x2545f4914f6cdd1dull;
+}
+
+// Uniform in [0, bound).
+static inline uint64_t random_below(workload_t* w, uint64_t bound) {
+  return (uint64_t)(((unsigned __int128)next_random(w) * bound) >> 64);
+}
+
+// Uniform in [0, 1).
+static inline double random_double(workload_t* w) {
+  return (next_random(w) >> 11) * 0x1p-53;
+}
+
+static uint64_t mix(uint64_t value) {
+  // splitmix64 finalizer.
+  value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ull;
+  value = (value ^ (value >> 27)) * 0x94d049bb133111ebull;
+  return value ^ (value >> 31);
+}
+
+// ========================================================================
+// ZIPF: rejection-inversion sampling (Hormann and Derflinger), which takes
+// constant time and memory for any number of pages.
+// ========================================================================
+
+// The parentheses keep the log() macro of log.h from expanding.
+static inline double natural_log(double x) { return (log)(x); }
+
+static double zipf_helper1(double x) {
+  return fabs(x) > 1e-8 ? log1p(x) / x
+                        : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static double zipf_helper2(double x) {
+  return fabs(x) > 1e-8 ? expm1(x) / x
+                        : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+}
+
+static double zipf_h(const workload_t* w, double x) {
+  return exp(-w->alpha * natural_log(x));
+}
+
+static double zipf_h_integral(const workload_t* w, double x) {
+  double log_x = natural_log(x);
+  return zipf_helper2((1 - w->alpha) * log_x) * log_x;
+}
+
+static double zipf_h_integral_inverse(const workload_t* w, double x) {
+  double t = x * (1 - w->alpha);
+  if (t < -1) {
+    t = -1;
+  }
+  return exp(zipf_helper1(t) * x);
+}
+
+static void zipf_init(workload_t* w) {
+  w->zipf_h_integral_x1 = zipf_h_integral(w, 1.5) - 1;
+  w->zipf_h_integral_n = zipf_h_integral(w, w->pages + 0.5);
+  w->zipf_s = 2 - zipf_h_integral_inverse(
+                      w, zipf_h_integral(w, 2.5) - zipf_h(w, 2));
+  w->zipf_multiplier =
+      w->scatter && w->pages % ZIPF_SCATTER_MULTIPLIER ? ZIPF_SCATTER_MULTIPLIER
+                                                       : 1;
+}
+
+// Rank in [0, pages), 0 being the most likely.
+static uint64_t zipf_rank(workload_t* w) {
+  for (;;) {
+    double u = w->zipf_h_integral_n +
+               random_double(w) *
+                   (w->zipf_h_integral_x1 - w->zipf_h_integral_n);
+    double x = zipf_h_integral_inverse(w, u);
+    double k = floor(x + 0.5);
+    if (k < 1) {
+      k = 1;
+    } else if (k > w->pages) {
+      k = w->pages;
+    }
+    if (k - x <= w->zipf_s ||
+        u >= zipf_h_integral(w, k + 0.5) - zipf_h(w, k)) {
+      return (uint64_t)k - 1;
+    }
+  }
+}
+
+// ========================================================================
+// CHASE.
+// ========================================================================
+
+static void chase_init(workload_t* w) {
+  if (w->pages > UINT32_MAX) {
+    panic("chase: at most %u pages", UINT32_MAX);
+  }
+  w->chase_next = malloc(w->pages * sizeof(uint32_t));
+  if (!w->chase_next) {
+    panic("chase: failed to allocate %" PRIu64 " pages", w->pages);
+  }
+
+  // Sattolo's algorithm: a uniformly random permutation with a single cycle.
+  for (uint64_t i = 0; i < w->pages; i++) {
+    w->chase_next[i] = (uint32_t)i;
+  }
+  for (uint64_t i = w->pages - 1; i > 0; i--) {
+    uint64_t j = random_below(w, i);
+    uint32_t swap = w->chase_next[i];
+    w->chase_next[i] = w->chase_next[j];
+    w->chase_next[j] = swap;
+  }
+}
+
+// ========================================================================
+// Parameters.
+// ========================================================================
+
+static uint64_t parse_uint(const char* spec, const char* name,
+                           const char* value) {
+  char* end;
+  unsigned long long parsed = strtoull(value, &end, 0);
+  if (*value == '\0' || *end != '\0') {
+    panic("Invalid value for %s in %s: %s", name, spec, value);
+  }
+  return parsed;
+}
+
+static double parse_double(const char* spec, const char* name,
+                           const char* value) {
+  char* end;
+  double parsed = strtod(value, &end);
+  if (*value == '\0' || *end != '\0') {
+    panic("Invalid value for %s in %s: %s", name, spec, value);
+  }
+  return parsed;
+}
+
+static void set_parameter(workload_t* w, const char* spec, const char* name,
+                          const char* value) {
+  if (strcmp(name, "count") == 0) {
+    w->count = parse_uint(spec, name, value);
+  } else if (strcmp(name, "seed") == 0) {
+    w->random_state = parse_uint(spec, name, value);
+  } else if (strcmp(name, "base") == 0) {
+    w->base_page = parse_uint(spec, name, value);
+  } else if (strcmp(name, "pages") == 0) {
+    w->pages = parse_uint(spec, name, value);
+  } else if (strcmp(name, "cores") == 0) {
+    w->cores = (uint32_t)parse_uint(spec, name, value);
+  } else if (strcmp(name, "processes") == 0) {
+    w->processes = (uint32_t)parse_uint(spec, name, value);
+  } else if (strcmp(name, "quantum") == 0) {
+    w->quantum = parse_uint(spec, name, value);
+  } else if (strcmp(name, "writes") == 0) {
+    w->writes = parse_double(spec, name, value);
+  } else if (strcmp(name, "stride") == 0 &&
+             (w->kind == WORKLOAD_SEQUENTIAL || w->kind == WORKLOAD_STRIDED)) {
+    w->stride = parse_uint(spec, name, value);
+  } else if (strcmp(name, "alpha") == 0 && w->kind == WORKLOAD_ZIPF) {
+    w->alpha = parse_double(spec, name, value);
+  } else if (strcmp(name, "scatter") == 0 && w->kind == WORKLOAD_ZIPF) {
+    w->scatter = parse_uint(spec, name, value) != 0;
+  } else if (strcmp(name, "phase") == 0 && w->kind == WORKLOAD_PHASED) {
+    w->phase = parse_uint(spec, name, value);
+  } else if (strcmp(name, "phases") == 0 && w->kind == WORKLOAD_PHASED) {
+    w->phases = parse_uint(spec, name, value);
+  } else if (strcmp(name, "shift") == 0 && w->kind == WORKLOAD_PHASED) {
+    w->shift = parse_uint(spec, name, value);
+  } else {
+    panic("Unknown parameter %s of %s", name, spec);
+  }
+}
+
+static void validate(const workload_t* w, const char* spec) {
+  if (w->pages == 0 || w->cores == 0 || w->cores > MAX_CORES) {
+    panic("%s: pages and cores must be at least 1, and cores at most %d", spec,
+          MAX_CORES);
+  }
+  if (w->processes == 0 || w->processes > MAX_ADDRESS_SPACES ||
+      w->quantum == 0) {
+    panic("%s: processes and quantum must be at least 1, and processes at "
+          "most %u",
+          spec, MAX_ADDRESS_SPACES);
+  }
+  if (!(w->writes >= 0 && w->writes <= 1)) {
+    panic("%s: writes must be a fraction between 0 and 1", spec);
+  }
+
+  // Highest page the generator can touch.
+  uint64_t span = w->pages;
+  switch (w->kind) {
+    case WORKLOAD_SEQUENTIAL:
+    case WORKLOAD_STRIDED:
+      if (w->stride == 0) {
+        panic("%s: stride must be at least 1", spec);
+      }
+      break;
+    case WORKLOAD_ZIPF:
+      if (!(w->alpha > 0)) {
+        panic("%s: alpha must be positive", spec);
+      }
+      break;
+    case WORKLOAD_PHASED:
+      if (w->phase == 0 || w->phases == 0) {
+        panic("%s: phase and phases must be at least 1", spec);
+      }
+      span += (w->phases - 1) * w->shift;
+      break;
+    default:
+      break;
+  }
+  if (w->base_page >= TOTAL_PAGES || span > TOTAL_PAGES - w->base_page) {
+    panic("%s: pages %" PRIu64 " to %" PRIu64
+          " do not fit the virtual address space",
+          spec, w->base_page, w->base_page + span - 1);
+  }
+}
+
+void workload_init(workload_t* w, const char* spec) {
+  memset(w, 0, sizeof(*w));
+
+  size_t kind_length = strcspn(spec, ":");
+  if (!parse_kind(spec, kind_length, &w->kind)) {
+    panic("Unknown workload: %s", spec);
+  }
+
+  w->count = DEFAULT_COUNT;
+  w->pages = DEFAULT_PAGES;
+  w->cores = 1;
+  w->processes = 1;
+  w->quantum = DEFAULT_QUANTUM;
+  w->random_state = DEFAULT_SEED;
+  w->stride = w->kind == WORKLOAD_STRIDED ? PAGE_SIZE_BYTES : 8;
+  w->alpha = DEFAULT_ALPHA;
+  w->scatter = true;
+  w->phase = DEFAULT_PHASE;
+  w->phases = DEFAULT_PHASES;
+
+  bool shift_set = false;
+  if (spec[kind_length] == ':') {
+    char* copy = strdup(spec + kind_length + 1);
+    if (!copy) {
+      panic("Failed to allocate the parameters of %s", spec);
+    }
+    char* saved;
+    for (char* token = strtok_r(copy, ",", &saved); token;
+         token = strtok_r(NULL, ",", &saved)) {
+      char* value = strchr(token, '=');
+      if (!value) {
+        panic("%s: expected parameter=value, got %s", spec, token);
+      }
+      *value++ = '\0';
+      set_parameter(w, spec, token, value);
+      shift_set |= strcmp(token, "shift") == 0;
+    }
+    free(copy);
+  }
+  if (!shift_set) {
+    w->shift = w->pages;
+  }
+
+  validate(w, spec);
+
+  // xorshift must not start from zero, and nearby seeds should not produce
+  // nearby streams.
+  w->random_state = mix(w->random_state) | 1;
+
+  if (w->kind == WORKLOAD_ZIPF) {
+    zipf_init(w);
+  } else if (w->kind == WORKLOAD_CHASE) {
+    chase_init(w);
+  }
+}
+
+bool workload_next(workload_t* w, va_t* address, op_t* op, uint32_t* core,
+                   asid_t* asid) {
+  if (w->generated == w->count) {
+    return false;
+  }
+
+  uint64_t span_bytes = w->pages << PAGE_SIZE_BITS;
+  va_t offset = 0;
+  switch (w->kind) {
+    case WORKLOAD_SEQUENTIAL:
+    case WORKLOAD_STRIDED:
+      offset = w->position;
+      w->position += w->stride;
+      if (w->position >= span_bytes) {
+        w->position %= span_bytes;
+      }
+      break;
+    case WORKLOAD_UNIFORM:
+      offset = random_below(w, span_bytes);
+      break;
+    case WORKLOAD_ZIPF: {
+      uint64_t page = zipf_rank(w) * w->zipf_multiplier % w->pages;
+      offset = (page << PAGE_SIZE_BITS) | (next_random(w) & PAGE_OFFSET_MASK);
+      break;
+    }
+    case WORKLOAD_PHASED: {
+      uint64_t window = w->generated / w->phase % w->phases * w->shift;
+      offset = (window << PAGE_SIZE_BITS) + random_below(w, span_bytes);
+      break;
+    }
+    case WORKLOAD_CHASE:
+      // Each node sits at a fixed, 8 byte aligned offset of its page.
+      offset = (w->position << PAGE_SIZE_BITS) |
+               (mix(w->position) & PAGE_OFFSET_MASK & ~(va_t)7);
+      w->position = w->chase_next[w->position];
+      break;
+  }
+
+  *address = (w->base_page << PAGE_SIZE_BITS) + offset;
+  *op = w->writes > 0 && random_double(w) < w->writes ? OP_WRITE : OP_READ;
+  *core = w->cores > 1 ? w->generated % w->cores : 0;
+  *asid = w->processes > 1
+              ? (w->generated / w->quantum + *core) % w->processes
+              : 0;
+  w->generated++;
+  return true;
+}
+
+void workload_free(workload_t* w) {
+  free(w->chase_next);
+  memset(w, 0, sizeof(*w));
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "memory.h"
+
+// Synthetic access patterns generated in process, so that arbitrarily long
+// runs need no trace file.
+typedef enum {
+  // Consecutive addresses, `stride` bytes apart (8 by default).
+  WORKLOAD_SEQUENTIAL,
+  // Like WORKLOAD_SEQUENTIAL, one page apart by default.
+  WORKLOAD_STRIDED,
+  // Uniformly random addresses.
+  WORKLOAD_UNIFORM,
+  // Zipf distributed pages: the page of rank k is accessed with probability
+  // proportional to 1 / k^alpha.
+  WORKLOAD_ZIPF,
+  // Uniformly random addresses in a working set of `pages` pages that moves
+  // `shift` pages every `phase` accesses, and back to the start after
+  // `phases` moves.
+  WORKLOAD_PHASED,
+  // Follows a single random cycle through every page, one dependent load
+  // per page, like a linked list walk.
+  WORKLOAD_CHASE,
+} workload_kind_t;
+
+typedef struct {
+  workload_kind_t kind;
+
+  // Parameters shared by every kind.
+  uint64_t count;
+  uint64_t base_page;
+  uint64_t pages;
+  uint32_t cores;
+  double writes;
+  // Processes taking turns on every core, each with its own address space,
+  // switched every `quantum` instructions. Cores start on different ones.
+  uint32_t processes;
+  uint64_t quantum;
+
+  // SEQUENTIAL/STRIDED.
+  uint64_t stride;
+  // ZIPF.
+  double alpha;
+  bool scatter;
+  // PHASED.
+  uint64_t phase;
+  uint64_t phases;
+  uint64_t shift;
+
+  // Generation state.
+  uint64_t generated;
+  uint64_t random_state;
+  uint64_t position;
+  double zipf_h_integral_x1;
+  double zipf_h_integral_n;
+  double zipf_s;
+  uint64_t zipf_multiplier;
+  uint32_t* chase_next;
+} workload_t;
+
+// Returns true if `spec` names a generator, `<kind>[:<key>=<value>,...]`,
+// rather than a trace file.
+bool workload_is_spec(const char* spec);
+
+// Sets up a generator from its spec. Panics on an invalid spec.
+void workload_init(workload_t* workload, const char* spec);
+
+// Generates the next instruction.
+// Returns false once `count` instructions have been generated.
+bool workload_next(workload_t* workload, va_t* address, op_t* op,
+                   uint32_t* core, asid_t* asid);
+
+void workload_free(workload_t* workload);
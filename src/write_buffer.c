@@ -0,0 +1,154 @@
+#include "write_buffer.h"
+
+#include <stdlib.h>
+
+#include "checkpoint.h"
+#include "log.h"
+#include "simulator.h"
+
+// A line waiting to be written to DRAM, and when its write completes. Lines
+// are written in order, so the write of a line starts when the one of the
+// line before it completes.
+typedef struct {
+  pa_dram_t line;
+  time_ns_t done_at;
+} write_buffer_entry_t;
+
+// Ring of the lines queued by a core, oldest first. Kept on separate cache
+// lines, as cores may be simulated by different host threads.
+typedef struct {
+  write_buffer_entry_t* entries;
+  uint32_t head;
+  uint32_t count;
+  write_buffer_stats_t stats;
+} __attribute__((aligned(64))) write_buffer_t;
+
+struct write_buffer_state {
+  write_buffer_entry_t* entries;
+  write_buffer_t cores[MAX_CORES];
+};
+
+static inline write_buffer_entry_t* entry_at(write_buffer_t* buffer,
+                                             uint32_t i) {
+  return &buffer->entries[(buffer->head + i) %
+                          sim->config.write_buffer_entries];
+}
+
+// Drops the lines written to DRAM by `now`.
+static void retire(write_buffer_t* buffer, time_ns_t now) {
+  while (buffer->count && entry_at(buffer, 0)->done_at <= now) {
+    buffer->head = (buffer->head + 1) % sim->config.write_buffer_entries;
+    buffer->count--;
+  }
+}
+
+void write_buffer_init() {
+  write_buffer_free();
+  uint32_t capacity = sim->config.write_buffer_entries;
+  if (!capacity) {
+    return;
+  }
+
+  struct write_buffer_state* state =
+      calloc(1, sizeof(struct write_buffer_state));
+  if (!state) {
+    panic("Failed to allocate the write buffers");
+  }
+  state->entries = calloc((size_t)sim->config.cores * capacity,
+                          sizeof(write_buffer_entry_t));
+  if (!state->entries) {
+    panic("Failed to allocate %u write buffer entries per core", capacity);
+  }
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    state->cores[core].entries = &state->entries[(size_t)core * capacity];
+  }
+  sim->write_buffer = state;
+}
+
+void write_buffer_free() {
+  if (sim->write_buffer) {
+    free(sim->write_buffer->entries);
+    free(sim->write_buffer);
+    sim->write_buffer = NULL;
+  }
+}
+
+void write_buffer_checkpoint(checkpoint_t* checkpoint) {
+  if (!sim->write_buffer) {
+    return;
+  }
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    write_buffer_t* buffer = &sim->write_buffer->cores[core];
+    checkpoint_array(checkpoint, buffer->entries,
+                     sim->config.write_buffer_entries,
+                     sizeof(write_buffer_entry_t));
+    checkpoint_value(checkpoint, buffer->head);
+    checkpoint_value(checkpoint, buffer->count);
+    checkpoint_value(checkpoint, buffer->stats);
+  }
+}
+
+bool write_buffer_access(pa_dram_t address, op_t op) {
+  write_buffer_t* buffer = &sim->write_buffer->cores[get_core()];
+  time_ns_t latency = sim->config.dram_latency_ns;
+  time_ns_t now = get_time();
+  pa_dram_t line = address >> WRITE_BUFFER_LINE_BITS;
+  retire(buffer, now);
+
+  if (op == OP_READ) {
+    for (uint32_t i = 0; i < buffer->count; i++) {
+      if (entry_at(buffer, i)->line == line) {
+        buffer->stats.forwarded++;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  buffer->stats.writes++;
+  // Lines whose write to DRAM has not started yet take the new data along.
+  for (uint32_t i = 0; i < buffer->count; i++) {
+    const write_buffer_entry_t* entry = entry_at(buffer, i);
+    if (entry->line == line && entry->done_at - latency > now) {
+      buffer->stats.coalesced++;
+      return true;
+    }
+  }
+
+  if (buffer->count == sim->config.write_buffer_entries) {
+    time_ns_t wait = entry_at(buffer, 0)->done_at - now;
+    log_dbg("Write buffer full, stalling for %" PRIu64 " ns", wait);
+    buffer->stats.stalls++;
+    buffer->stats.stall_ns += wait;
+    increment_time(wait);
+    now += wait;
+    retire(buffer, now);
+  }
+
+  time_ns_t start = now;
+  if (buffer->count) {
+    time_ns_t previous_done_at = entry_at(buffer, buffer->count - 1)->done_at;
+    if (previous_done_at > start) {
+      start = previous_done_at;
+    }
+  }
+  *entry_at(buffer, buffer->count++) =
+      (write_buffer_entry_t){.line = line, .done_at = start + latency};
+  return true;
+}
+
+void write_buffer_get_stats(write_buffer_stats_t* stats) {
+  *stats = (write_buffer_stats_t){0};
+  if (!sim->write_buffer) {
+    return;
+  }
+  for (unsigned core = 0; core < sim->config.cores; core++) {
+    const write_buffer_stats_t* core_stats =
+        &sim->write_buffer->cores[core].stats;
+    stats->writes += core_stats->writes;
+    stats->coalesced += core_stats->coalesced;
+    stats->forwarded += core_stats->forwarded;
+    stats->stalls += core_stats->stalls;
+    stats->stall_ns += core_stats->stall_ns;
+  }
+}
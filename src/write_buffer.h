@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "clock.h"
+#include "memory.h"
+
+// Write buffer between the MMU of every core and DRAM, off by default. The
+// page table updates and the write-backs of dirty TLB victims are queued in
+// it instead of waiting for DRAM: writes to a line still waiting for DRAM are
+// merged into it, and queued lines are written back one after the other in
+// the background, each taking the DRAM latency. A core only waits when its
+// buffer is full, until its oldest line has been written.
+//
+// Reads go ahead of the queued writes, and are served from the buffer when it
+// holds their line.
+typedef struct {
+  uint64_t writes;
+  uint64_t coalesced;
+  uint64_t forwarded;
+  uint64_t stalls;
+  time_ns_t stall_ns;
+} write_buffer_stats_t;
+
+// Sets up the write buffers of the current simulation, or resets them.
+void write_buffer_init();
+void write_buffer_free();
+
+struct checkpoint;
+// Saves or restores the write buffers of the current simulation.
+void write_buffer_checkpoint(struct checkpoint* checkpoint);
+
+// Runs a DRAM access of the current core through its write buffer. Returns
+// false if the access has to wait for DRAM.
+bool write_buffer_access(pa_dram_t address, op_t op);
+
+// Sums the statistics of the write buffers of every core.
+void write_buffer_get_stats(write_buffer_stats_t* stats);